@@ -0,0 +1,384 @@
+
+/* Micro benchmark of the power consumer kernels. Runs
+ * each consumer alone on a pinned core for a fixed time
+ * and measures its rate, IPC and how fast it reacts to
+ * the stop flag. The rate is in loops, as counted by
+ * the consumer itself, so it is known without
+ * performance counters. The asm kernels are also built with
+ * other loop alignment and unrolling than the shipped
+ * ones, to see how sensitive they are to code layout.
+ * Results are written as CSV for comparison between
+ * compilers and processor generations. Built and run by
+ * "make bench".
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/perf_event.h>
+
+#include "high-load.h"
+#include "jit.h"
+#include "misc.h"
+#include "perf.h"
+#include "hwprobe.h"
+
+
+//-------------------------------------------------------------
+#define BENCH_DFLT_TIME			1000											// Time in ms each kernel runs
+#define BENCH_DFLT_RUNS			5												// Runs per kernel
+#define BENCH_MAX_RUNS			100
+#define BENCH_DFLT_FILE			"bench.csv"
+
+/* Loop alignment and unroll variants of the asm kernels,
+ * as in BENCH_VARIANTS of the Makefile. */
+#define BENCH_VARIANTS \
+	X(2, 1) X(5, 1) X(7, 1) X(7, 2) X(7, 4)
+
+
+//-------------------------------------------------------------
+enum need_t {																	// What a kernel needs to run
+	NEED_NONE,
+	NEED_NEON,
+	NEED_ASIMD,
+	NEED_CRYPTO,
+	NEED_X86_V1,
+	NEED_X86_V3,
+	NEED_X86_V4,
+	NEED_JIT,																	// A code generator for this processor
+};
+
+struct kernel_t {
+	const char *name;
+	int align;																	// Loop .align, or 0 for C code
+	int unroll;
+	int (*func)(struct child_t *me);
+	enum need_t need;
+};
+
+struct result_t {
+	double iterPerSec;
+	double instrPerSec;
+	double ipc;
+	int64_t latency;															// Stop flag reaction in ns
+};
+
+struct run_t {
+	struct child_t child;
+	int (*func)(struct child_t *me);
+	int64_t startNs;															// When the consumer was called
+	int64_t endNs;																// When the consumer returned
+	uint32_t iters;																// Loops counted by the consumer
+	uint64_t cycles;
+	uint64_t instr;
+	int hasCounters;															// True when counters were read
+	int res;
+};
+
+
+//-------------------------------------------------------------
+int burn_cpu_generic(struct child_t *me);
+int stream_mem(struct child_t *me);
+#if defined(HAVE_ARM_CONSUMERS)													// Asm variants are only built for ARM
+#define X(a, u) \
+	extern int burn_cpu_neon_ ## a ## _ ## u(struct child_t *me); \
+	extern int burn_cpu_arm_ ## a ## _ ## u(struct child_t *me); \
+	extern int burn_cpu_crypto_ ## a ## _ ## u(struct child_t *me);
+BENCH_VARIANTS
+#undef X
+#endif
+#if defined(HAVE_A64_CONSUMERS)
+extern int burn_cpu_asimd(struct child_t *me);
+extern int burn_cpu_crypto(struct child_t *me);
+#endif
+#if defined(HAVE_X86_CONSUMERS)
+extern int burn_cpu_x86_v1(struct child_t *me);
+extern int burn_cpu_x86_v3(struct child_t *me);
+extern int burn_cpu_x86_v4(struct child_t *me);
+#endif
+
+
+//-------------------------------------------------------------
+/* The jit consumer has no loop counter in the generated
+ * code, its rate is only known by the instructions. */
+static const struct kernel_t kernels[] = {
+	{ "generic", 0, 0, burn_cpu_generic, NEED_NONE },
+	{ "mem", 0, 0, stream_mem, NEED_NONE },
+	{ "jit", 0, 0, jit_consumer, NEED_JIT },
+#if defined(HAVE_ARM_CONSUMERS)
+#define X(a, u) \
+	{ "arm", a, u, burn_cpu_arm_ ## a ## _ ## u, NEED_NONE }, \
+	{ "neon", a, u, burn_cpu_neon_ ## a ## _ ## u, NEED_NEON }, \
+	{ "crypto", a, u, burn_cpu_crypto_ ## a ## _ ## u, NEED_CRYPTO },
+BENCH_VARIANTS
+#undef X
+#endif
+#if defined(HAVE_A64_CONSUMERS)
+	{ "asimd", 7, 1, burn_cpu_asimd, NEED_ASIMD },
+	{ "crypto", 7, 1, burn_cpu_crypto, NEED_CRYPTO },
+#endif
+#if defined(HAVE_X86_CONSUMERS)
+	{ "x86-v1", 0, 0, burn_cpu_x86_v1, NEED_X86_V1 },
+	{ "x86-v3", 0, 0, burn_cpu_x86_v3, NEED_X86_V3 },
+	{ "x86-v4", 0, 0, burn_cpu_x86_v4, NEED_X86_V4 },
+#endif
+};
+
+static int benchTime = BENCH_DFLT_TIME;
+static int nRuns = BENCH_DFLT_RUNS;
+static int benchCpu = -1;														// Core the kernels run on
+static const char *csvFile = BENCH_DFLT_FILE;
+
+
+
+//-------------------------------------------------------------
+// Returns true when this system can run kernels that
+// need <need>, as by the hwcaps
+static int is_supported(const enum need_t need) {
+	switch(need) {
+		case NEED_NEON:
+			return hwIdent.hasNeon;
+
+		case NEED_ASIMD:
+			return hwIdent.hasAsimd;
+
+		case NEED_CRYPTO:
+			return hwIdent.hasCrypto;
+
+		case NEED_X86_V1:
+			return hwIdent.x86Level >= 1;
+
+		case NEED_X86_V3:
+			return hwIdent.x86Level >= 3;
+
+		case NEED_X86_V4:
+			return hwIdent.x86Level >= 4;
+
+		case NEED_JIT:
+			return jit_isa() != NULL;
+
+		default:
+			return 1;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Thread running one kernel, with counters around it
+static void* run_main(void *arg) {
+	struct run_t *run = arg;
+	int fds[2];
+
+	fds[0] = perf_open_thread(PERF_COUNT_HW_CPU_CYCLES);
+	fds[1] = perf_open_thread(PERF_COUNT_HW_INSTRUCTIONS);
+
+	run->startNs = mono_ns();
+	run->res = run->func(&run->child);
+	run->endNs = mono_ns();
+	run->iters = run->child.ctrl->iters;
+
+	run->hasCounters = fds[0] >= 0 && fds[1] >= 0 &&
+		read(fds[0], &run->cycles, sizeof(run->cycles)) == sizeof(run->cycles) &&
+		read(fds[1], &run->instr, sizeof(run->instr)) == sizeof(run->instr);
+	if(fds[0] >= 0) close(fds[0]);
+	if(fds[1] >= 0) close(fds[1]);
+
+	return NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Run kernel <k> once on the bench core. Returns 1 when
+// counters are missing, 0 on success and -1 on error.
+static int run_once(const struct kernel_t *k, struct result_t *result) {
+	struct child_ctrl_t *ctrl;
+	struct run_t run;
+	pthread_attr_t attr;
+	int64_t stopNs;
+	double secs;
+	int res;
+
+	if(posix_memalign((void**) &ctrl, CHILD_CTRL_ALIGN, sizeof(*ctrl))) {
+		perror("Error allocating control block");
+		return -1;
+	}
+	memset(ctrl, 0, sizeof(*ctrl));
+	ctrl->duty = 100;
+
+	memset(&run, 0, sizeof(run));
+	run.child.ctrl = ctrl;
+	run.func = k->func;
+	CPU_ZERO(&run.child.cpuMask);
+	CPU_SET(benchCpu, &run.child.cpuMask);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &run.child.cpuMask);
+	res = pthread_create(&run.child.thread, &attr, run_main, &run);
+	pthread_attr_destroy(&attr);
+	if(res) {
+		fprintf(stderr, "Error creating bench thread: %s\n", strerror(res));
+		free(ctrl);
+		return -1;
+	}
+
+	usleep(benchTime * 1000);
+	stopNs = mono_ns();
+	ctrl->stop = 1;
+	pthread_join(run.child.thread, NULL);
+	free(ctrl);
+
+	if(run.res) {
+		fprintf(stderr, "Error, kernel %s failed\n", k->name);
+		return -1;
+	}
+
+	secs = (run.endNs - run.startNs) / 1e9;
+	result->latency = run.endNs - stopNs;
+	result->iterPerSec = run.iters / secs;
+	result->instrPerSec = run.instr / secs;
+	result->ipc = run.cycles ? (double) run.instr / run.cycles : 0;
+
+	return run.hasCounters ? 0 : 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Sort order of qsort() for latencies
+static int cmp_latency(const void *a, const void *b) {
+	const struct result_t *ra = a, *rb = b;
+
+	return (ra->latency > rb->latency) - (ra->latency < rb->latency);
+}
+
+
+
+//-------------------------------------------------------------
+// Parse commandline arguments
+static int parse_args(int argc, char *argv[]) {
+	int arg;
+
+	while((arg = getopt(argc, argv, "c:ho:r:t:")) != -1) {
+		switch(arg) {
+			case 'c':
+				benchCpu = atoi(optarg);
+				break;
+
+			case 'o':
+				csvFile = optarg;
+				break;
+
+			case 'r':
+				nRuns = atoi(optarg);
+				break;
+
+			case 't':
+				benchTime = atoi(optarg);
+				break;
+
+			default:
+				printf("Usage: rpiburn-bench [options]\n");
+				printf("    -c <cpu>     Core to run the kernels on, default the last\n");
+				printf("    -o <file>    Write results as CSV to <file>, default %s\n", BENCH_DFLT_FILE);
+				printf("    -r <n>       Runs per kernel, default %d\n", BENCH_DFLT_RUNS);
+				printf("    -t <msec>    Time each kernel runs, default %d\n", BENCH_DFLT_TIME);
+				return -1;
+		}
+	}
+
+	if(nRuns < 1 || nRuns > BENCH_MAX_RUNS || benchTime < 1) {
+		fprintf(stderr, "Error, invalid number of runs or time\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// The main
+int main(int argc, char *argv[]) {
+	struct result_t results[BENCH_MAX_RUNS];
+	const struct kernel_t *k;
+	double iterPerSec, instrPerSec, ipc;
+	int i, n, res, hasCounters;
+	FILE *fp;
+
+	rpiburn_set_log(rpiburn_log_stdio, NULL);
+	if(parse_args(argc, argv)) return EXIT_FAILURE;
+	if(hw_probe(1)) return EXIT_FAILURE;
+	for(i = 0, n = 0; benchCpu < 0 && i < HW_MAX_CPUS; i++) {
+		if(hwIdent.cpu[i].online) n = i;
+	}
+	if(benchCpu < 0) benchCpu = n;
+	if(benchCpu >= HW_MAX_CPUS || !hwIdent.cpu[benchCpu].online) {
+		fprintf(stderr, "Error, core %d is not online\n", benchCpu);
+		return EXIT_FAILURE;
+	}
+
+	fp = fopen(csvFile, "w");
+	if(!fp) {
+		perror("Error creating CSV file");
+		return EXIT_FAILURE;
+	}
+	fprintf(fp, "compiler,cpu,kernel,align,unroll,iter_per_s,instr_per_s,ipc,"
+		"stop_us_median,stop_us_max\n");
+
+	printf("Benchmarking consumers on core %d, %d runs of %d ms\n", benchCpu,
+		nRuns, benchTime);
+	printf("  %-8s %5s %6s %12s %12s %5s %10s %10s\n", "kernel", "align",
+		"unroll", "iter/s", "instr/s", "IPC", "stop us", "max us");
+
+	res = 0;
+	hasCounters = 1;
+	for(k = kernels; k < kernels + sizeof(kernels) / sizeof(kernels[0]) && !res; k++) {
+		if(!is_supported(k->need)) continue;
+		if(k->need == NEED_JIT && jit_prepare()) continue;
+
+		iterPerSec = 0;
+		instrPerSec = 0;
+		ipc = 0;
+		for(n = 0; n < nRuns && !res; n++) {
+			res = run_once(k, &results[n]);
+			if(res > 0) {
+				hasCounters = 0;
+				res = 0;
+			}
+			iterPerSec += results[n].iterPerSec / nRuns;
+			instrPerSec += results[n].instrPerSec / nRuns;
+			ipc += results[n].ipc / nRuns;
+		}
+		if(res) break;
+		qsort(results, nRuns, sizeof(results[0]), cmp_latency);
+
+		printf("  %-8s %5d %6d %12.4g %12.4g %5.2f %10.1f %10.1f\n", k->name,
+			k->align, k->unroll, iterPerSec, instrPerSec, ipc,
+			results[nRuns / 2].latency / 1e3, results[nRuns - 1].latency / 1e3);
+		fprintf(fp, "\"%s\",\"%s\",%s,%d,%d,%.0f,%.0f,%.3f,%.1f,%.1f\n", __VERSION__,
+			hwIdent.model[0] ? hwIdent.model : hwIdent.cpuName, k->name, k->align,
+			k->unroll, iterPerSec, instrPerSec, ipc, results[nRuns / 2].latency / 1e3,
+			results[nRuns - 1].latency / 1e3);
+	}
+
+	if(fclose(fp)) {
+		perror("Error writing CSV file");
+		res = -1;
+	}
+	if(!hasCounters) printf("Warning, no performance counters; instr/s and IPC are zero\n");
+	if(!res) printf("Results written to %s\n", csvFile);
+
+	return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,440 @@
+
+/* Black box recorder for brownout forensics. A real
+ * brownout often resets the board before we can tell
+ * anything, so every trace event and every firmware poll
+ * is also written as a fixed size record into a file
+ * mapped in memory. The file is preallocated so writing
+ * never allocates blocks. Write back of changed pages is
+ * started in record order at a low rate, without waiting
+ * for the disk, and waited for when the throttled bits
+ * change and at close. After a reboot --postmortem
+ * decodes the timeline of the last run up to where power
+ * failed.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "blackbox.h"
+#include "freqmon.h"
+#include "high-load.h"
+#include "hwprobe.h"
+#include "misc.h"
+
+
+//-------------------------------------------------------------
+#define BB_MAGIC				"RPIBBOX"
+#define BB_VERSION				2												// Bump when the file format change
+#define BB_HDR_SIZE				4096											// Header page
+#define BB_N_RECS				16384											// Records in the ring
+#define BB_SYNC_PERIOD			250												// Max time in ms between write backs
+#define BB_MAX_LISTED			200												// Max number of records we print
+#define BB_EV_SAMPLE			0xffff											// Record event of a periodic sample
+#define BB_MAX_NAMES			16												// Max consumer names in header
+
+
+//-------------------------------------------------------------
+struct bb_rec_t {
+	uint32_t seq;																// Written last, zero when empty
+	uint16_t event;																// Trace event or BB_EV_SAMPLE
+	uint8_t phase;																// enum freq_phase_t
+	uint8_t check;																// Sum of all other bytes
+	int64_t ns;																	// Time since start of run
+	uint32_t throttVal;															// Last firmware throttled value
+	int32_t milliC;																// SoC temperature, or 0
+	int32_t arg;																// Event argument
+	uint16_t nActive;															// Childs running their consumer
+	uint16_t kinds;																// Bit per consumer kind running
+};
+
+struct bb_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t recSize;
+	uint32_t nRecs;
+	uint32_t isClean;															// True when the run ended by itself
+	int64_t startTime;															// Wall clock at start, in seconds
+	char model[128];
+	char map[512];
+	char names[BB_MAX_NAMES][12];												// Name of each consumer kind bit
+	uint64_t seed;																// Master seed of worker random numbers
+};
+
+
+//-------------------------------------------------------------
+static const char *phaseNames[FREQ_N_PHASES] = {
+	[FREQ_PH_IDLE] = "idle",
+	[FREQ_PH_SPAWN] = "spawn",
+	[FREQ_PH_LOAD] = "load",
+	[FREQ_PH_ENDING] = "ending",
+};
+
+static int isOpen;																// True when recording
+static int fd = -1;
+static uint8_t *area;															// Mapped file
+static size_t areaLen;
+static struct bb_header_t *hdr;
+static struct bb_rec_t *recs;
+static uint32_t seq;															// Last reserved sequence number
+static uint32_t syncedSeq;														// Records up to here are on disk
+static int64_t mono0;															// Start of run
+static int64_t lastSyncNs;
+static volatile uint8_t phase;
+static volatile uint32_t throttVal;
+static volatile int32_t milliC;
+static volatile uint16_t nActive;
+static volatile uint16_t kinds;
+
+
+
+//-------------------------------------------------------------
+// Checksum of a record, all bytes except the check byte
+static uint8_t rec_check(const struct bb_rec_t *rec) {
+	struct bb_rec_t tmp;
+	const uint8_t *p;
+	uint8_t sum;
+	int i;
+
+	tmp = *rec;
+	tmp.check = 0;
+	p = (const uint8_t*) &tmp;
+	for(i = 0, sum = 0x5a; i < (int) sizeof(tmp); i++) sum += p[i];
+
+	return sum;
+}
+
+
+
+//-------------------------------------------------------------
+// Write back the mapped bytes <from> to <to>. Either
+// wait for the disk, or only start the write. MS_ASYNC
+// does nothing since Linux 2.6.19, so the latter goes
+// by the file range instead of the mapping.
+static void sync_range(const uintptr_t from, const uintptr_t to, const int isWait) {
+	if(isWait) {
+		msync((void*) from, to - from, MS_SYNC);
+	}
+	else {
+		sync_file_range(fd, from - (uintptr_t) area, to - from,
+			SYNC_FILE_RANGE_WRITE);
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Sync the records written since last time to disk,
+// oldest first so the file is always a prefix of the
+// run. Stops at the first slot reserved but not yet
+// written; it is taken the next time. Waits for the
+// disk when <isWait> is true. Runs in the monitor thread
+// only.
+static void sync_recs(const int isWait) {
+	uintptr_t pageMask, from, to;
+	uint32_t last, i, j;
+
+	last = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+	if(last - syncedSeq >= BB_N_RECS) syncedSeq = last - BB_N_RECS;
+	for(j = syncedSeq; j != last; j++) {
+		if((int32_t) (__atomic_load_n(&recs[j % BB_N_RECS].seq, __ATOMIC_ACQUIRE) -
+				(j + 1)) < 0) {
+			break;																// Not committed
+		}
+	}
+	last = j;
+	if(last == syncedSeq) return;
+
+	pageMask = ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+	i = syncedSeq % BB_N_RECS;													// First unsynced slot
+	j = (last - 1) % BB_N_RECS;													// Last committed slot
+	from = (uintptr_t) &recs[i] & pageMask;
+	to = (uintptr_t) &recs[i <= j ? j + 1 : BB_N_RECS];
+	sync_range(from, to, isWait);
+	if(i > j) {																	// Wrapped
+		from = (uintptr_t) &recs[0] & pageMask;
+		to = (uintptr_t) &recs[j + 1];
+		sync_range(from, to, isWait);
+	}
+
+	syncedSeq = last;
+	lastSyncNs = mono_ns();
+}
+
+
+
+//-------------------------------------------------------------
+// Create the recorder file and start recording. Records
+// of any previous run are cleared.
+int blackbox_open(const char *fileName) {
+	const char *name;
+	int i, res;
+
+	areaLen = BB_HDR_SIZE + BB_N_RECS * sizeof(struct bb_rec_t);
+	fd = open(fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd == -1) {
+		log_errno("Error opening black box file");
+		return -1;
+	}
+
+	res = posix_fallocate(fd, 0, areaLen);
+	if(res) {
+		log_error("Error allocating black box file: %s\n", strerror(res));
+		close(fd);
+		return -1;
+	}
+
+	area = mmap(NULL, areaLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(area == MAP_FAILED) {
+		log_errno("Error mapping black box file");
+		close(fd);
+		return -1;
+	}
+	hdr = (struct bb_header_t*) area;
+	recs = (struct bb_rec_t*) (area + BB_HDR_SIZE);
+
+	memset(area, 0, areaLen);
+	memcpy(hdr->magic, BB_MAGIC, sizeof(BB_MAGIC));
+	hdr->version = BB_VERSION;
+	hdr->recSize = sizeof(struct bb_rec_t);
+	hdr->nRecs = BB_N_RECS;
+	hdr->startTime = time(NULL);
+	snprintf(hdr->model, sizeof(hdr->model), "%s", hwIdent.model);
+	hdr->seed = high_load_get_seed();
+	snprintf(hdr->map, sizeof(hdr->map), "%s", high_load_get_map());
+	for(i = 0; i < BB_MAX_NAMES && (name = high_load_consumer_name(i)); i++) {
+		snprintf(hdr->names[i], sizeof(hdr->names[i]), "%s", name);
+	}
+	if(msync(area, areaLen, MS_SYNC)) {
+		log_errno("Error syncing black box file");
+		return -1;
+	}
+
+	mono0 = mono_ns();
+	lastSyncNs = mono0;
+	seq = 0;
+	syncedSeq = 0;
+	isOpen = 1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Record an event. Called from the trace hook by any
+// thread; slots are reserved by an atomic add and the
+// sequence number is written last. Polls of the firmware
+// also sample the temperature and running consumers,
+// and sync the file when it is time.
+void blackbox_event(const enum trace_event_t event, const int arg) {
+	struct bb_rec_t rec;
+	uint32_t n;
+	uint16_t k;
+	int temp;
+
+	if(likely(!isOpen)) return;
+
+	switch(event) {
+		case TR_CYCLE_BEGIN: phase = FREQ_PH_SPAWN; break;
+		case TR_LOAD_BEGIN: phase = FREQ_PH_LOAD; break;
+		case TR_LOAD_END: phase = FREQ_PH_ENDING; break;
+		case TR_CYCLE_END: phase = FREQ_PH_IDLE; break;
+
+		case TR_VCHIQ_POLL:
+			throttVal = arg;
+			milliC = read_soc_temp(&temp) ? 0 : temp;
+			nActive = high_load_active(&k);
+			kinds = k;
+			break;
+
+		case TR_THROTTLED:
+			throttVal = arg;
+			break;
+
+		default:
+			break;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.event = event == TR_VCHIQ_POLL ? BB_EV_SAMPLE : event;
+	rec.phase = phase;
+	rec.ns = mono_ns() - mono0;
+	rec.throttVal = throttVal;
+	rec.milliC = milliC;
+	rec.arg = arg;
+	rec.nActive = nActive;
+	rec.kinds = kinds;
+
+	n = __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED);
+	rec.seq = n;
+	rec.check = rec_check(&rec);
+	rec.seq = 0;
+	recs[(n - 1) % BB_N_RECS] = rec;											// Sequence number last
+	__atomic_store_n(&recs[(n - 1) % BB_N_RECS].seq, n, __ATOMIC_RELEASE);
+
+	/* Waiting for the disk would stall the monitor, so
+	 * the periodic write back doesn't. A change of the
+	 * throttled bits may be the last thing we see. */
+	if(event == TR_THROTTLED) {
+		sync_recs(1);
+	}
+	else if(event == TR_VCHIQ_POLL && mono_ns() - lastSyncNs >= BB_SYNC_PERIOD * 1000000LL) {
+		sync_recs(0);
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Stop recording and mark the run as ended by itself
+void blackbox_close(void) {
+	if(!isOpen) return;
+	isOpen = 0;
+
+	sync_recs(1);
+	hdr->isClean = 1;
+	msync(area, BB_HDR_SIZE, MS_SYNC);
+	munmap(area, areaLen);
+	close(fd);
+	fd = -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Sort order of qsort() for records
+static int cmp_seq(const void *a, const void *b) {
+	const struct bb_rec_t *ra = a, *rb = b;
+
+	return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+
+
+//-------------------------------------------------------------
+// Print one record of the timeline
+static void print_rec(const struct bb_header_t *h, const struct bb_rec_t *rec) {
+	char buf[128];
+	int i, len;
+
+	log_info("  %10.3f ms  %-6s  %-10s", rec->ns / 1e6, rec->phase < FREQ_N_PHASES ?
+		phaseNames[rec->phase] : "?", rec->event == BB_EV_SAMPLE ? "sample" :
+		trace_event_name(rec->event));
+	if(rec->event != BB_EV_SAMPLE) log_info(" %-6d", rec->arg);
+	else log_info(" %-6s", "");
+	log_info("  0x%05x", rec->throttVal);
+	if(rec->milliC) log_info("  %5.1f C", rec->milliC / 1000.0);
+
+	buf[0] = 0;
+	for(i = 0, len = 0; i < BB_MAX_NAMES && len < (int) sizeof(buf); i++) {
+		if(!(rec->kinds & (1u << i))) continue;
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%.*s", len ? "," : "",
+			(int) sizeof(h->names[i]), h->names[i]);
+	}
+	log_info("  %u running%s%s%s\n", rec->nActive, buf[0] ? " (" : "", buf,
+		buf[0] ? ")" : "");
+}
+
+
+
+//-------------------------------------------------------------
+// Read header and valid records of a black box file,
+// oldest first. Returns number of records or -1.
+static int read_box(const char *fileName, struct bb_header_t *h, struct bb_rec_t **all) {
+	struct stat st;
+	uint32_t i, n;
+	FILE *fp;
+
+	fp = fopen(fileName, "r");
+	if(!fp) {
+		log_errno("Error opening black box file");
+		return -1;
+	}
+
+	if(fread(h, sizeof(*h), 1, fp) != 1 || memcmp(h->magic, BB_MAGIC, sizeof(BB_MAGIC)) ||
+			h->version != BB_VERSION || h->recSize != sizeof(struct bb_rec_t) ||
+			fstat(fileno(fp), &st) || st.st_size < BB_HDR_SIZE +
+			(off_t) h->nRecs * h->recSize) {
+		log_error("Error, %s is not a black box file\n", fileName);
+		fclose(fp);
+		return -1;
+	}
+
+	*all = malloc(h->nRecs * sizeof(struct bb_rec_t));
+	if(!*all || fseek(fp, BB_HDR_SIZE, SEEK_SET) ||
+			fread(*all, sizeof(struct bb_rec_t), h->nRecs, fp) != h->nRecs) {
+		log_errno("Error reading black box file");
+		free(*all);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	for(i = 0, n = 0; i < h->nRecs; i++) {
+		if((*all)[i].seq && (*all)[i].check == rec_check(&(*all)[i])) (*all)[n++] = (*all)[i];
+	}
+	qsort(*all, n, sizeof(struct bb_rec_t), cmp_seq);
+	h->model[sizeof(h->model) - 1] = 0;
+	h->map[sizeof(h->map) - 1] = 0;
+
+	return n;
+}
+
+
+
+//-------------------------------------------------------------
+// Decode the black box of the last run. Only records
+// with a valid checksum are used, a torn record at the
+// moment power failed is skipped.
+int blackbox_postmortem(const char *fileName) {
+	struct bb_header_t h;
+	struct bb_rec_t *all, *last;
+	time_t start;
+	int i, n;
+
+	n = read_box(fileName, &h, &all);
+	if(n < 0) return -1;
+
+	start = h.startTime;
+	log_info("Black box of run started %s", ctime(&start));
+	log_info("  Board %s, consumer map %s, seed %llu\n", h.model, h.map,
+		(unsigned long long) h.seed);
+	log_info("  %d records", n);
+	if(n && all[n - 1].seq > (uint32_t) n) log_info(", %u older overwritten or lost", all[n - 1].seq - n);
+	log_info("\n");
+
+	if(n) log_info("Timeline%s:\n", n > BB_MAX_LISTED ? " (last records)" : "");
+	for(i = n > BB_MAX_LISTED ? n - BB_MAX_LISTED : 0; i < n; i++) print_rec(&h, &all[i]);
+
+	last = n ? &all[n - 1] : NULL;
+	if(h.isClean) {
+		log_info("The run ended normally\n");
+	}
+	else if(last) {
+		log_info("The run never ended; power presumably failed %.3f ms after start,\n",
+			last->ns / 1e6);
+		log_info("  during %s with %u consumers running, throttled 0x%05x",
+			last->phase < FREQ_N_PHASES ? phaseNames[last->phase] : "?",
+			last->nActive, last->throttVal);
+		if(last->milliC) log_info(", %.1f C", last->milliC / 1000.0);
+		log_info("\n");
+	}
+	else {
+		log_info("The run never ended and left no records\n");
+	}
+	free(all);
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+
+#ifndef BLACKBOX_H
+#define BLACKBOX_H
+
+#include "trace.h"
+
+
+//-------------------------------------------------------------
+int blackbox_open(const char *fileName);
+void blackbox_event(const enum trace_event_t event, const int arg);
+void blackbox_close(void);
+int blackbox_postmortem(const char *fileName);
+
+#endif
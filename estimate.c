@@ -0,0 +1,452 @@
+
+/* Software estimate of the board current, for the many
+ * boards without a meter attached. The current mostly
+ * depends on the SoC, how busy and how fast its cores
+ * are, what the consumers do and the I/O activity. We
+ * use a linear model of
+ *   base + cycles/s + instructions/s + Neon + I/O workers
+ * where the cycles and instructions come from the
+ * performance counters of every core, or from the
+ * processor load and clock when the counters aren't
+ * available. The coefficients are per SoC, from a built
+ * in table or fitted against a real meter by a
+ * calibration run.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "estimate.h"
+#include "main.h"
+#include "misc.h"
+#include "high-load.h"
+#include "hwprobe.h"
+#include "storage.h"
+#include "perf.h"
+
+
+//-------------------------------------------------------------
+#define EST_PERIOD				250												// Time in ms between samples
+#define EST_PRINT_PERIOD		1000											// Time in ms between live reports
+#define EST_DFLT_IPC			1.0												// Instructions per cycle when not counted
+#define EST_DFLT_GHZ			1.0												// Core clock when unknown
+#define EST_RIDGE				1e-3											// Pull of fit towards the table coefficients
+#define EST_MAX_STEPS			5												// Number of calibration steps
+#define EST_MAP_LEN				(HW_MAX_CPUS * 16 + 64)
+
+
+//-------------------------------------------------------------
+enum est_coef_id_t {															// Terms of the model
+	EST_BASE,																	// mA when idle
+	EST_CYCLES,																	// mA per G cycles per second
+	EST_INSTR,																	// mA per G instructions per second
+	EST_NEON,																	// mA per GHz of running Neon consumers
+	EST_IO,																		// mA per running I/O consumer
+	EST_N_COEF
+};
+
+struct est_coef_t {
+	enum cpuid_t cpuId;
+	double coef[EST_N_COEF];
+};
+
+
+//-------------------------------------------------------------
+static const char *coefNames[EST_N_COEF] = {
+	[EST_BASE] = "base",
+	[EST_CYCLES] = "cycles",
+	[EST_INSTR] = "instructions",
+	[EST_NEON] = "neon",
+	[EST_IO] = "io",
+};
+
+/* Starting points, fitted to the measured figures of
+ * the README at full load. Calibrate for accuracy. */
+static const struct est_coef_t coefTable[] = {
+	{ CPU_BCM2835, { 200, 150, 20,   0, 40 } },
+	{ CPU_BCM2836, { 230,  80, 20,  60, 40 } },
+	{ CPU_BCM2837, { 300,  80, 20, 108, 40 } },
+	{ CPU_BCM2711, { 600,  90, 20,  60, 50 } },
+	{ CPU_BCM2712, { 700, 100, 15,  50, 50 } },
+};
+
+static int isEnabled;															// True when estimating
+static double coef[EST_N_COEF];
+static int hasCoef;																// True when coefficients are known
+static int isCalibrated;														// True when coefficients are from a file
+static struct perf_cores_t perf;												// Cycle and instruction counters, or -1
+static int hasPerf;																// True when counters are used
+static uint64_t lastCnt[HW_MAX_CPUS][2];
+static struct cpu_stat_t lastStat[HW_MAX_CPUS];
+static int64_t lastNs;															// Time of last sample
+static struct timespec sampleTimer;
+static struct timespec printTimer;
+static double sumX[EST_N_COEF];													// Sum of terms of samples at full load
+static int nSum;
+static double lastMa;
+static double sumMa;
+static double peakMa;
+
+
+
+//-------------------------------------------------------------
+// Load coefficients from a file written by a calibration
+// run, with one "name value" pair per line.
+int estimate_load(const char *fileName) {
+	char line[128], name[32];
+	int i, nFound;
+	double val;
+	FILE *fp;
+
+	fp = fopen(fileName, "r");
+	if(!fp) {
+		perror("Error opening coefficient file");
+		return -1;
+	}
+
+	nFound = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		if(line[0] == '#' || sscanf(line, "%31s %lf", name, &val) != 2) continue;
+		for(i = 0; i < EST_N_COEF && strcmp(name, coefNames[i]); i++);
+		if(i == EST_N_COEF) continue;
+		coef[i] = val;
+		nFound++;
+	}
+	fclose(fp);
+
+	if(nFound != EST_N_COEF) {
+		fprintf(stderr, "Error, %s is not a complete coefficient file\n", fileName);
+		return -1;
+	}
+	hasCoef = 1;
+	isCalibrated = 1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the current clock of core <cpu> in GHz
+static double core_ghz(const int cpu) {
+	char path[256];
+	long khz;
+
+	if(sys_path(path, sizeof(path),
+			"/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu) ||
+			read_file_long(path, &khz) || khz <= 0) {
+		return EST_DFLT_GHZ;
+	}
+
+	return khz / 1e6;
+}
+
+
+
+//-------------------------------------------------------------
+// Sample the terms of the model since the last call
+static void sample_terms(double *x) {
+	struct cpu_stat_t stat[HW_MAX_CPUS];
+	uint64_t cnt[2];
+	int cpus[HW_MAX_CPUS];
+	int64_t ns;
+	double dt, busy;
+	int i, n;
+
+	ns = mono_ns();
+	dt = (ns - lastNs) / 1e9;
+	lastNs = ns;
+	if(dt <= 0) dt = 1e-9;
+
+	memset(x, 0, EST_N_COEF * sizeof(double));
+	x[EST_BASE] = 1;
+
+	if(hasPerf) {
+		for(i = 0; i < HW_MAX_CPUS; i++) {
+			if(perf_read_core(&perf, i, &cnt[0], &cnt[1])) continue;
+			x[EST_CYCLES] += (cnt[0] - lastCnt[i][0]) / dt / 1e9;
+			x[EST_INSTR] += (cnt[1] - lastCnt[i][1]) / dt / 1e9;
+			lastCnt[i][0] = cnt[0];
+			lastCnt[i][1] = cnt[1];
+		}
+	}
+	else if(!read_cpu_stat(stat, HW_MAX_CPUS)) {
+		// Busy time at the current clock, with a typical IPC
+		for(i = 0; i < HW_MAX_CPUS; i++) {
+			if(!hwIdent.cpu[i].online || stat[i].total == lastStat[i].total) continue;
+			busy = (double) (stat[i].busy - lastStat[i].busy) /
+				(stat[i].total - lastStat[i].total);
+			x[EST_CYCLES] += busy * core_ghz(i);
+			lastStat[i] = stat[i];
+		}
+		x[EST_INSTR] = x[EST_CYCLES] * EST_DFLT_IPC;
+	}
+
+	n = high_load_running_cpus("neon", cpus, HW_MAX_CPUS);
+	n += high_load_running_cpus("crypto", cpus + n, HW_MAX_CPUS - n);			// Also on the Neon unit
+	for(i = 0; i < n; i++) x[EST_NEON] += core_ghz(cpus[i]);
+	x[EST_IO] = high_load_running_cpus("io", cpus, HW_MAX_CPUS) +
+		high_load_running_cpus("write", cpus, HW_MAX_CPUS);
+}
+
+
+
+//-------------------------------------------------------------
+// Take a sample and update the estimate. The terms are
+// summed when <doSum> is true, for the average and for
+// calibration.
+static void take_sample(const int doSum) {
+	double x[EST_N_COEF];
+	int i;
+
+	sample_terms(x);
+	for(i = 0, lastMa = 0; i < EST_N_COEF; i++) lastMa += coef[i] * x[i];
+
+	if(doSum) {
+		for(i = 0; i < EST_N_COEF; i++) sumX[i] += x[i];
+		nSum++;
+		sumMa += lastMa;
+		if(lastMa > peakMa) peakMa = lastMa;
+	}
+
+	timer_set(&sampleTimer, EST_PERIOD);
+}
+
+
+
+//-------------------------------------------------------------
+// Start estimating. Uses the coefficients of this SoC
+// unless a calibration file has been loaded. Fails when
+// there are none and <needCoef> is true.
+int estimate_init(const int needCoef) {
+	int i;
+
+	for(i = 0; !hasCoef && i < (int) (sizeof(coefTable) / sizeof(coefTable[0])); i++) {
+		if(coefTable[i].cpuId != hwIdent.cpuId) continue;
+		memcpy(coef, coefTable[i].coef, sizeof(coef));
+		hasCoef = 1;
+	}
+	if(!hasCoef && needCoef) {
+		fprintf(stderr, "Error, no current coefficients for this processor, "
+			"calibrate first\n");
+		return -1;
+	}
+
+	hasPerf = !perf_open_cores(&perf);
+
+	printf("Estimating current from %s\n", hasPerf ?
+		"performance counters" : "processor load and clock");
+
+	isEnabled = 1;
+	lastNs = mono_ns();
+	take_sample(0);																// Counter base values
+	timer_set(&printTimer, EST_PRINT_PERIOD);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Sample while the test runs and print the estimate
+// live at full load. Called from the main loop.
+int estimate_manager(void) {
+	if(!isEnabled) return 0;
+
+	if(timer_timeout(&sampleTimer)) take_sample(high_load_is_full());
+	maxSleep(timer_remaining(&sampleTimer));
+
+	if(high_load_is_full() && hasCoef && timer_timeout(&printTimer)) {
+		printf("  estimated %.0f mA\n", lastMa);
+		timer_set(&printTimer, EST_PRINT_PERIOD);
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Solve <a> x = <b> of size <n> by Gaussian elimination
+// with partial pivoting. The result is left in <b>.
+static int solve(double a[EST_N_COEF][EST_N_COEF], double *b, const int n) {
+	int i, j, k, piv;
+	double f, tmp;
+
+	for(i = 0; i < n; i++) {
+		for(piv = i, j = i + 1; j < n; j++) {
+			if(fabs(a[j][i]) > fabs(a[piv][i])) piv = j;
+		}
+		if(fabs(a[piv][i]) < 1e-12) return -1;
+
+		for(k = 0; k < n; k++) {
+			tmp = a[i][k];
+			a[i][k] = a[piv][k];
+			a[piv][k] = tmp;
+		}
+		tmp = b[i];
+		b[i] = b[piv];
+		b[piv] = tmp;
+
+		for(j = i + 1; j < n; j++) {
+			f = a[j][i] / a[i][i];
+			for(k = i; k < n; k++) a[j][k] -= f * a[i][k];
+			b[j] -= f * b[i];
+		}
+	}
+
+	for(i = n - 1; i >= 0; i--) {
+		for(k = i + 1; k < n; k++) b[i] -= a[i][k] * b[k];
+		b[i] /= a[i][i];
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Calibrate against a real meter. Runs a series of load
+// steps, from idle to all cores plus I/O, and asks the
+// user for the meter reading of each. Coefficients are
+// fitted by least squares with a weak pull towards the
+// table values, so terms the steps can't tell apart keep
+// sensible values. The result is written to <fileName>.
+int estimate_calibrate(const char *fileName) {
+	char map[EST_MAP_LEN], prevMap[EST_MAP_LEN], line[64];
+	double x[EST_MAX_STEPS][EST_N_COEF], y[EST_MAX_STEPS];
+	double ata[EST_N_COEF][EST_N_COEF], atb[EST_N_COEF], lambda, est;
+	struct timespec stepTimer;
+	int i, j, k, step, nSteps, len, res;
+	FILE *fp;
+
+	nSteps = storage_n_devs() ? EST_MAX_STEPS : EST_MAX_STEPS - 1;
+	snprintf(prevMap, sizeof(prevMap), "%s", high_load_get_map());
+	printf("Calibrating current estimate in %d steps, read the meter "
+		"during each step...\n", nSteps);
+
+	res = 0;
+	for(step = 0; step < nSteps && !res; step++) {
+		memset(sumX, 0, sizeof(sumX));
+		nSum = 0;
+
+		/* Idle, one core, all cores with the generic
+		 * and the best processor consumer, then all
+		 * cores plus I/O. */
+		for(i = 0, len = 0, map[0] = 0; step && i < high_load_cores(); i++) {
+			if(step == 1 && i) break;
+			len += snprintf(map + len, sizeof(map) - len, "%s%s", i ? "," : "",
+				step < 3 ? "generic" : "cpu");
+		}
+		for(i = 0; step == 4 && i < storage_n_devs(); i++) {
+			len += snprintf(map + len, sizeof(map) - len, ",io");
+		}
+		printf("Step %d of %d: %s\n", step + 1, nSteps, step ? map : "idle");
+
+		if(!step) {
+			timer_set(&stepTimer, run_load_time());
+			take_sample(0);
+			while(!res && !isExitRequested() && !timer_timeout(&stepTimer)) {
+				res = run_idle(timer_remaining(&sampleTimer));
+				if(!res && timer_timeout(&sampleTimer)) take_sample(1);
+			}
+		}
+		else {
+			res = high_load_set_map(map);
+			if(!res) res = run_cycle();
+		}
+		if(res || isExitRequested()) break;
+		if(!nSum) {
+			fprintf(stderr, "Error, no samples at full load\n");
+			res = -1;
+			break;
+		}
+
+		for(i = 0; i < EST_N_COEF; i++) x[step][i] = sumX[i] / nSum;
+		printf("Meter reading in mA: ");
+		fflush(stdout);
+		if(!fgets(line, sizeof(line), stdin) || sscanf(line, "%lf", &y[step]) != 1 ||
+				y[step] <= 0) {
+			fprintf(stderr, "Error, invalid meter reading\n");
+			res = -1;
+		}
+	}
+
+	high_load_set_map(prevMap);
+	if(res || isExitRequested()) return res;
+
+	/* Normal equations of the fit, with the table
+	 * values as prior. Terms without variation, such
+	 * as Neon on a board without, keep the prior. */
+	memset(ata, 0, sizeof(ata));
+	memset(atb, 0, sizeof(atb));
+	for(k = 0; k < nSteps; k++) {
+		for(i = 0; i < EST_N_COEF; i++) {
+			for(j = 0; j < EST_N_COEF; j++) ata[i][j] += x[k][i] * x[k][j];
+			atb[i] += x[k][i] * y[k];
+		}
+	}
+	for(i = 0; i < EST_N_COEF; i++) {
+		lambda = EST_RIDGE * ata[i][i] + 1e-9;
+		ata[i][i] += lambda;
+		atb[i] += lambda * coef[i];
+	}
+	if(solve(ata, atb, EST_N_COEF)) {
+		fprintf(stderr, "Error, calibration can't be solved\n");
+		return -1;
+	}
+	memcpy(coef, atb, sizeof(coef));
+	hasCoef = 1;
+	isCalibrated = 1;
+
+	printf("Calibrated coefficients:\n");
+	for(i = 0; i < EST_N_COEF; i++) printf("  %-13s %8.1f\n", coefNames[i], coef[i]);
+	for(k = 0; k < nSteps; k++) {
+		for(i = 0, est = 0; i < EST_N_COEF; i++) est += coef[i] * x[k][i];
+		printf("  step %d measured %.0f mA, estimated %.0f mA\n", k + 1, y[k], est);
+	}
+	nSum = 0;																	// Steps aren't a test result
+
+	fp = fopen(fileName, "w");
+	if(!fp) {
+		perror("Error creating coefficient file");
+		return -1;
+	}
+	fprintf(fp, "# rpiburn current coefficients, %s\n", hwIdent.cpuName);
+	for(i = 0; i < EST_N_COEF; i++) fprintf(fp, "%s %.3f\n", coefNames[i], coef[i]);
+	if(fclose(fp)) {
+		perror("Error writing coefficient file");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Print the average and peak estimate at full load
+void estimate_report(void) {
+	if(!isEnabled || !hasCoef || !nSum) return;
+
+	printf("Estimated current at full load %.0f mA average, %.0f mA peak (%s)\n",
+		sumMa / nSum, peakMa, isCalibrated ? "calibrated" : "uncalibrated");
+}
+
+
+
+//-------------------------------------------------------------
+// Close the counters
+void estimate_close(void) {
+	if(hasPerf) perf_close_cores(&perf);
+	hasPerf = 0;
+}
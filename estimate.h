@@ -0,0 +1,14 @@
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+
+//-------------------------------------------------------------
+int estimate_load(const char *fileName);
+int estimate_init(const int needCoef);
+int estimate_manager(void);
+int estimate_calibrate(const char *fileName);
+void estimate_report(void);
+void estimate_close(void);
+
+#endif
@@ -0,0 +1,419 @@
+
+/* Core frequency sampler. The firmware throttled bits
+ * only tell that the frequency was capped at some time,
+ * not when or on which core. Here a thread of low
+ * priority samples the clock of every core and the
+ * thermal zones from sysfs, at up to some kHz, with the
+ * files kept open and read by pread(). That is much
+ * cheaper than asking the firmware through VCHIQ. Every
+ * change is kept in a timeline, tagged with the load
+ * phase at the time, so a frequency drop can be lined
+ * up with the test progress.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "freqmon.h"
+#include "hwprobe.h"
+#include "misc.h"
+#include "trace.h"
+
+
+//-------------------------------------------------------------
+#define FREQ_MAX_RATE			10000											// Max sample rate in Hz
+#define FREQ_MAX_ZONES			8												// Max number of thermal zones we sample
+#define FREQ_MAX_CHANGES		8192											// Max number of changes in timeline
+#define FREQ_MAX_LISTED			40												// Max number of changes we print
+#define FREQ_NICE				10												// Priority of sampler thread
+
+
+//-------------------------------------------------------------
+struct freq_core_t {
+	int curFd;																	// scaling_cur_freq, or -1
+	int hwFd;																	// cpuinfo_cur_freq, or -1 when not readable
+	int maxKhz;																	// Highest frequency of the core
+	int minKhz;																	// Lowest frequency seen
+	int lastKhz;																// Frequency at previous sample, or 0
+	uint32_t nDrops[FREQ_N_PHASES];
+	int64_t belowNs[FREQ_N_PHASES];												// Time spent below max frequency
+};
+
+struct freq_change_t {
+	int64_t ns;																	// Time since sampler start
+	uint8_t cpu;
+	uint8_t phase;
+	int fromKhz;
+	int toKhz;
+	int milliC;																	// Hottest thermal zone, or 0
+};
+
+
+//-------------------------------------------------------------
+static const char *phaseNames[FREQ_N_PHASES] = {
+	[FREQ_PH_IDLE] = "idle",
+	[FREQ_PH_SPAWN] = "spawn",
+	[FREQ_PH_LOAD] = "load",
+	[FREQ_PH_ENDING] = "ending",
+};
+
+static int rate;																// Sample rate in Hz, or 0 when disabled
+static struct freq_core_t cores[HW_MAX_CPUS];
+static int zoneFds[FREQ_MAX_ZONES];
+static int nZones;
+static struct freq_change_t *timeline;
+static int nChanges;
+static uint32_t nLost;															// Changes not kept due to full timeline
+static volatile enum freq_phase_t phase;										// Set by the monitor thread
+static volatile int isStopping;
+static pthread_t thread;
+static int isOpen;																// True when files are opened
+static int isRunning;															// True when sampler thread exists
+static uint32_t nSamples;
+static uint32_t nLate;															// Samples taken a period or more too late
+static int64_t phaseNs[FREQ_N_PHASES];											// Time sampled per phase
+static int maxTemp[FREQ_N_PHASES];												// Hottest zone per phase, milli degrees
+static int firstDropMs = -1;													// Earliest drop after full load began
+static int firstDropCpu;
+
+
+
+//-------------------------------------------------------------
+// Set the sample rate in Hz. Zero disables sampling.
+int freqmon_set_rate(const int hz) {
+	if(hz < 0 || hz > FREQ_MAX_RATE) {
+		log_error("Error, frequency sample rate must be 0 to %d Hz\n",
+			FREQ_MAX_RATE);
+		return -1;
+	}
+	rate = hz;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Read a decimal value from an open sysfs file. Returns
+// -1 on failure.
+static long read_fd_long(const int fd) {
+	char buf[32];
+	int len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0) return -1;
+	buf[len] = 0;
+
+	return strtol(buf, NULL, 10);
+}
+
+
+
+//-------------------------------------------------------------
+// Open a sysfs file of a core for reading
+static int open_cpu_file(const int cpu, const char *name) {
+	char path[256];
+
+	if(sys_path(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/%s",
+		cpu, name)) return -1;
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+
+
+//-------------------------------------------------------------
+// Take one sample of all cores and zones. Runs in the
+// sampler thread only.
+static void sample(const int64_t t, const int64_t dt) {
+	struct freq_change_t *chg;
+	enum freq_phase_t ph;
+	int i, khz, temp, milliC;
+	struct freq_core_t *core;
+	static enum freq_phase_t lastPhase;
+	static int64_t loadBegin;
+
+	ph = phase;
+	if(ph == FREQ_PH_LOAD && lastPhase != FREQ_PH_LOAD) loadBegin = t;
+	lastPhase = ph;
+	phaseNs[ph] += dt;
+	nSamples++;
+
+	for(i = 0, milliC = 0; i < nZones; i++) {
+		temp = read_fd_long(zoneFds[i]);
+		if(temp > milliC) milliC = temp;
+	}
+	if(milliC > maxTemp[ph]) maxTemp[ph] = milliC;
+
+	for(i = 0; i < HW_MAX_CPUS; i++) {
+		core = &cores[i];
+		if(core->curFd < 0 && core->hwFd < 0) continue;
+
+		// The hardware clock is the truth, when we may read it
+		khz = core->hwFd >= 0 ? read_fd_long(core->hwFd) : -1;
+		if(khz <= 0 && core->curFd >= 0) khz = read_fd_long(core->curFd);
+		if(khz <= 0) continue;
+
+		if(core->lastKhz && core->lastKhz < core->maxKhz) core->belowNs[ph] += dt;
+		if(khz > core->maxKhz) core->maxKhz = khz;
+		if(!core->minKhz || khz < core->minKhz) core->minKhz = khz;
+
+		if(core->lastKhz && khz != core->lastKhz) {
+			if(khz < core->lastKhz) {
+				core->nDrops[ph]++;
+				trace_event(TR_FREQ_DROP, i);
+				if(ph == FREQ_PH_LOAD && (firstDropMs < 0 ||
+						(t - loadBegin) / 1000000 < firstDropMs)) {
+					firstDropMs = (t - loadBegin) / 1000000;
+					firstDropCpu = i;
+				}
+			}
+
+			if(nChanges < FREQ_MAX_CHANGES) {
+				chg = &timeline[nChanges++];
+				chg->ns = t;
+				chg->cpu = i;
+				chg->phase = ph;
+				chg->fromKhz = core->lastKhz;
+				chg->toKhz = khz;
+				chg->milliC = milliC;
+			}
+			else {
+				nLost++;
+			}
+		}
+		core->lastKhz = khz;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// The sampler thread. Wakes up on absolute deadlines so
+// the rate doesn't drift; when the thread is starved by
+// the load, late samples are counted and skipped.
+static void* sampler(void *arg) {
+	struct timespec next;
+	int64_t period, t, t0, lastT;
+
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), FREQ_NICE);
+
+	period = 1000000000LL / rate;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	t0 = mono_ns();
+	lastT = t0;
+
+	while(!isStopping) {
+		next.tv_nsec += period;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		t = mono_ns();
+		if(t - (next.tv_sec * 1000000000LL + next.tv_nsec) >= period) {
+			nLate++;
+			clock_gettime(CLOCK_MONOTONIC, &next);								// Skip ahead
+		}
+
+		sample(t - t0, t - lastT);
+		lastT = t;
+	}
+
+	return NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Open the frequency and thermal files of all online
+// cores and start sampling. The sampler is pinned to
+// <cpu> when not negative, such as the core reserved
+// for the monitor.
+int freqmon_start(const int cpu) {
+	char path[256];
+	struct sched_param schedParam;
+	pthread_attr_t attr;
+	cpu_set_t cpuMask;
+	int i, n, res;
+	long val;
+
+	if(!rate) return 0;
+
+	isOpen = 1;
+	for(i = 0, n = 0; i < HW_MAX_CPUS; i++) {
+		cores[i].curFd = -1;
+		cores[i].hwFd = -1;
+		if(!hwIdent.cpu[i].online) continue;
+
+		cores[i].curFd = open_cpu_file(i, "scaling_cur_freq");
+		cores[i].hwFd = open_cpu_file(i, "cpuinfo_cur_freq");					// Root only
+		if(cores[i].hwFd >= 0 && read_fd_long(cores[i].hwFd) <= 0) {
+			close(cores[i].hwFd);
+			cores[i].hwFd = -1;
+		}
+
+		if(!sys_path(path, sizeof(path),
+				"/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", i) &&
+				!read_file_long(path, &val)) {
+			cores[i].maxKhz = val;
+		}
+
+		if(cores[i].curFd >= 0 || cores[i].hwFd >= 0) n++;
+	}
+
+	if(!n) {
+		log_error("Error, no cpufreq support for frequency sampling\n");
+		return -1;
+	}
+
+	for(nZones = 0; nZones < FREQ_MAX_ZONES; nZones++) {
+		if(sys_path(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp",
+			nZones)) break;
+		zoneFds[nZones] = open(path, O_RDONLY | O_CLOEXEC);
+		if(zoneFds[nZones] == -1) break;
+	}
+
+	timeline = malloc(FREQ_MAX_CHANGES * sizeof(struct freq_change_t));
+	if(!timeline) {
+		log_errno("Error allocating frequency timeline");
+		return -1;
+	}
+
+	/* Normal class on the monitor core, not inherited
+	 * from the real-time monitor, which it would starve. */
+	pthread_attr_init(&attr);
+	schedParam.sched_priority = 0;
+	res = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	if(!res) res = pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	if(!res) res = pthread_attr_setschedparam(&attr, &schedParam);
+	if(!res && cpu >= 0) {
+		CPU_ZERO(&cpuMask);
+		CPU_SET(cpu, &cpuMask);
+		res = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuMask);
+	}
+
+	isStopping = 0;
+	if(!res) res = pthread_create(&thread, &attr, sampler, NULL);
+	pthread_attr_destroy(&attr);
+	if(res) {
+		log_error("Error creating sampler thread: %s\n", strerror(res));
+		return -1;
+	}
+	isRunning = 1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Tell the sampler which load phase we are in
+void freqmon_set_phase(const enum freq_phase_t ph) {
+	phase = ph;
+}
+
+
+
+//-------------------------------------------------------------
+// Get the load phase we are in
+enum freq_phase_t freqmon_get_phase(void) {
+	return phase;
+}
+
+
+
+//-------------------------------------------------------------
+// Stop sampling and close all files
+void freqmon_close(void) {
+	int i;
+
+	if(isRunning) {
+		isStopping = 1;
+		pthread_join(thread, NULL);
+		isRunning = 0;
+	}
+
+	for(i = 0; isOpen && i < HW_MAX_CPUS; i++) {
+		if(cores[i].curFd >= 0) close(cores[i].curFd);
+		if(cores[i].hwFd >= 0) close(cores[i].hwFd);
+		cores[i].curFd = -1;
+		cores[i].hwFd = -1;
+	}
+
+	for(i = 0; isOpen && i < nZones; i++) close(zoneFds[i]);
+	isOpen = 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Print the time every core spent below max frequency
+// per load phase and the timeline of changes. Must be
+// called after freqmon_close().
+void freqmon_report(void) {
+	struct freq_change_t *chg;
+	int i, ph;
+
+	if(!rate || !nSamples) return;
+
+	log_info("Core frequency sampled at %d Hz, %u samples (%u late)\n",
+		rate, nSamples, nLate);
+	log_info("  core  max MHz  min MHz  drops  below max in");
+	for(ph = 0; ph < FREQ_N_PHASES; ph++) log_info(" %6s", phaseNames[ph]);
+	log_info("\n");
+
+	for(i = 0; i < HW_MAX_CPUS; i++) {
+		if(!cores[i].minKhz) continue;
+		log_info("  %4d  %7d  %7d  %5u              ", i, cores[i].maxKhz / 1000,
+			cores[i].minKhz / 1000, cores[i].nDrops[FREQ_PH_IDLE] +
+			cores[i].nDrops[FREQ_PH_SPAWN] + cores[i].nDrops[FREQ_PH_LOAD] +
+			cores[i].nDrops[FREQ_PH_ENDING]);
+		for(ph = 0; ph < FREQ_N_PHASES; ph++) {
+			if(phaseNs[ph]) log_info(" %5.1f%%", 100.0 * cores[i].belowNs[ph] / phaseNs[ph]);
+			else log_info(" %6s", "-");
+		}
+		log_info("\n");
+	}
+
+	if(nZones) {
+		log_info("  Max temperature");
+		for(ph = 0; ph < FREQ_N_PHASES; ph++) {
+			if(phaseNs[ph]) log_info(" %s %.1f C", phaseNames[ph], maxTemp[ph] / 1000.0);
+		}
+		log_info("\n");
+	}
+
+	if(firstDropMs >= 0) {
+		log_info("  First drop at core %d, %d ms into full load\n", firstDropCpu,
+			firstDropMs);
+	}
+
+	if(nChanges) log_info("Frequency changes:\n");
+	for(i = 0; i < nChanges && i < FREQ_MAX_LISTED; i++) {
+		chg = &timeline[i];
+		log_info("  %10.3f ms  %-6s  core %-2d  %4d -> %4d MHz", chg->ns / 1e6,
+			phaseNames[chg->phase], chg->cpu, chg->fromKhz / 1000, chg->toKhz / 1000);
+		if(chg->milliC) log_info("  %.1f C", chg->milliC / 1000.0);
+		log_info("\n");
+	}
+	if(nChanges + nLost > FREQ_MAX_LISTED) {
+		log_info("  ... %u more\n", nChanges + nLost - FREQ_MAX_LISTED);
+	}
+
+	free(timeline);
+	timeline = NULL;
+}
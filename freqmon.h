@@ -0,0 +1,24 @@
+
+#ifndef FREQMON_H
+#define FREQMON_H
+
+
+//-------------------------------------------------------------
+enum freq_phase_t {																// Load phase frequency samples belong to
+	FREQ_PH_IDLE,
+	FREQ_PH_SPAWN,																// Spawning childs
+	FREQ_PH_LOAD,																// All childs running, full load
+	FREQ_PH_ENDING,																// Waiting for childs to exit
+	FREQ_N_PHASES
+};
+
+
+//-------------------------------------------------------------
+int freqmon_set_rate(const int hz);
+int freqmon_start(const int cpu);
+void freqmon_set_phase(const enum freq_phase_t phase);
+enum freq_phase_t freqmon_get_phase(void);
+void freqmon_close(void);
+void freqmon_report(void);
+
+#endif
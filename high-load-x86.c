@@ -0,0 +1,177 @@
+
+/* Power consumers for x86-64 PC hosts, one per psABI
+ * microarchitecture level. All are built into the same
+ * binary with per function target attributes, whatever
+ * the -march of the rest, and high-load.c picks one by
+ * what the processor supports at run time. Each keeps
+ * the widest FMA or multiply-add units of its level busy
+ * with independent accumulator chains.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "high-load.h"
+
+
+//-------------------------------------------------------------
+#define X86_ROUNDS			256													// Loop rounds between polls of stop
+
+
+//-------------------------------------------------------------
+int burn_cpu_x86_v1(struct child_t *me);
+int burn_cpu_x86_v3(struct child_t *me) __attribute__((target("avx2,fma")));
+int burn_cpu_x86_v4(struct child_t *me) __attribute__((target("avx512f")));
+
+
+//-------------------------------------------------------------
+static volatile double sink;													// Keeps the results alive
+
+
+
+//-------------------------------------------------------------
+// Power consumer for x86-64 baseline, SSE2 multiply and
+// add in eight chains, enough to hide the latency.
+int burn_cpu_x86_v1(struct child_t *me) {
+	__m128d a0, a1, a2, a3, a4, a5, a6, a7, m, c;
+	uint32_t n;
+	int i;
+
+	m = _mm_set1_pd(0.999999);													// Converges to c / (1 - m), never overflows
+	c = _mm_set1_pd(1e-6);
+	a0 = _mm_set1_pd(child_random(me) & 0xff);									// Distinct starts, else the chains are merged
+	a1 = _mm_add_pd(a0, c);
+	a2 = _mm_add_pd(a1, c);
+	a3 = _mm_add_pd(a2, c);
+	a4 = _mm_add_pd(a3, c);
+	a5 = _mm_add_pd(a4, c);
+	a6 = _mm_add_pd(a5, c);
+	a7 = _mm_add_pd(a6, c);
+
+	for(n = 0; !me->ctrl->stop; n += X86_ROUNDS) {
+		for(i = 0; i < X86_ROUNDS; i++) {
+			a0 = _mm_add_pd(_mm_mul_pd(a0, m), c);
+			a1 = _mm_add_pd(_mm_mul_pd(a1, m), c);
+			a2 = _mm_add_pd(_mm_mul_pd(a2, m), c);
+			a3 = _mm_add_pd(_mm_mul_pd(a3, m), c);
+			a4 = _mm_add_pd(_mm_mul_pd(a4, m), c);
+			a5 = _mm_add_pd(_mm_mul_pd(a5, m), c);
+			a6 = _mm_add_pd(_mm_mul_pd(a6, m), c);
+			a7 = _mm_add_pd(_mm_mul_pd(a7, m), c);
+		}
+	}
+
+	a0 = _mm_add_pd(_mm_add_pd(_mm_add_pd(a0, a1), _mm_add_pd(a2, a3)),
+		_mm_add_pd(_mm_add_pd(a4, a5), _mm_add_pd(a6, a7)));
+	sink = _mm_cvtsd_f64(a0);
+
+	me->ctrl->iters = n;
+
+	return EXIT_SUCCESS;
+}
+
+
+
+//-------------------------------------------------------------
+// Power consumer for x86-64-v3, AVX2 fused multiply add
+// in ten chains to fill both FMA ports.
+int burn_cpu_x86_v3(struct child_t *me) {
+	__m256d a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, m, c;
+	__m256i b0, b1;
+	uint32_t n;
+	int i;
+
+	m = _mm256_set1_pd(0.999999);
+	c = _mm256_set1_pd(1e-6);
+	a0 = _mm256_set1_pd(child_random(me) & 0xff);
+	a1 = _mm256_add_pd(a0, c);
+	a2 = _mm256_add_pd(a1, c);
+	a3 = _mm256_add_pd(a2, c);
+	a4 = _mm256_add_pd(a3, c);
+	a5 = _mm256_add_pd(a4, c);
+	a6 = _mm256_add_pd(a5, c);
+	a7 = _mm256_add_pd(a6, c);
+	a8 = _mm256_add_pd(a7, c);
+	a9 = _mm256_add_pd(a8, c);
+	b0 = _mm256_set1_epi32(child_random(me));
+	b1 = _mm256_set1_epi32(0x0f0f0f0f);
+
+	for(n = 0; !me->ctrl->stop; n += X86_ROUNDS) {
+		for(i = 0; i < X86_ROUNDS; i++) {
+			a0 = _mm256_fmadd_pd(a0, m, c);
+			a1 = _mm256_fmadd_pd(a1, m, c);
+			a2 = _mm256_fmadd_pd(a2, m, c);
+			a3 = _mm256_fmadd_pd(a3, m, c);
+			a4 = _mm256_fmadd_pd(a4, m, c);
+			b0 = _mm256_xor_si256(_mm256_add_epi32(b0, b1), b1);				// Integer port in between
+			a5 = _mm256_fmadd_pd(a5, m, c);
+			a6 = _mm256_fmadd_pd(a6, m, c);
+			a7 = _mm256_fmadd_pd(a7, m, c);
+			a8 = _mm256_fmadd_pd(a8, m, c);
+			a9 = _mm256_fmadd_pd(a9, m, c);
+		}
+	}
+
+	a0 = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)),
+		_mm256_add_pd(_mm256_add_pd(a4, a5), _mm256_add_pd(a6, a7)));
+	a0 = _mm256_add_pd(a0, _mm256_add_pd(a8, a9));
+	sink = _mm256_cvtsd_f64(a0) + _mm256_extract_epi32(b0, 0);
+
+	me->ctrl->iters = n;
+
+	return EXIT_SUCCESS;
+}
+
+
+
+//-------------------------------------------------------------
+// Power consumer for x86-64-v4, AVX-512 fused multiply
+// add in ten chains. Cores with one 512-bit FMA port
+// are still kept at their widest.
+int burn_cpu_x86_v4(struct child_t *me) {
+	__m512d a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, m, c;
+	uint32_t n;
+	int i;
+
+	m = _mm512_set1_pd(0.999999);
+	c = _mm512_set1_pd(1e-6);
+	a0 = _mm512_set1_pd(child_random(me) & 0xff);
+	a1 = _mm512_add_pd(a0, c);
+	a2 = _mm512_add_pd(a1, c);
+	a3 = _mm512_add_pd(a2, c);
+	a4 = _mm512_add_pd(a3, c);
+	a5 = _mm512_add_pd(a4, c);
+	a6 = _mm512_add_pd(a5, c);
+	a7 = _mm512_add_pd(a6, c);
+	a8 = _mm512_add_pd(a7, c);
+	a9 = _mm512_add_pd(a8, c);
+
+	for(n = 0; !me->ctrl->stop; n += X86_ROUNDS) {
+		for(i = 0; i < X86_ROUNDS; i++) {
+			a0 = _mm512_fmadd_pd(a0, m, c);
+			a1 = _mm512_fmadd_pd(a1, m, c);
+			a2 = _mm512_fmadd_pd(a2, m, c);
+			a3 = _mm512_fmadd_pd(a3, m, c);
+			a4 = _mm512_fmadd_pd(a4, m, c);
+			a5 = _mm512_fmadd_pd(a5, m, c);
+			a6 = _mm512_fmadd_pd(a6, m, c);
+			a7 = _mm512_fmadd_pd(a7, m, c);
+			a8 = _mm512_fmadd_pd(a8, m, c);
+			a9 = _mm512_fmadd_pd(a9, m, c);
+		}
+	}
+
+	a0 = _mm512_add_pd(_mm512_add_pd(_mm512_add_pd(a0, a1), _mm512_add_pd(a2, a3)),
+		_mm512_add_pd(_mm512_add_pd(a4, a5), _mm512_add_pd(a6, a7)));
+	a0 = _mm512_add_pd(a0, _mm512_add_pd(a8, a9));
+	sink = _mm512_reduce_add_pd(a0);
+
+	me->ctrl->iters = n;
+
+	return EXIT_SUCCESS;
+}
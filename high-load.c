@@ -12,117 +12,303 @@
 #include <sched.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/syscall.h>														/* For syscall SYS_xxx definitions */
 #include <sys/wait.h>
 #include <sys/resource.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/futex.h>
 
 #include "high-load.h"
-#include "main.h"
 #include "misc.h"
+#include "hwprobe.h"
+#include "trace.h"
+#include "freqmon.h"
+#include "storage.h"
+#include "jit.h"
 
 
 //-------------------------------------------------------------
 #define CHILD_SPAWN_DELAY		150												// Delay in ms between spawned childrens
-#define DFLT_LOAD_TIME			750												// Time in ms we run with full load power consumption
-
-enum child_state_t {
-	THREAD_NONE,
-	THREAD_STARTUP,
-	THREAD_RUNNING,
-	THREAD_ENDING,
-	THREAD_HALTED
-};
-
-struct child_t {
-	volatile enum child_state_t state;											// The child thread state
-	int tid;																	// Linux PID of thread
-	pthread_t thread;															// Posix thread ID
-	int index;																	// Array index
-	cpu_set_t cpuMask;															// Affinity
-	int exitStatus;																// Return code after process exit
-
-	int (*consumer)(struct child_t *me);										// Power consumer for specific thread
-};
-
-
-enum cpuid_t {																	// System processor ID
-	CPU_UNKNOWN,
-	CPU_BCM2835,																// RPi 1
-	CPU_BCM2836,																// RPi 2
-	CPU_BCM2837,																// RPi 3
-};
+#define MAX_SLOTS				(2 * HW_MAX_CPUS)								// Max number of childs in a consumer map
+#define MEM_STREAM_LEN			(8 * 1024 * 1024)								// Size of each memory streaming buffer; larger than any L2/L3
+#define MEM_STREAM_CHUNK		(64 * 1024)										// Bytes copied between polls of stop flag
+#define DUTY_PERIOD				10												// Duty cycle period in ms
+#define ISA_CHECK_TIME			20												// Time in ms each core runs its variant in the self check
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id	_sigev_un._tid									// Missing in older libc
+#endif
 
 
 //-------------------------------------------------------------
 static struct child_t *childs;
+static struct child_ctrl_t *ctrls;												// Control block of each child
 static struct timespec spawnTimer;												// When to spawn a child next time
 static int maxChilds;															// Number of childs to spawn
-static int nCpus;																// Number of processor cores in system
-static enum cpuid_t cpuId;														// System processor ID
-static const char* cpuName;														// System processor name (text)
-static int osHasNeon;															// True when the operating system ARM Neon support
-static int ccHasArm;															// True when compiler has ARM 32-bit support
-static int ccHasNeon;															// True when compiler has ARM Neon support
+static int nCpus;																// Number of processor cores we load
+static int cpuList[HW_MAX_CPUS];												// Core number of each core we load, in spawn order
+static int maxCapacity;															// Capacity of the fastest core we load
+static int reservedCpu = -1;													// Core reserved for the monitor, if any
 static int hasFullLoad;															// True when we are consuming maximum power
 static struct timespec loadTimer;
-static pthread_t parentThread;													// Posix thread ID of parent
+static int loadTime;															// Time in ms at full load of this cycle
+static int isStopping;															// True when the cycle is ending
+static int eventFd = -1;														// Readable when a child has exited
 
 
 //-------------------------------------------------------------
-static int identify_cpu(void);
 int burn_cpu_generic(struct child_t *me);
+#if defined(HAVE_ARM_CONSUMERS) || defined(HAVE_A64_CONSUMERS)					// Arch variants, set by the Makefile
+extern int burn_cpu_crypto(struct child_t *me);
+#else
+#define burn_cpu_crypto			NULL
+#endif
+#if defined(HAVE_ARM_CONSUMERS)
 extern int burn_cpu_neon(struct child_t *me);
 extern int burn_cpu_arm(struct child_t *me);
+#else
+#define burn_cpu_neon			NULL
+#define burn_cpu_arm			NULL
+#endif
+#if defined(HAVE_A64_CONSUMERS)
+extern int burn_cpu_asimd(struct child_t *me);
+#else
+#define burn_cpu_asimd			NULL
+#endif
+#if defined(HAVE_X86_CONSUMERS)
+extern int burn_cpu_x86_v1(struct child_t *me);
+extern int burn_cpu_x86_v3(struct child_t *me);
+extern int burn_cpu_x86_v4(struct child_t *me);
+#else
+#define burn_cpu_x86_v1			NULL
+#define burn_cpu_x86_v3			NULL
+#define burn_cpu_x86_v4			NULL
+#endif
 int idle_cpu(struct child_t *me);
-int dump_sdcard(struct child_t *me);
+int stream_mem(struct child_t *me);
 static int hasAllChildsStarted(void);
 
 
+//-------------------------------------------------------------
+enum consumer_id_t {															// Index in table of power consumers
+	CONSUMER_CPU,
+	CONSUMER_NEON,
+	CONSUMER_ARM,
+	CONSUMER_GENERIC,
+	CONSUMER_MEM,
+	CONSUMER_IO,
+	CONSUMER_WRITE,
+	CONSUMER_JIT,
+	CONSUMER_IDLE,
+	CONSUMER_CRYPTO,
+	CONSUMER_X86_V1,
+	CONSUMER_X86_V3,
+	CONSUMER_X86_V4,
+	CONSUMER_ASIMD,
+	N_CONSUMERS
+};
+
+static const struct consumer_t {
+	const char *name;															// Name used in consumer maps
+	int (*func)(struct child_t *me);
+} consumers[N_CONSUMERS] = {
+	[CONSUMER_CPU] = { "cpu", NULL },											// Best processor consumer for this system
+	[CONSUMER_NEON] = { "neon", burn_cpu_neon },
+	[CONSUMER_ARM] = { "arm", burn_cpu_arm },
+	[CONSUMER_GENERIC] = { "generic", burn_cpu_generic },
+	[CONSUMER_MEM] = { "mem", stream_mem },
+	[CONSUMER_IO] = { "io", read_storage },
+	[CONSUMER_WRITE] = { "write", write_storage },
+	[CONSUMER_JIT] = { "jit", jit_consumer },
+	[CONSUMER_IDLE] = { "idle", idle_cpu },
+	[CONSUMER_CRYPTO] = { "crypto", burn_cpu_crypto },
+	[CONSUMER_X86_V1] = { "x86-v1", burn_cpu_x86_v1 },
+	[CONSUMER_X86_V3] = { "x86-v3", burn_cpu_x86_v3 },
+	[CONSUMER_X86_V4] = { "x86-v4", burn_cpu_x86_v4 },
+	[CONSUMER_ASIMD] = { "asimd", burn_cpu_asimd },
+};
+
+struct isa_check_t {															// A consumer run by the self check
+	struct child_t me;
+	int cpu;																	// Core it ran on
+};
+
+static const enum consumer_id_t cpuVariants[] = {								// Processor consumers, the best first
+	CONSUMER_CRYPTO,
+	CONSUMER_ASIMD,
+	CONSUMER_NEON,
+	CONSUMER_X86_V4,
+	CONSUMER_X86_V3,
+	CONSUMER_X86_V1,
+	CONSUMER_ARM,
+	CONSUMER_GENERIC,
+};
+
+static int slotMap[MAX_SLOTS];													// Consumer of each child
+static int nSlots;																// Number of used entries in map
+static int (*cpuConsumer)(struct child_t *me);									// Best processor consumer
+static int slotDuty[MAX_SLOTS];													// Duty cycle in percent of each child
+static int hasDuty;																// True when childs are duty cycled
+static uint64_t masterSeed;														// Seed of all child random generators
+static int hasSeed;																// True when seed is set by user
+static uint32_t nCycles;														// Cycles started, part of child seeds
+
+
+
+//-------------------------------------------------------------
+// Sort order of qsort() for the cores we load. First
+// SMT thread of every physical core before any second
+// thread, and the fastest cores first within each.
+static int cmp_cpu(const void *a, const void *b) {
+	const struct hw_cpu_t *ca = &hwIdent.cpu[*(const int*) a];
+	const struct hw_cpu_t *cb = &hwIdent.cpu[*(const int*) b];
+
+	if(ca->threadIdx != cb->threadIdx) return ca->threadIdx - cb->threadIdx;
+	if(ca->capacity != cb->capacity) return cb->capacity - ca->capacity;
+
+	return *(const int*) a - *(const int*) b;
+}
+
+
+
+//-------------------------------------------------------------
+// Build the list of cores to load from the online cores
+// we are allowed to run on, as seen by hw_probe(). Not
+// from our own affinity, which the monitor may have
+// narrowed to its core.
+static int init_cpu_list(void) {
+	int i, nClusters, nPhys, j;
+
+	for(i = 0, nCpus = 0, nPhys = 0, nClusters = 0, maxCapacity = 0; i < HW_MAX_CPUS; i++) {
+		if(!hwIdent.cpu[i].online || !CPU_ISSET(i, &hwAllowed) || i == reservedCpu) continue;
+		cpuList[nCpus++] = i;
+		if(hwIdent.cpu[i].capacity > maxCapacity) maxCapacity = hwIdent.cpu[i].capacity;
+		if(!hwIdent.cpu[i].threadIdx) nPhys++;
+		for(j = 0; j < nCpus - 1 && hwIdent.cpu[cpuList[j]].clusterId != hwIdent.cpu[i].clusterId; j++);
+		if(j == nCpus - 1) nClusters++;
+	}
+	if(nCpus < 1) {
+		log_error("Error, no cores left to load\n");
+		return -1;
+	}
+	qsort(cpuList, nCpus, sizeof(cpuList[0]), cmp_cpu);
+
+	if(nCpus != hwIdent.nCpus || nPhys != nCpus || nClusters > 1) {
+		log_info("Loading %d of %d cores, %d physical in %d clusters\n", nCpus,
+			hwIdent.nCpus, nPhys, nClusters);
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when consumer <id> is built into this
+// binary and the processor and the system supports it
+static int is_supported(const enum consumer_id_t id) {
+	switch(id) {
+		case CONSUMER_CPU:
+			return 1;
+
+		case CONSUMER_CRYPTO:
+			return consumers[id].func && hwIdent.hasCrypto;
+
+		case CONSUMER_NEON:
+			return consumers[id].func && hwIdent.hasNeon;
+
+		case CONSUMER_ASIMD:
+			return consumers[id].func && hwIdent.hasAsimd;
+
+		case CONSUMER_X86_V1:
+			return consumers[id].func && hwIdent.x86Level >= 1;
+
+		case CONSUMER_X86_V3:
+			return consumers[id].func && hwIdent.x86Level >= 3;
+
+		case CONSUMER_X86_V4:
+			return consumers[id].func && hwIdent.x86Level >= 4;
+
+		case CONSUMER_IO:
+			return storage_n_devs() > 0;
+
+		case CONSUMER_WRITE:
+			return storage_has_write();
+
+		case CONSUMER_JIT:
+			return jit_isa() != NULL;
+
+		default:
+			return consumers[id].func != NULL;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Processor consumer that suits core <cpu> best. Second
+// SMT threads share the SIMD unit with the first one
+// and cores slower than the fastest are in-order ones,
+// where Neon doesn't pay off; give them plain ARM code,
+// or in 64-bit mode Advanced SIMD without the crypto.
+static int (*cpu_consumer(const int cpu))(struct child_t *me) {
+	if(cpuConsumer != burn_cpu_neon && cpuConsumer != burn_cpu_crypto) return cpuConsumer;
+	if(hwIdent.cpu[cpu].threadIdx || hwIdent.cpu[cpu].capacity < maxCapacity) {
+#if defined(HAVE_A64_CONSUMERS)
+		return burn_cpu_asimd;
+#else
+		return burn_cpu_arm;
+#endif
+	}
+
+	return cpuConsumer;
+}
+
+
 
 //-------------------------------------------------------------
 // Initialize high load testing
 int high_load_init(void) {
 	int i;
 
-	timer_set(&spawnTimer, 0);
-	timer_set(&loadTimer, 9999999);
-	if(load_time < 1) load_time = DFLT_LOAD_TIME;								// Command line argument from user?
-	parentThread = pthread_self();
-
-	// Check what features the compiler has
-#if defined(__ARMEL__) || defined( __ARM_EABI__)
-	ccHasArm = 1;																// True when compiler has ARM 32-bit support
-#endif
-#if defined(__ARM_NEON__) || defined(__ARM_NEON)
-	ccHasNeon = 1;																// True when compiler has ARM Neon support
-#endif
+	if(eventFd < 0) eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(eventFd < 0) {
+		log_errno("Error creating child event fd");
+		return -1;
+	}
 
-	if(identify_cpu()) return -1;
+	// Load all allowed cores except one reserved for the monitor
+	if(init_cpu_list()) return -1;
+
+	/* Pick the best processor consumer among the
+	 * variants built in, which the processor supports.
+	 * Decided here at run time from the hwcaps, not by
+	 * how the binary was compiled. */
+	for(i = 0; i < (int) (sizeof(cpuVariants) / sizeof(cpuVariants[0])); i++) {
+		if(cpuVariants[i] == CONSUMER_NEON &&
+			hwIdent.cpuId == CPU_BCM2836) continue;								// Ignore Neon in Cortex A7, it's to slow.
+		if(is_supported(cpuVariants[i])) break;
+	}
+	cpuConsumer = consumers[cpuVariants[i]].func;
 
-	// Prepare threads
-	maxChilds = nCpus + 1;
-	childs = calloc(maxChilds, sizeof(struct child_t));
-	for(i = 0; i < maxChilds; i++) {
-		childs[i].state = THREAD_NONE;
-		childs[i].index = i;
-		CPU_ZERO(&childs[i].cpuMask);
-		CPU_SET(i % nCpus, &childs[i].cpuMask);
-		childs[i].exitStatus = -1;
+	for(i = 0; i < MAX_SLOTS; i++) slotDuty[i] = 100;
+	if(!hasSeed) masterSeed = ((uint64_t) time(NULL) << 20) ^ mono_ns() ^ getpid();
 
-		if(cpuId == CPU_BCM2836) osHasNeon = 0;									// Ignore Neon in Cortex A7, it's to slow.
-		if(ccHasArm) {															// ARM processor? Then use asm optimizations.
-			childs[i].consumer = (ccHasNeon && osHasNeon) ?						// Both compile time and run time Neon support?
-				burn_cpu_neon : burn_cpu_arm;
-		}
-		else {
-			childs[i].consumer = burn_cpu_generic;
-		}
+	/* Default map is the processor consumer on every
+	 * core plus an extra I/O child per storage device. */
+	nSlots = nCpus;
+	for(i = 0; i < nCpus; i++) slotMap[i] = CONSUMER_CPU;
+	for(i = 0; i < storage_n_devs() && nSlots < MAX_SLOTS; i++) {
+		slotMap[nSlots++] = CONSUMER_IO;
 	}
-	childs[nCpus].consumer = dump_sdcard;
-	//childs[nCpus].state = THREAD_HALTED;										// Disabled thread; for testing
+	if(storage_has_write()) slotMap[nSlots++] = CONSUMER_WRITE;					// Storage writes enabled by user?
+	//slotMap[nCpus] = CONSUMER_IDLE;											// Disabled thread; for testing
 
 	return 0;
 }
@@ -130,72 +316,197 @@ int high_load_init(void) {
 
 
 //-------------------------------------------------------------
-// Reads the file /proc/cpuinfo into a newly created buffer
-// which the caller needs to free when finished with it.
-static int read_cpuinfo(char **buf) {
-	int res, fd, hasRdLen;
-	int bufLen;
+// Keep childs away from core <cpu>. Must be called
+// before high_load_init().
+void high_load_reserve_cpu(const int cpu) {
+	reservedCpu = cpu;
+}
 
-	hasRdLen = 0;
-	bufLen = 1024;
-	*buf = malloc(bufLen);
 
-	fd = open("/proc/cpuinfo", O_RDONLY);
-	if(fd == -1) {
-		perror("Error opening cpuinfo");
-		res = -1;
-		goto out;
+
+//-------------------------------------------------------------
+// Signal handler of the duty cycle timer, which the
+// application installs for SIGUSR1. Runs in the
+// context of the child it belongs to and pauses its
+// consumer for the off part of the period. Works with
+// any consumer, also the asm ones which only polls
+// the stop flag.
+void rpiburn_duty_signal(int sig, siginfo_t *info, void *ctx) {
+	struct child_t *me = info->si_value.sival_ptr;
+	struct timespec off;
+	int duty;
+
+	duty = me->ctrl->duty;
+	if(duty >= 100 || me->ctrl->stop) return;
+	if(duty < 0) duty = 0;
+
+	off.tv_sec = 0;
+	off.tv_nsec = (100 - duty) * DUTY_PERIOD * 10000L;
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &off, NULL);
+}
+
+
+
+//-------------------------------------------------------------
+// Publish a change of a control block and wake up the
+// child if it's paused.
+static void ctrl_update(struct child_ctrl_t *ctrl) {
+	__sync_add_and_fetch(&ctrl->gen, 1);
+	syscall(SYS_futex, &ctrl->gen, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+
+
+//-------------------------------------------------------------
+// Set duty cycle in percent of child <idx>, or of all
+// childs when <idx> is negative. Takes effect at once
+// for running childs and is kept for later cycles.
+// Returns -1 unless SIGUSR1 has been routed to the
+// duty cycle handler, since the timers would kill us.
+int high_load_set_duty(const int idx, const int duty) {
+	struct sigaction sigAct;
+	int i;
+
+	if(!hasDuty) {
+		if(sigaction(SIGUSR1, NULL, &sigAct) == -1 ||
+				!(sigAct.sa_flags & SA_SIGINFO) ||
+				sigAct.sa_sigaction != rpiburn_duty_signal) {
+			log_error("Error, duty cycles need SIGUSR1 handled by "
+				"rpiburn_duty_signal()\n");
+			return -1;
+		}
+		hasDuty = 1;
 	}
 
-	/* Size of the file is unknown and can't be
-	 * probed since it's generated dynamically
-	 * in runtime. We read the file twice to be
-	 * able to allocate a large enough buffer.
-	 * First time just dummy read until EOF. */
-	do {
-		res = read(fd, *buf, bufLen);
-		if(res == -1) {
-			if(errno == EINTR) continue;
-			perror("Error reading cpuinfo");
-			goto out;
+	for(i = 0; i < MAX_SLOTS; i++) {
+		if(idx >= 0 && i != idx) continue;
+		slotDuty[i] = duty;
+		if(!ctrls || i >= maxChilds || ctrls[i].duty == duty) continue;
+		ctrls[i].duty = duty;
+		ctrl_update(&ctrls[i]);
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Pause or resume child <idx>, or all childs when <idx>
+// is negative. A paused child returns from its consumer
+// and sleeps until resumed, without ending the cycle.
+// Only for the current cycle.
+void high_load_pause(const int idx, const int isPaused) {
+	int i;
+
+	for(i = 0; ctrls && i < maxChilds; i++) {
+		if(idx >= 0 && i != idx) continue;
+		if(!ctrls[i].pause == !isPaused || isStopping) continue;
+
+		/* Order matters, a child must never see the
+		 * consumer stopped without pause while we only
+		 * pause it, or the other way around. */
+		if(isPaused) {
+			ctrls[i].pause = 1;
+			__sync_synchronize();
+			ctrls[i].stop = 1;
 		}
+		else {
+			ctrls[i].stop = 0;
+			__sync_synchronize();
+			ctrls[i].pause = 0;
+		}
+		ctrl_update(&ctrls[i]);
+	}
+}
 
-		hasRdLen += res;
-	} while(res > 0);
 
-	// Allocate a buffer which can hold entire file.
-	bufLen = hasRdLen;
-	hasRdLen = 0;
-	*buf = realloc(*buf, bufLen);
-	memset(*buf, 0, bufLen);
 
-	if(lseek(fd, 0, SEEK_SET) == (off_t) -1) {
-		perror("Error rewinding cpuinfo");
-		res = -1;
-		goto out;
+//-------------------------------------------------------------
+// Tell all childs to return from their consumers and
+// exit, also the paused ones.
+static void stop_childs(void) {
+	int i;
+
+	for(i = 0; ctrls && i < maxChilds; i++) {
+		if(ctrls[i].stop && !ctrls[i].pause) continue;
+		ctrls[i].pause = 0;
+		__sync_synchronize();
+		ctrls[i].stop = 1;
+		ctrl_update(&ctrls[i]);
 	}
+}
 
-	// Read a second time to fill up buffer
-	do {
-		res = read(fd, *buf + hasRdLen, bufLen - hasRdLen);
-		if(res == -1) {
-			if(errno == EINTR) continue;
-			perror("Error reading cpuinfo");
-			goto out;
-		}
 
-		hasRdLen += res;
-	} while(res > 0);
 
-	// Ensure NULL terminated string
-	(*buf)[bufLen - 1] = 0;
+//-------------------------------------------------------------
+// Set the master seed of the random generators of all
+// childs, to replay the accesses of an earlier run.
+void high_load_set_seed(const uint64_t seed) {
+	masterSeed = seed;
+	hasSeed = 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Get the master seed, to be logged for a later replay
+uint64_t high_load_get_seed(void) {
+	return masterSeed;
+}
+
+
+
+//-------------------------------------------------------------
+// Next number of a splitmix64 sequence, which spreads
+// a seed into generator states.
+static uint64_t splitmix64(uint64_t *x) {
+	uint64_t z;
+
+	z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+
+
+//-------------------------------------------------------------
+// Seed the generator of child <me>. Each child of each
+// cycle gets a sequence of its own, which is the same
+// in every run with the same master seed.
+static void child_seed(struct child_t *me) {
+	uint64_t x, z;
+	int i;
 
-out:
-	if(res) {
-		free(*buf);
-		*buf = NULL;
+	x = masterSeed ^ ((uint64_t) nCycles << 32) ^ me->index;
+	for(i = 0; i < 4; i += 2) {
+		z = splitmix64(&x);
+		me->rng[i] = z;
+		me->rng[i + 1] = z >> 32;
 	}
-	if(fd) close(fd);
+}
+
+
+
+//-------------------------------------------------------------
+// Random number by the xoshiro128** generator of child
+// <me>. Only the child itself may call it, there is no
+// lock, and it's cheap on 32-bit processors too.
+uint32_t child_random(struct child_t *me) {
+	uint32_t *s, res, t;
+
+	s = me->rng;
+	res = s[1] * 5;
+	res = ((res << 7) | (res >> 25)) * 9;
+	t = s[1] << 9;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 11) | (s[3] >> 21);
 
 	return res;
 }
@@ -203,68 +514,137 @@ out:
 
 
 //-------------------------------------------------------------
-// Identify the system processor by parsing the file
-// /proc/cpuinfo and extracting the 'CPU part' record.
-// List of values used by ARM:
-//   BCM2708 BCM2835 ARM1176JZF-S == 0xb76
-//   BCM2709 BCM2836 Cortex-A7 MPCore == 0xc07
-//   BCM2710 BCM2837 Cortex-A53 MPCore == 0xd03
-// Common for all are 'CPU implementer' == 0x41
-static int identify_cpu(void) {
-	char *begin, *end, *buf;
-	int res;
+// Set which power consumer each child runs from a comma
+// separated list of consumer names, such as
+// "neon,mem,neon,io". Child <n> runs on the <n>th loaded
+// core modulo the number of loaded cores. Returns -1 on
+// a bad map.
+int high_load_set_map(const char *map) {
+	char *buf, *tok, *save;
+	int i, n, res;
 
 	res = 0;
-	buf = NULL;
-	cpuId = CPU_UNKNOWN;
-	cpuName = "unknown";
-	nCpus = sysconf(_SC_NPROCESSORS_ONLN);
-	if(nCpus < 1) return -1;
-
-	res = read_cpuinfo(&buf);													// Fill buffer
-
-	begin = end = NULL;
-	if(!res && buf) {
-		res = grep(buf,
-			"^cpu part[[:space:]]*:[[:space:]]*(0x)?[[:xdigit:]]+$",			// Search with regular expression
-			(const char **) &begin, (const char **) &end);
-	}
-
-	if(!res && buf && begin && end) {
-		*end = 0;																// Null terminate string
-		begin = strrchr(begin, ':');											// Find filed separator
-		if(begin && sscanf(begin + 1, "%i", &res) == 1 && res > 0) {			// strtol() but with auto base
-			switch(res) {
-				case 0xb76:
-					cpuId = CPU_BCM2835;
-					cpuName = "BCM2835";
-					break;
-				case 0xc07:
-					cpuId = CPU_BCM2836;
-					cpuName = "BCM2836";
-					break;
-				case 0xd03:
-					cpuId = CPU_BCM2837;
-					cpuName = "BCM2837";
-					break;
-				default:
-					break;
-			}
+	n = 0;
+	buf = strdup(map);
+
+	for(tok = strtok_r(buf, ",", &save); tok && !res;
+			tok = strtok_r(NULL, ",", &save)) {
+		for(i = 0; i < N_CONSUMERS && strcmp(tok, consumers[i].name); i++);
+
+		if(i == N_CONSUMERS) {
+			log_error("Error, unknown power consumer %s\n", tok);
+			res = -1;
 		}
-		printf("Preparing %s system processor...\n", cpuName);
-		res = 0;
+		else if(!is_supported(i)) {
+			log_error("Error, power consumer %s not supported "
+				"by this system\n", tok);
+			res = -1;
+		}
+		else if(n == MAX_SLOTS) {
+			log_error("Error, to many power consumers in map\n");
+			res = -1;
+		}
+		else {
+			slotMap[n++] = i;
+		}
+	}
+
+	if(!res && n == 0) {
+		log_error("Error, empty power consumer map\n");
+		res = -1;
+	}
+	if(!res) nSlots = n;
+
+	free(buf);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the current power consumer map as text, in
+// the same format as accepted by high_load_set_map().
+const char* high_load_get_map(void) {
+	static char buf[MAX_SLOTS * 8];
+	int i, len;
+
+	buf[0] = 0;
+	for(i = 0, len = 0; i < nSlots && len < (int) sizeof(buf); i++) {
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+			i ? "," : "", consumers[slotMap[i]].name);
 	}
 
-	// Does the CPU as well as the OS have ARM Neon support?
-	begin = end = NULL;
-	if(!res && buf) {
-		res = grep(buf,
-			"^Features[[:space:]]*:[[:space:]]?[[:alnum:][:space:]]*neon[[:space:]]?",
-			(const char **) &begin, (const char **) &end);
+	return buf;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when <cpu> is one of the cores we load
+static int is_loaded_cpu(const int cpu) {
+	int i;
+
+	for(i = 0; i < nCpus; i++) {
+		if(cpuList[i] == cpu) return 1;
 	}
-	osHasNeon = !res && buf && begin && end;									// Flag true if match was found
 
-	free(buf);																	// Allocated in read_cpuinfo()
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Prepare threads for a new spawn and load cycle
+// according to the current power consumer map. All
+// childs of a previous cycle must have been collected.
+int high_load_start(const int ms) {
+	int i, nIo, cpu;
+
+	for(i = 0; i < nSlots && slotMap[i] != CONSUMER_JIT; i++);
+	if(i < nSlots && jit_prepare()) return -1;									// Generate code before childs run it
+
+	free(childs);
+	free(ctrls);
+	ctrls = NULL;
+	maxChilds = nSlots;
+	childs = calloc(maxChilds, sizeof(struct child_t));
+	if(!childs || posix_memalign((void**) &ctrls, CHILD_CTRL_ALIGN,
+			maxChilds * sizeof(struct child_ctrl_t))) {
+		log_errno("Error allocating childs");
+		return -1;
+	}
+	memset(ctrls, 0, maxChilds * sizeof(struct child_ctrl_t));
+	nCycles++;
+
+	for(i = 0, nIo = 0; i < maxChilds; i++) {
+		childs[i].ctrl = &ctrls[i];
+		childs[i].ctrl->duty = slotDuty[i];
+		childs[i].state = THREAD_NONE;
+		childs[i].index = i;
+		childs[i].exitStatus = -1;
+		child_seed(&childs[i]);
+
+		// I/O childs take one storage device each, in turn,
+		// and run near the interrupt of it when we can.
+		cpu = cpuList[i % nCpus];
+		if(slotMap[i] == CONSUMER_IO) {
+			childs[i].arg = nIo++;
+			if(is_loaded_cpu(storage_dev_cpu(childs[i].arg))) {
+				cpu = storage_dev_cpu(childs[i].arg);
+			}
+		}
+		childs[i].consumer = consumers[slotMap[i]].func ?
+			consumers[slotMap[i]].func : cpu_consumer(cpu);
+		CPU_ZERO(&childs[i].cpuMask);
+		CPU_SET(cpu, &childs[i].cpuMask);
+	}
+
+	hasFullLoad = 0;
+	isStopping = 0;
+	loadTime = ms;
+	timer_set(&spawnTimer, 0);
+	timer_set(&loadTimer, 9999999);
 
 	return 0;
 }
@@ -276,12 +656,14 @@ static int identify_cpu(void) {
 // until told to exit.
 int burn_cpu_generic(struct child_t *me) {
 	volatile int dummy __attribute__ ((unused));
+	uint32_t n;
 
 	// Burn cpu! :)
-	while(!do_exit) {
-		dummy = random();
+	for(n = 0; !me->ctrl->stop; n++) {
+		dummy = child_random(me);
 		pthread_yield();
 	}
+	me->ctrl->iters = n;
 
 	return EXIT_SUCCESS;
 }
@@ -297,62 +679,41 @@ int idle_cpu(struct child_t *me) {
 
 
 //-------------------------------------------------------------
-// Power consumer: read random locations in the SD card
-// in a loop until told to exit. This will make
-// the board consume some extra mA.
-int dump_sdcard(struct child_t *me) {
-	const int SDREAD_LEN = 4 * 1024;
-	off64_t sdSize, sdOffs;
-	int sdFd, res;
-	char *buf;
-
-	sdFd = open("/dev/mmcblk0", O_RDONLY | O_LARGEFILE | O_NOATIME);
-	if(sdFd == -1 || sdFd == 0) {
-		perror("Error opening SD card block device");
-		if(errno == EACCES && geteuid() != 0) {
-			fprintf(stderr, "You need to become root!\n");
-		}
+// Power consumer: stream data between two buffers much
+// larger than the caches, in a loop until told to exit.
+// Stresses the memory controller and the SDRAM supply
+// rather than the processor core.
+int stream_mem(struct child_t *me) {
+	char *src, *dst, *tmp;
+	uint32_t n;
+	int offs;
+
+	src = malloc(MEM_STREAM_LEN);
+	dst = malloc(MEM_STREAM_LEN);
+	if(!src || !dst) {
+		log_errno("Error allocating memory streaming buffers");
+		free(src);
+		free(dst);
 		return EXIT_FAILURE;
 	}
+	memset(src, 0x5a, MEM_STREAM_LEN);
+	memset(dst, 0xa5, MEM_STREAM_LEN);
 
-	// How large is the SD card?
-	sdSize = lseek64(sdFd, 0, SEEK_END);
-	if(sdSize == -1 || sdSize <= SDREAD_LEN) {
-		printf("Error determining SD card size");
-		close(sdFd);
-		return EXIT_FAILURE;
-	}
-
-	res = 0;
-	buf = malloc(SDREAD_LEN);
-
-	do {
-		// Read from a random address in the SD card.
-		sdOffs = random() % (sdSize - (off64_t) SDREAD_LEN);
-		res = lseek64(sdFd, sdOffs, SEEK_SET);
-		if(res == -1) {
-			perror("Error setting random SD card offset");
-			break;
+	for(n = 0; !me->ctrl->stop;) {
+		for(offs = 0; offs < MEM_STREAM_LEN && !me->ctrl->stop;
+				offs += MEM_STREAM_CHUNK, n++) {
+			memcpy(dst + offs, src + offs, MEM_STREAM_CHUNK);
 		}
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	me->ctrl->iters = n;														// One per chunk
 
-		res = read(sdFd, buf, SDREAD_LEN);
-		if(res == -1) {
-			if(errno == EINTR) {
-				res = 0;
-			}
-			else {
-				perror("Error reading from SD card block device");
-				break;
-			}
-		}
-
-		pthread_yield();
-	} while(!do_exit);
-
-	close(sdFd);
-	free(buf);
+	free(src);
+	free(dst);
 
-	return (res == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+	return EXIT_SUCCESS;
 }
 
 
@@ -382,8 +743,12 @@ static const enum child_state_t child_state(const int idx) {
 // the thread is about to terminate.
 static void child_exit_clean(void *arg) {
 	struct child_t *me = arg;
+	uint64_t one = 1;
 	int i;
 
+	if(me->hasDutyTimer) timer_delete(me->dutyTimer);
+	me->hasDutyTimer = 0;
+
 	// Slow throttle when high load test has finished
 	for(i = 0; i < me->index * 50; i++) pthread_yield();
 
@@ -392,9 +757,11 @@ static void child_exit_clean(void *arg) {
 
 	/* Wake up parent from sleep so it can collect
 	 * our exit code. We would have preferrd the kernel
-	 * to send a signal instead, as with fork(). */
+	 * to send a signal instead, as with fork(). The
+	 * event fd is ours, unlike any signal. */
+	trace_event(TR_CONSUMER_END, me->index);
 	me->state = THREAD_ENDING;
-	pthread_kill(parentThread, SIGCHLD);
+	while(write(eventFd, &one, sizeof(one)) == -1 && errno == EINTR);
 }
 
 
@@ -406,6 +773,7 @@ static void* child_main(void *arg) {
 	struct sched_param schedParam;
 	struct child_t *me;
 	sigset_t sigsBlk;
+	uint32_t gen;
 	int res = 0;
 
 	/* Wait for parent to write my thread ID into global struct.
@@ -416,6 +784,7 @@ static void* child_main(void *arg) {
 	}
 	me->tid = syscall(SYS_gettid);
 	me->state = THREAD_RUNNING;
+	trace_worker(me->index);
 	pthread_cleanup_push(child_exit_clean, me);
 	//printf("Child %lu %d has started\n", me->thread, me->tid);
 	//fflush(NULL);
@@ -429,12 +798,12 @@ static void* child_main(void *arg) {
 	schedParam.sched_priority = 0;
 	res = pthread_setschedparam(me->thread, SCHED_BATCH, &schedParam);
 	if(res == -1) {
-		perror("Error setting low priority class");
+		log_errno("Error setting low priority class");
 		pthread_exit((void*) EXIT_FAILURE);
 	}
 	res = setpriority(PRIO_PROCESS, me->tid, 18);
 	if(res == -1) {
-		perror("Error setting child as nice prio");
+		log_errno("Error setting child as nice prio");
 		pthread_exit((void*) EXIT_FAILURE);
 	}
 
@@ -444,13 +813,61 @@ static void* child_main(void *arg) {
 	res |= sigdelset(&sigsBlk, SIGUSR2);
 	res |= pthread_sigmask(SIG_BLOCK, &sigsBlk, NULL);
 	if(res == -1) {
-		perror("Error setting child signal mask");
+		log_errno("Error setting child signal mask");
 		pthread_exit((void*) EXIT_FAILURE);
 	}
 	
-	// Run the power consumer algorithm
-	srandom(me->tid + time(NULL));
-	if(me->consumer) res = me->consumer(me);
+	// Periodic timer signal which pauses the consumer
+	if(hasDuty) {
+		struct sigevent sigEv;
+		struct itimerspec period;
+
+		memset(&sigEv, 0, sizeof(sigEv));
+		sigEv.sigev_notify = SIGEV_THREAD_ID;
+		sigEv.sigev_signo = SIGUSR1;
+		sigEv.sigev_value.sival_ptr = me;
+		sigEv.sigev_notify_thread_id = me->tid;
+		period.it_interval.tv_sec = 0;
+		period.it_interval.tv_nsec = DUTY_PERIOD * 1000000L;
+		period.it_value = period.it_interval;
+		if(timer_create(CLOCK_MONOTONIC, &sigEv, &me->dutyTimer) == -1) {
+			log_errno("Error creating duty cycle timer");
+			pthread_exit((void*) EXIT_FAILURE);
+		}
+		me->hasDutyTimer = 1;
+		if(timer_settime(me->dutyTimer, 0, &period, NULL) == -1) {
+			log_errno("Error starting duty cycle timer");
+			pthread_exit((void*) EXIT_FAILURE);
+		}
+	}
+
+	/* Run the power consumer algorithm until told to
+	 * stop. While paused we sleep on the generation
+	 * counter of our control block until it changes. */
+	trace_event(TR_CONSUMER_BEGIN, me->index);
+	while(me->consumer) {
+		gen = me->ctrl->gen;
+		__sync_synchronize();
+		if(me->ctrl->pause) {
+			syscall(SYS_futex, &me->ctrl->gen, FUTEX_WAIT_PRIVATE, gen,
+				NULL, NULL, 0);
+			continue;
+		}
+		if(me->ctrl->stop) break;
+
+		/* Back to the top to see why the consumer returned,
+		 * it may have been paused and resumed already. The
+		 * generation is bumped after stop is set, so stop or
+		 * pause may show before it changes. Only when none
+		 * of them did it ended by itself; we are done. */
+		res = me->consumer(me);
+		if(res) break;
+		if(!__atomic_load_n(&me->ctrl->stop, __ATOMIC_ACQUIRE) &&
+				!__atomic_load_n(&me->ctrl->pause, __ATOMIC_ACQUIRE) &&
+				__atomic_load_n(&me->ctrl->gen, __ATOMIC_ACQUIRE) == gen) {
+			break;
+		}
+	}
 
 	pthread_cleanup_pop(1);
 	pthread_exit((void*) res);
@@ -477,7 +894,7 @@ static int child_spawn(void) {
 	res = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t),
 		&childs[cIdx].cpuMask);
 	if(res == -1) {
-		perror("Error, couldn't set child cpu affinity");
+		log_errno("Error, couldn't set child cpu affinity");
 		return -1;
 	}
 
@@ -486,9 +903,10 @@ static int child_spawn(void) {
 	res = pthread_create(&childs[cIdx].thread, &attr,
 		child_main, &childs[cIdx]);
 	if(res == -1) {
-		perror("Error spawning a child");
+		log_errno("Error spawning a child");
 		return -1;
 	}
+	trace_event(TR_SPAWN, cIdx);
 	//printf("Parent %lu spawned %lu\n", pthread_self(), childs[cIdx].thread);
 	//fflush(NULL);
 
@@ -508,7 +926,7 @@ static int child_spawn(void) {
 //-------------------------------------------------------------
 // Has any child exited? Then collect their exit
 // status to prevent them from becoming a zombie.
-static int collect_child_exit(void) {
+static int collect_child_exit(int *sleepMs) {
 	void *exitVal;
 	int res, i;
 
@@ -517,14 +935,15 @@ static int collect_child_exit(void) {
 
 		res = pthread_join(childs[i].thread, &exitVal);
 		if(res == -1) {
-			perror("Error collecting child exit status");
+			log_errno("Error collecting child exit status");
 		}
 		else if(res == 0) {
 			childs[i].state = THREAD_HALTED;
 			childs[i].exitStatus = (int) exitVal;
+			trace_event(TR_CHILD_EXIT, childs[i].exitStatus);
 			//printf("Collected child %lu exit status %d\n",
 			//	childs[i].thread, childs[i].exitStatus);
-			maxSleep(0);
+			sleep_limit(sleepMs, 0);
 			if(childs[i].exitStatus) return -1;
 		}
 	}
@@ -555,6 +974,247 @@ int isAnyChildAlive(void) {
 
 
 
+//-------------------------------------------------------------
+// Returns the number of cores we load
+int high_load_cores(void) {
+	return nCpus;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the core number of loaded core <idx>, or -1
+int high_load_cpu(const int idx) {
+	return idx >= 0 && idx < nCpus ? cpuList[idx] : -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the number of childs of the current cycle
+int high_load_workers(void) {
+	return maxChilds;
+}
+
+
+
+//-------------------------------------------------------------
+// Find the childs running power consumer <name>, not
+// paused, and store the core of each in <cpus>. Returns
+// the number of such childs.
+int high_load_running_cpus(const char *name, int *cpus, const int maxCpus) {
+	int (*func)(struct child_t *me);
+	int i, j, n;
+
+	for(i = 0; i < N_CONSUMERS && strcmp(name, consumers[i].name); i++);
+	if(i == N_CONSUMERS) return 0;
+	func = i == CONSUMER_CPU ? cpuConsumer : consumers[i].func;
+
+	for(i = 0, n = 0; i < maxChilds && n < maxCpus; i++) {
+		if(childs[i].consumer != func || child_state(i) != THREAD_RUNNING ||
+			ctrls[i].pause || ctrls[i].stop) continue;
+		for(j = 0; j < HW_MAX_CPUS && !CPU_ISSET(j, &childs[i].cpuMask); j++);
+		cpus[n++] = j;
+	}
+
+	return n;
+}
+
+
+
+//-------------------------------------------------------------
+// Find the last child running power consumer <name>, or
+// any consumer when NULL, which is paused if <isPaused>
+// is true and else not. Returns its index or -1.
+int high_load_find(const char *name, const int isPaused) {
+	int (*func)(struct child_t *me);
+	int i;
+
+	func = NULL;
+	if(name) {
+		for(i = 0; i < N_CONSUMERS && strcmp(name, consumers[i].name); i++);
+		if(i == N_CONSUMERS) return -1;
+		func = i == CONSUMER_CPU ? cpuConsumer : consumers[i].func;
+		if(!func) return -1;													// Not built in
+	}
+
+	for(i = maxChilds - 1; i >= 0; i--) {
+		if(child_state(i) != THREAD_RUNNING || !ctrls[i].pause != !isPaused) continue;
+		if(func && childs[i].consumer != func) continue;
+		return i;
+	}
+
+	return -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Count the childs running their consumer, not paused,
+// and set a bit in <kinds> per kind of consumer they run.
+// Kinds are numbered as by high_load_consumer_name().
+int high_load_active(uint16_t *kinds) {
+	int i, j, n;
+
+	*kinds = 0;
+	for(i = 0, n = 0; i < maxChilds; i++) {
+		if(child_state(i) != THREAD_RUNNING || ctrls[i].pause || ctrls[i].stop) continue;
+		n++;
+		for(j = 0; j < N_CONSUMERS && consumers[j].func != childs[i].consumer; j++);
+		if(j < N_CONSUMERS && j < 16) *kinds |= 1u << j;
+		else if(childs[i].consumer == cpuConsumer) *kinds |= 1u << CONSUMER_CPU;
+	}
+
+	return n;
+}
+
+
+
+//-------------------------------------------------------------
+// Name of consumer kind <id>, or NULL past the last
+const char* high_load_consumer_name(const int id) {
+	return (id >= 0 && id < N_CONSUMERS) ? consumers[id].name : NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Thread of the self check, runs the consumer once
+static void* isa_check_main(void *arg) {
+	struct isa_check_t *check;
+
+	check = (struct isa_check_t*) arg;
+	check->cpu = sched_getcpu();
+	check->me.exitStatus = check->me.consumer(&check->me);
+
+	return NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Self check of the processor consumer variants. Lists
+// the ones built into this binary and which of them the
+// processor supports, then runs the variant picked for
+// each loaded core shortly on that core. Returns -1 if
+// any of them fails.
+int high_load_isa_check(void) {
+	struct child_ctrl_t ctrl;
+	struct isa_check_t check;
+	pthread_attr_t attr;
+	int i, j, n, res;
+
+	log_info("Processor consumers built in:");
+	for(i = 0; i < (int) (sizeof(cpuVariants) / sizeof(cpuVariants[0])); i++) {
+		if(consumers[cpuVariants[i]].func) log_info(" %s", consumers[cpuVariants[i]].name);
+	}
+	log_info("\nSupported by this system:    ");
+	for(i = 0; i < (int) (sizeof(cpuVariants) / sizeof(cpuVariants[0])); i++) {
+		if(is_supported(cpuVariants[i])) log_info(" %s", consumers[cpuVariants[i]].name);
+	}
+	log_info("\n");
+
+	for(i = 0, n = 0; i < nCpus; i++) {
+		memset(&ctrl, 0, sizeof(ctrl));
+		memset(&check, 0, sizeof(check));
+		check.me.ctrl = &ctrl;
+		check.me.index = i;
+		check.me.exitStatus = -1;
+		check.me.consumer = cpu_consumer(cpuList[i]);
+		check.cpu = -1;
+		child_seed(&check.me);
+		CPU_ZERO(&check.me.cpuMask);
+		CPU_SET(cpuList[i], &check.me.cpuMask);
+		for(j = 0; j < N_CONSUMERS && consumers[j].func != check.me.consumer; j++);
+
+		pthread_attr_init(&attr);
+		res = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &check.me.cpuMask);
+		if(!res) res = pthread_create(&check.me.thread, &attr, isa_check_main, &check);
+		pthread_attr_destroy(&attr);
+		if(res) {
+			log_error("Error starting self check on core %d: %s\n",
+				cpuList[i], strerror(res));
+			return -1;
+		}
+		usleep(ISA_CHECK_TIME * 1000);
+		ctrl.stop = 1;
+		pthread_join(check.me.thread, NULL);
+
+		res = check.me.exitStatus == EXIT_SUCCESS && check.cpu == cpuList[i];
+		if(!res) n++;
+		log_info("Core %d: %-8s %s\n", cpuList[i], j < N_CONSUMERS ?
+			consumers[j].name : "?", res ? "ok" : "FAILED");
+	}
+
+	return n ? -1 : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true while all childs are consuming maximum
+// power, until the end of the load period.
+int high_load_is_full(void) {
+	return hasFullLoad && !isStopping;
+}
+
+
+
+//-------------------------------------------------------------
+// End the cycle. Childs are told to exit by the
+// following calls of the manager.
+void high_load_stop(void) {
+	isStopping = 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when the cycle is ending
+int high_load_is_stopping(void) {
+	return isStopping;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns a file descriptor which turns readable when a
+// child has exited, to wake up the caller of the manager.
+int high_load_event_fd(void) {
+	return eventFd;
+}
+
+
+
+//-------------------------------------------------------------
+// Forget child exit events, before they are handled
+void high_load_clear_events(void) {
+	uint64_t n;
+
+	while(eventFd >= 0 && read(eventFd, &n, sizeof(n)) > 0);
+}
+
+
+
+//-------------------------------------------------------------
+// Release the childs of the last test and the event fd.
+// Childs which refused to die keep both, rather than
+// having them pulled from under their feet. The map,
+// duty cycles and seed are kept for a following init.
+void high_load_close(void) {
+	if(isAnyChildAlive()) return;
+
+	free(childs);
+	free(ctrls);
+	childs = NULL;
+	ctrls = NULL;
+	maxChilds = 0;
+	if(eventFd >= 0) close(eventFd);
+	eventFd = -1;
+}
+
+
+
 //-------------------------------------------------------------
 // Returns true when all childrens have been started
 static int hasAllChildsStarted(void) {
@@ -603,7 +1263,7 @@ int kill_remaining_childs(void) {
 			case THREAD_RUNNING:
 			case THREAD_ENDING:
 				if(pthread_kill(childs[i].thread, SIGKILL)) {
-					perror("Error killing child hard");
+					log_errno("Error killing child hard");
 				}
 				break;
 			default:
@@ -617,7 +1277,7 @@ int kill_remaining_childs(void) {
 
 
 //-------------------------------------------------------------
-int high_load_manager(void) {
+int high_load_manager(int *sleepMs) {
 	int res;
 
 	res = 0;
@@ -629,26 +1289,37 @@ int high_load_manager(void) {
 	 * the program will exit with a failure
 	 * return code. */
 	if(timer_timeout(&loadTimer)) {
-		do_exit = 1;
+		isStopping = 1;
 	}
 	else if(hasAnyChildAborted()) {
 		res = -1;
 	}
 	else {
-		maxSleep(timer_remaining(&loadTimer));
-		if(do_exit) res = -1;
+		sleep_limit(sleepMs, timer_remaining(&loadTimer));
+		if(isStopping) res = -1;
+	}
+
+	if(isStopping) stop_childs();
+
+	// Full load has ended, for whatever reason
+	if(hasFullLoad && isStopping) {
+		hasFullLoad = 0;
+		trace_event(TR_LOAD_END, 0);
+		freqmon_set_phase(FREQ_PH_ENDING);
 	}
 
-	if(!res && !do_exit) {
+	if(!res && !isStopping) {
 		if(hasFullLoad) {
 			if(!isAnyChildAlive()) res = -1;
 		}
 		else {
 			if(hasAllChildsStarted() && timer_timeout(&spawnTimer)) {
 				hasFullLoad = 1;
-				printf("Power consumption test in progress...\n");
-				timer_set(&loadTimer, load_time);
-				maxSleep(load_time);
+				trace_event(TR_LOAD_BEGIN, 0);
+				freqmon_set_phase(FREQ_PH_LOAD);
+				log_info("Power consumption test in progress...\n");
+				timer_set(&loadTimer, loadTime);
+				sleep_limit(sleepMs, loadTime);
 			}
 			else {
 				/* Time to spawn another child? We need some
@@ -660,13 +1331,13 @@ int high_load_manager(void) {
 					res = child_spawn();
 					timer_set(&spawnTimer, CHILD_SPAWN_DELAY);
 				}
-				maxSleep(timer_remaining(&spawnTimer));
+				sleep_limit(sleepMs, timer_remaining(&spawnTimer));
 			}
 		}
 	}
 
 	// Check if any child has exited
-	if(collect_child_exit()) res = -1;
+	if(collect_child_exit(sleepMs)) res = -1;
 
 	return res;
 }
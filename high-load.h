@@ -2,15 +2,86 @@
 #ifndef HIGH_LOAD_H
 #define HIGH_LOAD_H
 
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+
+
+//-------------------------------------------------------------
+#define CHILD_CTRL_ALIGN		64												// Cache line size of control blocks
+
 
 //-------------------------------------------------------------
-int load_time;																	// Number of milliseconds we run with full load
+enum child_state_t {
+	THREAD_NONE,
+	THREAD_STARTUP,
+	THREAD_RUNNING,
+	THREAD_ENDING,
+	THREAD_HALTED
+};
+
+/* Control block of a child, written by the parent and
+ * polled by the consumer. Each is alone in a cache line
+ * so changing one core doesn't disturb the others. The
+ * asm consumers poll <stop> with an unaligned load which
+ * also covers the zero <guard> word. Consumers count
+ * their loops and store the count in <iters> as they
+ * return, for the benchmark. The asm ones know the
+ * offset of both. */
+struct child_ctrl_t {
+	uint32_t guard;																// Always zero
+	volatile uint32_t stop;														// True when the consumer shall return
+	volatile uint32_t pause;													// True when the child idles instead of exit
+	volatile int32_t duty;														// Percent of time the consumer runs
+	volatile uint32_t gen;														// Bumped on every change, paused childs wait on it
+	volatile uint32_t iters;													// Loops of the last consumer run, set as it returns
+} __attribute__((aligned(CHILD_CTRL_ALIGN)));
+
+struct child_t {
+	struct child_ctrl_t *ctrl;													// Must be first, the asm consumers read it
+	volatile enum child_state_t state;											// The child thread state
+	int tid;																	// Linux PID of thread
+	pthread_t thread;															// Posix thread ID
+	int index;																	// Array index
+	cpu_set_t cpuMask;															// Affinity
+	int exitStatus;																// Return code after process exit
+	timer_t dutyTimer;															// Periodic timer pausing the consumer
+	int hasDutyTimer;															// True when duty timer has been created
+	int arg;																	// Consumer specific, such as storage device
+	uint32_t rng[4];															// Random generator state, seeded per cycle
+
+	int (*consumer)(struct child_t *me);										// Power consumer for specific thread
+};
 
 
 //-------------------------------------------------------------
+void high_load_reserve_cpu(const int cpu);
 int high_load_init(void);
+int high_load_set_map(const char *map);
+int high_load_set_duty(const int idx, const int duty);
+void high_load_pause(const int idx, const int isPaused);
+void high_load_set_seed(const uint64_t seed);
+uint64_t high_load_get_seed(void);
+const char* high_load_get_map(void);
+int high_load_start(const int ms);
+int high_load_cores(void);
+int high_load_cpu(const int idx);
+int high_load_workers(void);
+int high_load_is_full(void);
+void high_load_stop(void);
+int high_load_is_stopping(void);
+int high_load_event_fd(void);
+void high_load_clear_events(void);
+void high_load_close(void);
+int high_load_running_cpus(const char *name, int *cpus, const int maxCpus);
+int high_load_find(const char *name, const int isPaused);
+int high_load_active(uint16_t *kinds);
+const char* high_load_consumer_name(const int id);
+int high_load_isa_check(void);
+uint32_t child_random(struct child_t *me);
 int isAnyChildAlive(void);
 int kill_remaining_childs(void);
-int high_load_manager(void);
+int high_load_manager(int *sleepMs);
 
 #endif
@@ -0,0 +1,379 @@
+
+/* Identify the board, processor and core topology in a
+ * single pass. Hardware capabilities comes from the
+ * kernel auxiliary vector, the board from device tree
+ * and the topology from sysfs. The result is cached in
+ * a small identity file so later runs skip the probe.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/auxv.h>
+
+#include "hwprobe.h"
+#include "misc.h"
+
+
+//-------------------------------------------------------------
+#define IDENT_CACHE_FILE	"/run/rpiburn.ident"								// Cached identity, cleared at reboot (tmpfs)
+#define IDENT_VERSION		4													// Bump when the cache file format change
+
+/* Hardware capability bits from the kernel <asm/hwcap.h>.
+ * They differ between 32- and 64-bit ARM. */
+#if defined(__aarch64__)
+#define HW_HWCAP_NEON		(1ul << 1)											// HWCAP_ASIMD
+#define HW_HWCAP_ASIMD		(1ul << 1)											// HWCAP_ASIMD
+#define HW_HWCAP_CRYPTO		((1ul << 3) | (1ul << 4) | (1ul << 5) | (1ul << 6))	// AES, PMULL, SHA1, SHA2
+#define HW_HWCAP2_CRYPTO	0ul
+#elif defined(__arm__)
+#define HW_HWCAP_NEON		(1ul << 12)											// HWCAP_NEON
+#define HW_HWCAP_ASIMD		0ul
+#define HW_HWCAP_CRYPTO		0ul
+#define HW_HWCAP2_CRYPTO	((1ul << 0) | (1ul << 1) | (1ul << 2) | (1ul << 3))	// AES, PMULL, SHA1, SHA2
+#else
+#define HW_HWCAP_NEON		0ul
+#define HW_HWCAP_ASIMD		0ul
+#define HW_HWCAP_CRYPTO		0ul
+#define HW_HWCAP2_CRYPTO	0ul
+#endif
+
+
+//-------------------------------------------------------------
+struct hw_ident_t hwIdent;
+cpu_set_t hwAllowed;
+
+/* Map of device tree compatible strings and ARM 'CPU part'
+ * numbers to processor ID. Downstream kernels used the
+ * BCM27xx names for the first generations. */
+static const struct {
+	enum cpuid_t cpuId;
+	const char *name;
+	const char *compat[2];
+	unsigned int cpuPart;
+} socTable[] = {
+	{ CPU_BCM2835, "BCM2835", { "brcm,bcm2835", "brcm,bcm2708" }, 0xb76 },		// ARM1176JZF-S
+	{ CPU_BCM2836, "BCM2836", { "brcm,bcm2836", "brcm,bcm2709" }, 0xc07 },		// Cortex-A7 MPCore
+	{ CPU_BCM2837, "BCM2837", { "brcm,bcm2837", "brcm,bcm2710" }, 0xd03 },		// Cortex-A53 MPCore
+	{ CPU_BCM2711, "BCM2711", { "brcm,bcm2711", NULL }, 0xd08 },				// Cortex-A72 MPCore
+	{ CPU_BCM2712, "BCM2712", { "brcm,bcm2712", NULL }, 0xd0b },				// Cortex-A76 MPCore
+};
+
+#define SOC_TABLE_LEN		(int) (sizeof(socTable) / sizeof(socTable[0]))
+
+
+
+//-------------------------------------------------------------
+// Set processor ID and name from the table index
+static void set_soc(const int idx) {
+	if(idx >= 0 && idx < SOC_TABLE_LEN) {
+		hwIdent.cpuId = socTable[idx].cpuId;
+		hwIdent.cpuName = socTable[idx].name;
+	}
+	else {
+		hwIdent.cpuId = CPU_UNKNOWN;
+		hwIdent.cpuName = "unknown";
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Read the board model and revision code from device
+// tree. The revision is a big endian 32-bit cell.
+static void probe_board(char *model, const int modelLen, unsigned int *revision) {
+	unsigned char buf[8];
+	char path[256];
+	int len;
+
+	sys_path(path, sizeof(path), "/proc/device-tree/model");
+	len = read_file_str(path, model, modelLen);
+	if(len <= 0) snprintf(model, modelLen, "unknown board");
+
+	sys_path(path, sizeof(path), "/proc/device-tree/system/linux,revision");
+	len = read_file_str(path, (char*) buf, sizeof(buf));
+	*revision = (len == 4) ? ((unsigned int) buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3]) : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Identify the board by the device tree. The compatible
+// property is a list of null terminated strings where
+// one of them names the SoC.
+static int probe_device_tree(void) {
+	char buf[256], path[256], *p;
+	int len, i, j;
+
+	probe_board(hwIdent.model, sizeof(hwIdent.model), &hwIdent.revision);
+
+	sys_path(path, sizeof(path), "/proc/device-tree/compatible");
+	len = read_file_str(path, buf, sizeof(buf));
+	for(p = buf; len > 0 && p < buf + len; p += strlen(p) + 1) {
+		for(i = 0; i < SOC_TABLE_LEN; i++) {
+			for(j = 0; j < 2; j++) {
+				if(socTable[i].compat[j] && !strcmp(p, socTable[i].compat[j])) {
+					set_soc(i);
+					return 0;
+				}
+			}
+		}
+	}
+
+	return -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Fallback when the device tree doesn't tell; single
+// pass over /proc/cpuinfo for the 'CPU part' record.
+// Common for all are 'CPU implementer' == 0x41
+static int probe_cpuinfo(void) {
+	char line[256], path[256];
+	unsigned int part;
+	FILE *fp;
+	int i;
+
+	sys_path(path, sizeof(path), "/proc/cpuinfo");
+	fp = fopen(path, "r");
+	if(!fp) {
+		log_errno("Error opening cpuinfo");
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "CPU part : %i", &part) != 1) continue;
+		for(i = 0; i < SOC_TABLE_LEN; i++) {
+			if(socTable[i].cpuPart == part) set_soc(i);
+		}
+		break;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Ask the kernel for what the CPU and the OS supports.
+// Not all SIMD variants are visible in both AT_HWCAP
+// and AT_HWCAP2, depending on 32- or 64-bit ARM.
+static void probe_hwcaps(void) {
+	unsigned long hwcap, hwcap2;
+
+	hwcap = getauxval(AT_HWCAP);
+	hwcap2 = getauxval(AT_HWCAP2);
+
+	hwIdent.hasNeon = HW_HWCAP_NEON && (hwcap & HW_HWCAP_NEON);
+	hwIdent.hasAsimd = HW_HWCAP_ASIMD && (hwcap & HW_HWCAP_ASIMD);
+	hwIdent.hasCrypto = (HW_HWCAP_CRYPTO && (hwcap & HW_HWCAP_CRYPTO) ==
+		HW_HWCAP_CRYPTO) || (HW_HWCAP2_CRYPTO && (hwcap2 &
+		HW_HWCAP2_CRYPTO) == HW_HWCAP2_CRYPTO);
+
+#if defined(__x86_64__)
+	/* The x86-64 psABI levels. The cpuid bits alone
+	 * don't tell if the OS saves the wide registers,
+	 * but libgcc checks XCR0 for AVX and AVX-512. */
+	__builtin_cpu_init();
+	hwIdent.x86Level = 1;
+	if(__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse4.2") &&
+			__builtin_cpu_supports("ssse3")) {
+		hwIdent.x86Level = 2;
+		if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+				__builtin_cpu_supports("bmi2")) {
+			hwIdent.x86Level = 3;
+			if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+					__builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+				hwIdent.x86Level = 4;
+			}
+		}
+	}
+#endif
+}
+
+
+
+//-------------------------------------------------------------
+// Read which cores are online and how they are
+// grouped from sysfs. Core 0 has no online attribute
+// since it can't be taken offline. SMT siblings share
+// core and cluster ID. Capacity is only present on
+// systems with different kinds of cores.
+static int probe_topology(void) {
+	char path[256];
+	long val;
+	int i, j, nConf;
+
+	nConf = sysconf(_SC_NPROCESSORS_CONF);
+	if(nConf > HW_MAX_CPUS) nConf = HW_MAX_CPUS;
+	hwIdent.nCpus = 0;
+
+	for(i = 0; i < nConf; i++) {
+		sys_path(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/online", i);
+		hwIdent.cpu[i].online = read_file_long(path, &val) ? 1 : (val != 0);
+		if(hwIdent.cpu[i].online) hwIdent.nCpus++;
+
+		sys_path(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+		hwIdent.cpu[i].coreId = read_file_long(path, &val) ? i : val;
+
+		sys_path(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/cluster_id", i);
+		if(read_file_long(path, &val)) {
+			sys_path(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+			if(read_file_long(path, &val)) val = 0;
+		}
+		hwIdent.cpu[i].clusterId = val;
+
+		sys_path(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpu_capacity", i);
+		hwIdent.cpu[i].capacity = (read_file_long(path, &val) || val < 1) ? 1024 : val;
+
+		for(j = 0; j < i; j++) {
+			if(hwIdent.cpu[j].online && hwIdent.cpu[j].coreId == hwIdent.cpu[i].coreId &&
+				hwIdent.cpu[j].clusterId == hwIdent.cpu[i].clusterId) {
+				hwIdent.cpu[i].threadIdx++;
+			}
+		}
+	}
+
+	return (hwIdent.nCpus < 1 ? -1 : 0);
+}
+
+
+
+//-------------------------------------------------------------
+// Load a previously saved identity. Discarded if from
+// another version, if the number of cores has changed
+// or if the board isn't the same, as when the SD card
+// moved to another board.
+static int load_ident(void) {
+	char line[sizeof(hwIdent.model) + 16], name[16], model[sizeof(hwIdent.model)];
+	unsigned int revision;
+	int i, n, ver, coreId, clusterId, online, threadIdx, capacity;
+	FILE *fp;
+
+	fp = fopen(IDENT_CACHE_FILE, "r");
+	if(!fp) return -1;
+
+	ver = -1;
+	memset(&hwIdent, 0, sizeof(hwIdent));
+	set_soc(-1);
+
+	while(fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = 0;
+		if(sscanf(line, "version=%d", &ver) == 1) continue;
+		if(sscanf(line, "neon=%d", &hwIdent.hasNeon) == 1) continue;
+		if(sscanf(line, "asimd=%d", &hwIdent.hasAsimd) == 1) continue;
+		if(sscanf(line, "crypto=%d", &hwIdent.hasCrypto) == 1) continue;
+		if(sscanf(line, "x86level=%d", &hwIdent.x86Level) == 1) continue;
+		if(sscanf(line, "revision=%x", &hwIdent.revision) == 1) continue;
+
+		if(sscanf(line, "soc=%15s", name) == 1) {
+			for(i = 0; i < SOC_TABLE_LEN; i++) {
+				if(!strcmp(name, socTable[i].name)) set_soc(i);
+			}
+		}
+		else if(!strncmp(line, "model=", 6)) {
+			snprintf(hwIdent.model, sizeof(hwIdent.model), "%.*s",
+				(int) sizeof(hwIdent.model) - 1, line + 6);
+		}
+		else if(sscanf(line, "cpu%d=%d,%d,%d,%d,%d", &n, &online, &coreId, &clusterId,
+				&threadIdx, &capacity) == 6 && n >= 0 && n < HW_MAX_CPUS) {
+			hwIdent.cpu[n].online = online;
+			hwIdent.cpu[n].coreId = coreId;
+			hwIdent.cpu[n].clusterId = clusterId;
+			hwIdent.cpu[n].threadIdx = threadIdx;
+			hwIdent.cpu[n].capacity = capacity;
+			if(online) hwIdent.nCpus++;
+		}
+	}
+
+	fclose(fp);
+
+	if(ver != IDENT_VERSION) return -1;
+	if(hwIdent.nCpus != sysconf(_SC_NPROCESSORS_ONLN)) return -1;
+
+	probe_board(model, sizeof(model), &revision);
+	if(strcmp(model, hwIdent.model) || revision != hwIdent.revision) return -1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Save the identity for later runs. Write to a temporary
+// file and rename it, so a concurrent reader never sees
+// a partial file. Failure is not fatal.
+static void save_ident(void) {
+	char tmpName[sizeof(IDENT_CACHE_FILE) + 16];
+	FILE *fp;
+	int i;
+
+	snprintf(tmpName, sizeof(tmpName), "%s.%d", IDENT_CACHE_FILE, getpid());
+	fp = fopen(tmpName, "w");
+	if(!fp) return;
+
+	fprintf(fp, "version=%d\n", IDENT_VERSION);
+	fprintf(fp, "soc=%s\n", hwIdent.cpuName);
+	fprintf(fp, "model=%s\n", hwIdent.model);
+	fprintf(fp, "revision=%x\n", hwIdent.revision);
+	fprintf(fp, "neon=%d\n", hwIdent.hasNeon);
+	fprintf(fp, "asimd=%d\n", hwIdent.hasAsimd);
+	fprintf(fp, "crypto=%d\n", hwIdent.hasCrypto);
+	fprintf(fp, "x86level=%d\n", hwIdent.x86Level);
+	for(i = 0; i < HW_MAX_CPUS; i++) {
+		if(!hwIdent.cpu[i].online) continue;
+		fprintf(fp, "cpu%d=%d,%d,%d,%d,%d\n", i, hwIdent.cpu[i].online,
+			hwIdent.cpu[i].coreId, hwIdent.cpu[i].clusterId,
+			hwIdent.cpu[i].threadIdx, hwIdent.cpu[i].capacity);
+	}
+
+	if(fclose(fp) || rename(tmpName, IDENT_CACHE_FILE)) unlink(tmpName);
+}
+
+
+
+//-------------------------------------------------------------
+// Identify the system. Use the cached identity from
+// an earlier run when allowed and still valid. Never
+// when probing a fake system tree.
+int hw_probe(const int useCache) {
+	int res;
+
+	if(!useCache || sysRoot[0] || load_ident()) {
+		memset(&hwIdent, 0, sizeof(hwIdent));
+		set_soc(-1);
+
+		probe_hwcaps();
+		if(probe_device_tree()) probe_cpuinfo();
+		res = probe_topology();
+		if(res) {
+			log_error("Error, no online processor cores found\n");
+			return -1;
+		}
+
+		if(!sysRoot[0]) save_ident();
+	}
+
+	/* Cores we may run on, which may be a subset when
+	 * started in a cpuset or with taskset. Taken here
+	 * before the monitor pins the main thread. */
+	if(sched_getaffinity(0, sizeof(hwAllowed), &hwAllowed)) {
+		log_errno("Error reading allowed cores");
+		return -1;
+	}
+
+	log_info("Preparing %s system processor (%s)...\n", hwIdent.cpuName,
+		hwIdent.model);
+
+	return 0;
+}
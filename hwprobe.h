@@ -0,0 +1,51 @@
+
+#ifndef HWPROBE_H
+#define HWPROBE_H
+
+#include <sched.h>
+
+
+//-------------------------------------------------------------
+#define HW_MAX_CPUS			64													// Max number of processor cores we keep track of
+
+
+enum cpuid_t {																	// System processor ID
+	CPU_UNKNOWN,
+	CPU_BCM2835,																// RPi 1
+	CPU_BCM2836,																// RPi 2
+	CPU_BCM2837,																// RPi 3
+	CPU_BCM2711,																// RPi 4
+	CPU_BCM2712,																// RPi 5
+};
+
+struct hw_cpu_t {
+	int online;																	// True when the core is online
+	int coreId;																	// Physical core ID from sysfs topology
+	int clusterId;																// Cluster (or package) ID from sysfs topology
+	int threadIdx;																// Index among SMT siblings of the physical core
+	int capacity;																// Relative performance, 1024 for the fastest
+};
+
+struct hw_ident_t {
+	enum cpuid_t cpuId;															// System processor ID
+	const char *cpuName;														// System processor name (text)
+	char model[128];															// Board model from device tree
+	unsigned int revision;														// Board revision code from device tree, 0 when unknown
+	int hasNeon;																// True when the OS and CPU has ARM Neon support
+	int hasAsimd;																// True when the OS and CPU has ARMv8 Advanced SIMD
+	int hasCrypto;																// True when the OS and CPU has ARMv8 crypto extensions
+	int x86Level;																// x86-64 microarchitecture level 1 - 4, 0 when not x86
+	int nCpus;																	// Number of online processor cores in system
+	struct hw_cpu_t cpu[HW_MAX_CPUS];											// Per core topology
+};
+
+
+//-------------------------------------------------------------
+extern struct hw_ident_t hwIdent;												// Result of the hardware probe
+extern cpu_set_t hwAllowed;														// Cores the process may run on, at probe time
+
+
+//-------------------------------------------------------------
+int hw_probe(const int useCache);
+
+#endif
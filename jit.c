@@ -0,0 +1,690 @@
+
+/* Power consumer generated at run time. A loop is
+ * described as a list of instruction classes and
+ * registers, independent of architecture, and emitted
+ * as machine code into an executable page. This lets a
+ * search evolve the instruction mix and dependency
+ * chains per processor, instead of the fixed mix of the
+ * hand written asm consumers. Code generators exist for
+ * A32, A64 and x86-64, the latter so the search can be
+ * developed on a workstation.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+
+#include "jit.h"
+#include "hwprobe.h"
+#include "misc.h"
+#include "perf.h"
+
+
+//-------------------------------------------------------------
+#define JIT_VERSION				1												// Bump when the loop file format change
+#define JIT_CODE_SIZE			4096											// Executable page with the loop
+#define JIT_N_REGS				8												// Registers of each kind a loop use
+#define JIT_N_SLOTS				16												// 8 byte slots for loads and stores
+#define JIT_BUF_LEN				256												// Scratch buffer of each child
+#define JIT_BUF_INT				128												// Offset of integer register start values
+#define JIT_BUF_FLOAT			192												// Offset of four single precision 1.0
+#define JIT_BUF_DOUBLE			208												// Offset of two double precision 1.0
+
+#if defined(__x86_64__)
+#define JIT_ISA					"x86-64"
+#elif defined(__aarch64__)
+#define JIT_ISA					"a64"
+#elif defined(__arm__)
+#define JIT_ISA					"a32"
+#else
+#define JIT_ISA					NULL
+#endif
+
+
+//-------------------------------------------------------------
+typedef void (*jit_func_t)(volatile uint32_t *stop, void *buf);
+
+struct emit_t {
+	uint8_t *start;
+	uint8_t *p;
+};
+
+
+//-------------------------------------------------------------
+static const char *classNames[JIT_N_CLASSES] = {
+	[JIT_INT] = "int",
+	[JIT_MUL] = "mul",
+	[JIT_LOAD] = "load",
+	[JIT_STORE] = "store",
+	[JIT_SIMD] = "simd",
+	[JIT_FP] = "fp",
+	[JIT_BRANCH] = "branch",
+};
+
+/* Rough relative energy per instruction of each class,
+ * used when no better power proxy is available. */
+static const double classWeight[JIT_N_CLASSES] = {
+	[JIT_INT] = 1,
+	[JIT_MUL] = 2,
+	[JIT_LOAD] = 2,
+	[JIT_STORE] = 2,
+	[JIT_SIMD] = 4,
+	[JIT_FP] = 4,
+	[JIT_BRANCH] = 1,
+};
+
+/* Loop used until one is loaded or searched for. Two
+ * chains of SIMD and FP multiplies interleaved with
+ * independent integer work. */
+static const struct jit_loop_t dfltLoop = {
+	10, {
+		{ JIT_SIMD, 0, 1 }, { JIT_FP, 0, 1 }, { JIT_MUL, 0, 1 },
+		{ JIT_SIMD, 2, 3 }, { JIT_FP, 2, 3 }, { JIT_INT, 2, 3 },
+		{ JIT_LOAD, 4, 0 }, { JIT_SIMD, 4, 5 }, { JIT_STORE, 5, 1 },
+		{ JIT_MUL, 6, 7 },
+	}
+};
+
+static struct jit_loop_t curLoop;												// Loop to generate
+static int hasLoop;																// True when curLoop is set
+static int isDirty = 1;															// True when code must be generated again
+static jit_func_t code;															// Generated loop, or NULL
+static uint64_t totInstr;														// Counted by all childs since last take
+static uint64_t totCycles;
+static int hasCounters = 1;														// False when any child lacked counters
+
+
+
+//-------------------------------------------------------------
+// Name of the instruction set we generate code for, or
+// NULL when there is no code generator.
+const char* jit_isa(void) {
+	return JIT_ISA;
+}
+
+
+
+//-------------------------------------------------------------
+// Random number in range 0 to <n> - 1
+static int rnd(unsigned int *seed, const int n) {
+	return rand_r(seed) % n;
+}
+
+
+
+//-------------------------------------------------------------
+// Random instruction
+static void random_op(struct jit_op_t *op, unsigned int *seed) {
+	op->cls = rnd(seed, JIT_N_CLASSES);
+	op->dst = rnd(seed, JIT_N_REGS);
+	op->src = rnd(seed, (op->cls == JIT_LOAD || op->cls == JIT_STORE) ?
+		JIT_N_SLOTS : JIT_N_REGS);
+}
+
+
+
+//-------------------------------------------------------------
+// Create a random loop of at least 8 instructions
+void jit_random(struct jit_loop_t *loop, unsigned int *seed) {
+	int i;
+
+	loop->nOps = 8 + rnd(seed, JIT_MAX_OPS - 8 + 1);
+	for(i = 0; i < loop->nOps; i++) random_op(&loop->op[i], seed);
+}
+
+
+
+//-------------------------------------------------------------
+// Make one to three random changes of a loop; replace,
+// insert, delete or swap instructions or change the
+// register of one, which adds or breaks a dependency.
+void jit_mutate(struct jit_loop_t *loop, unsigned int *seed) {
+	struct jit_op_t tmp;
+	int n, i, j;
+
+	for(n = 1 + rnd(seed, 3); n > 0; n--) {
+		i = rnd(seed, loop->nOps);
+		switch(rnd(seed, 5)) {
+			case 0:
+				random_op(&loop->op[i], seed);
+				break;
+
+			case 1:
+				if(loop->nOps == JIT_MAX_OPS) break;
+				memmove(&loop->op[i + 1], &loop->op[i],
+					(loop->nOps - i) * sizeof(loop->op[0]));
+				random_op(&loop->op[i], seed);
+				loop->nOps++;
+				break;
+
+			case 2:
+				if(loop->nOps == 1) break;
+				memmove(&loop->op[i], &loop->op[i + 1],
+					(loop->nOps - i - 1) * sizeof(loop->op[0]));
+				loop->nOps--;
+				break;
+
+			case 3:
+				j = rnd(seed, loop->nOps);
+				tmp = loop->op[i];
+				loop->op[i] = loop->op[j];
+				loop->op[j] = tmp;
+				break;
+
+			default:
+				if(loop->op[i].cls == JIT_LOAD || loop->op[i].cls == JIT_STORE) {
+					loop->op[i].dst = rnd(seed, JIT_N_REGS);
+				}
+				else {
+					loop->op[i].src = rnd(seed, JIT_N_REGS);
+				}
+				break;
+		}
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// One point crossover; head of <a> and tail of <b>
+void jit_crossover(struct jit_loop_t *child, const struct jit_loop_t *a,
+		const struct jit_loop_t *b, unsigned int *seed) {
+	int i, j, n;
+
+	i = rnd(seed, a->nOps + 1);
+	j = rnd(seed, b->nOps + 1);
+	n = b->nOps - j;
+	if(i + n > JIT_MAX_OPS) n = JIT_MAX_OPS - i;
+
+	memcpy(child->op, a->op, i * sizeof(a->op[0]));
+	memcpy(child->op + i, b->op + j, n * sizeof(b->op[0]));
+	child->nOps = i + n;
+	if(child->nOps == 0) {
+		child->op[0] = a->op[0];
+		child->nOps = 1;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Mean relative energy per instruction of a loop
+double jit_weight(const struct jit_loop_t *loop) {
+	double sum;
+	int i;
+
+	for(i = 0, sum = 0; i < loop->nOps; i++) sum += classWeight[loop->op[i].cls];
+
+	return loop->nOps ? sum / loop->nOps : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Set the loop the consumer runs from the next load
+// cycle. Must not be called while childs are running.
+void jit_set_loop(const struct jit_loop_t *loop) {
+	curLoop = *loop;
+	hasLoop = 1;
+	isDirty = 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Get the current loop
+void jit_get_loop(struct jit_loop_t *loop) {
+	*loop = hasLoop ? curLoop : dfltLoop;
+}
+
+
+
+//-------------------------------------------------------------
+// Load a loop saved by jit_save()
+int jit_load(const char *fileName) {
+	struct jit_loop_t loop;
+	char line[128], name[16];
+	int i, ver, dst, src;
+	FILE *fp;
+
+	fp = fopen(fileName, "r");
+	if(!fp) {
+		log_errno("Error opening loop file");
+		return -1;
+	}
+
+	ver = -1;
+	loop.nOps = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "version=%d", &ver) == 1) continue;
+		if(sscanf(line, "op=%15[^,],%d,%d", name, &dst, &src) != 3) continue;
+		for(i = 0; i < JIT_N_CLASSES && strcmp(name, classNames[i]); i++);
+		if(i == JIT_N_CLASSES || loop.nOps == JIT_MAX_OPS || dst < 0 || src < 0) {
+			ver = -1;
+			break;
+		}
+		loop.op[loop.nOps].cls = i;
+		loop.op[loop.nOps].dst = dst % JIT_N_REGS;
+		loop.op[loop.nOps].src = src % ((i == JIT_LOAD || i == JIT_STORE) ?
+			JIT_N_SLOTS : JIT_N_REGS);
+		loop.nOps++;
+	}
+
+	fclose(fp);
+
+	if(ver != JIT_VERSION || loop.nOps == 0) {
+		log_error("Error, invalid loop file %s\n", fileName);
+		return -1;
+	}
+	jit_set_loop(&loop);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Save the current loop for later runs, with the score
+// it got and where it was found as information.
+int jit_save(const char *fileName, const int64_t score) {
+	struct jit_loop_t loop;
+	FILE *fp;
+	int i;
+
+	fp = fopen(fileName, "w");
+	if(!fp) {
+		log_errno("Error creating loop file");
+		return -1;
+	}
+
+	jit_get_loop(&loop);
+	fprintf(fp, "version=%d\n", JIT_VERSION);
+	fprintf(fp, "isa=%s\n", JIT_ISA ? JIT_ISA : "none");
+	fprintf(fp, "soc=%s\n", hwIdent.cpuName);
+	fprintf(fp, "score=%lld\n", (long long) score);
+	for(i = 0; i < loop.nOps; i++) {
+		fprintf(fp, "op=%s,%d,%d\n", classNames[loop.op[i].cls],
+			loop.op[i].dst, loop.op[i].src);
+	}
+
+	if(fclose(fp)) {
+		log_errno("Error writing loop file");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+static void emit8(struct emit_t *e, const uint8_t b) {
+	*e->p++ = b;
+}
+
+
+
+//-------------------------------------------------------------
+static void emit32(struct emit_t *e, const uint32_t w) {
+	memcpy(e->p, &w, sizeof(w));
+	e->p += sizeof(w);
+}
+
+
+
+#if defined(__x86_64__)
+//-------------------------------------------------------------
+// x86-64 code generator. Arguments in rdi (stop flag)
+// and rsi (buffer). Integer registers are the scratch
+// ones plus rbx which we save. SIMD uses xmm0-7 and FP
+// xmm8-15, all scratch.
+static const uint8_t x86Int[JIT_N_REGS] = {										// rax, rcx, rdx, rbx, r8-r11
+	0, 1, 2, 3, 8, 9, 10, 11
+};
+
+
+static void x86_rex(struct emit_t *e, const int w, const int reg, const int rm) {
+	if(w || reg >= 8 || rm >= 8) emit8(e, 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+static void x86_modrm(struct emit_t *e, const int mod, const int reg, const int rm) {
+	emit8(e, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_prologue(struct emit_t *e) {
+	int i;
+
+	emit8(e, 0x53);																// push rbx
+	for(i = 0; i < JIT_N_REGS; i++) {
+		emit8(e, 0xf3);															// movdqu xmm<i>, [rsi + 16i]
+		emit8(e, 0x0f);
+		emit8(e, 0x6f);
+		x86_modrm(e, 1, i, 6);
+		emit8(e, 16 * i);
+
+		x86_rex(e, 1, x86Int[i], 6);											// mov <int>, [rsi + JIT_BUF_INT + 8i]
+		emit8(e, 0x8b);
+		x86_modrm(e, 2, x86Int[i], 6);
+		emit32(e, JIT_BUF_INT + 8 * i);
+
+		emit8(e, 0xf2);															// movsd xmm<8+i>, [rsi + JIT_BUF_DOUBLE]
+		emit8(e, 0x44);
+		emit8(e, 0x0f);
+		emit8(e, 0x10);
+		x86_modrm(e, 2, i, 6);
+		emit32(e, JIT_BUF_DOUBLE);
+	}
+}
+
+static void emit_op(struct emit_t *e, const struct jit_op_t *op) {
+	int d, s;
+
+	d = x86Int[op->dst];
+	s = x86Int[op->src % JIT_N_REGS];
+
+	switch(op->cls) {
+		case JIT_INT:															// add d, s
+			x86_rex(e, 1, s, d);
+			emit8(e, 0x01);
+			x86_modrm(e, 3, s, d);
+			break;
+
+		case JIT_MUL:															// imul d, s
+			x86_rex(e, 1, d, s);
+			emit8(e, 0x0f);
+			emit8(e, 0xaf);
+			x86_modrm(e, 3, d, s);
+			break;
+
+		case JIT_LOAD:															// mov d, [rsi + 8 * slot]
+		case JIT_STORE:															// mov [rsi + 8 * slot], d
+			x86_rex(e, 1, d, 6);
+			emit8(e, op->cls == JIT_LOAD ? 0x8b : 0x89);
+			x86_modrm(e, 1, d, 6);
+			emit8(e, 8 * op->src);
+			break;
+
+		case JIT_SIMD:															// pmuludq xmm<d>, xmm<s>
+			emit8(e, 0x66);
+			emit8(e, 0x0f);
+			emit8(e, 0xf4);
+			x86_modrm(e, 3, op->dst, op->src);
+			break;
+
+		case JIT_FP:															// mulsd xmm<8+d>, xmm<8+s>
+			emit8(e, 0xf2);
+			emit8(e, 0x45);
+			emit8(e, 0x0f);
+			emit8(e, 0x59);
+			x86_modrm(e, 3, op->dst, op->src);
+			break;
+
+		default:																// jmp to next
+			emit8(e, 0xeb);
+			emit8(e, 0x00);
+			break;
+	}
+}
+
+static void emit_epilogue(struct emit_t *e, const uint8_t *top) {
+	emit8(e, 0x83);																// cmp dword [rdi], 0
+	emit8(e, 0x3f);
+	emit8(e, 0x00);
+	emit8(e, 0x0f);																// je top
+	emit8(e, 0x84);
+	emit32(e, top - (e->p + 4));
+	emit8(e, 0x5b);																// pop rbx
+	emit8(e, 0xc3);																// ret
+}
+
+
+
+#elif defined(__aarch64__)
+//-------------------------------------------------------------
+// A64 code generator. Arguments in x0 (stop flag) and
+// x1 (buffer). Integer registers x2-x9, SIMD v0-v7 and
+// FP v16-v23, all scratch.
+static void emit_prologue(struct emit_t *e) {
+	int i;
+
+	for(i = 0; i < JIT_N_REGS; i++) {
+		emit32(e, 0x3dc00000 | (i << 10) | (1 << 5) | i);						// ldr q<i>, [x1, #16i]
+		emit32(e, 0xf9400000 | ((JIT_BUF_INT / 8 + i) << 10) | (1 << 5) | (2 + i));	// ldr x<2+i>, [x1, #JIT_BUF_INT + 8i]
+		emit32(e, 0x3dc00000 | ((JIT_BUF_FLOAT / 16) << 10) | (1 << 5) | (16 + i));	// ldr q<16+i>, [x1, #JIT_BUF_FLOAT]
+	}
+}
+
+static void emit_op(struct emit_t *e, const struct jit_op_t *op) {
+	int d, s;
+
+	d = 2 + op->dst;
+	s = 2 + op->src % JIT_N_REGS;
+
+	switch(op->cls) {
+		case JIT_INT:
+			emit32(e, 0x8b000000 | (s << 16) | (d << 5) | d);					// add d, d, s
+			break;
+
+		case JIT_MUL:
+			emit32(e, 0x9b007c00 | (s << 16) | (d << 5) | d);					// mul d, d, s
+			break;
+
+		case JIT_LOAD:
+			emit32(e, 0xf9400000 | (op->src << 10) | (1 << 5) | d);				// ldr d, [x1, #8 * slot]
+			break;
+
+		case JIT_STORE:
+			emit32(e, 0xf9000000 | (op->src << 10) | (1 << 5) | d);				// str d, [x1, #8 * slot]
+			break;
+
+		case JIT_SIMD:
+			emit32(e, 0x4ea09c00 | (op->src << 16) | (op->dst << 5) | op->dst);	// mul v<d>.4s, v<d>.4s, v<s>.4s
+			break;
+
+		case JIT_FP:
+			emit32(e, 0x6e20dc00 | ((16 + op->src) << 16) |						// fmul v<16+d>.4s, v<16+d>.4s, v<16+s>.4s
+				((16 + op->dst) << 5) | (16 + op->dst));
+			break;
+
+		default:
+			emit32(e, 0x14000001);												// b to next
+			break;
+	}
+}
+
+static void emit_epilogue(struct emit_t *e, const uint8_t *top) {
+	emit32(e, 0xb9400010);														// ldr w16, [x0]
+	emit32(e, 0x34000000 | ((((top - e->p) / 4) & 0x7ffff) << 5) | 16);			// cbz w16, top
+	emit32(e, 0xd65f03c0);														// ret
+}
+
+
+
+#elif defined(__arm__)
+//-------------------------------------------------------------
+// A32 code generator. Arguments in r0 (stop flag) and
+// r1 (buffer). Integer registers r2-r9, saved when
+// callee saved. SIMD uses q8-q15 when the system has
+// Neon, else integer adds. FP uses VFP d0-d7, which all
+// Raspberry Pi processors have.
+static void emit_prologue(struct emit_t *e) {
+	int i, dreg;
+
+	emit32(e, 0xe92d4ff0);														// push {r4-r11, lr}
+	for(i = 0; i < JIT_N_REGS; i++) {
+		emit32(e, 0xe5910000 | ((2 + i) << 12) | (JIT_BUF_INT + 4 * i));		// ldr r<2+i>, [r1, #JIT_BUF_INT + 4i]
+		emit32(e, 0xed910b00 | (i << 12) | (JIT_BUF_DOUBLE / 4));				// vldr d<i>, [r1, #JIT_BUF_DOUBLE]
+		if(!hwIdent.hasNeon) continue;
+		dreg = 16 + 2 * i;
+		emit32(e, 0xed910b00 | (1 << 22) | ((dreg & 15) << 12) | (4 * i));		// vldr d<16+2i>, [r1, #16i]
+		emit32(e, 0xed910b00 | (1 << 22) | (((dreg + 1) & 15) << 12) | (4 * i + 2));	// vldr d<17+2i>, [r1, #16i + 8]
+	}
+}
+
+static void emit_op(struct emit_t *e, const struct jit_op_t *op) {
+	int d, s, vd, vs;
+
+	d = 2 + op->dst;
+	s = 2 + op->src % JIT_N_REGS;
+	vd = (2 * op->dst) & 15;													// Low bits of d<16+2d>, the D bit is set
+	vs = (2 * (op->src % JIT_N_REGS)) & 15;
+
+	switch(op->cls) {
+		case JIT_SIMD:
+			if(hwIdent.hasNeon) {
+				emit32(e, 0xf2200950 | (1 << 22) | (vd << 16) | (vd << 12) |		// vmul.i32 q<8+d>, q<8+d>, q<8+s>
+					(1 << 7) | (1 << 5) | vs);
+				break;
+			}
+			/* Fall through */
+
+		case JIT_INT:
+			emit32(e, 0xe0800000 | (d << 16) | (d << 12) | s);					// add d, d, s
+			break;
+
+		case JIT_MUL:
+			emit32(e, 0xe0000090 | (d << 16) | (s << 8) | d);					// mul d, d, s
+			break;
+
+		case JIT_LOAD:
+			emit32(e, 0xe5910000 | (d << 12) | (8 * op->src));					// ldr d, [r1, #8 * slot]
+			break;
+
+		case JIT_STORE:
+			emit32(e, 0xe5810000 | (d << 12) | (8 * op->src));					// str d, [r1, #8 * slot]
+			break;
+
+		case JIT_FP:
+			emit32(e, 0xee200b00 | (op->dst << 16) | (op->dst << 12) |			// vmul.f64 d<d>, d<d>, d<s>
+				(op->src % JIT_N_REGS));
+			break;
+
+		default:
+			emit32(e, 0xeaffffff);												// b to next
+			break;
+	}
+}
+
+static void emit_epilogue(struct emit_t *e, const uint8_t *top) {
+	emit32(e, 0xe590c000);														// ldr r12, [r0]
+	emit32(e, 0xe35c0000);														// cmp r12, #0
+	emit32(e, 0x0a000000 | (((top - (e->p + 8)) / 4) & 0xffffff));				// beq top
+	emit32(e, 0xe8bd8ff0);														// pop {r4-r11, pc}
+}
+#endif
+
+
+
+//-------------------------------------------------------------
+// Generate machine code of the current loop into a new
+// executable page, unless already done. Must be called
+// before childs start running the consumer.
+int jit_prepare(void) {
+	struct jit_loop_t loop;
+	struct emit_t e;
+	uint8_t *top;
+	void *page;
+	int i;
+
+	if(!isDirty && code) return 0;
+	if(!JIT_ISA) {
+		log_error("Error, no code generator for this processor\n");
+		return -1;
+	}
+
+	page = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(page == MAP_FAILED) {
+		log_errno("Error allocating code page");
+		return -1;
+	}
+
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__arm__)
+	jit_get_loop(&loop);
+	e.start = page;
+	e.p = page;
+	emit_prologue(&e);
+	top = e.p;
+	for(i = 0; i < loop.nOps; i++) emit_op(&e, &loop.op[i]);
+	emit_epilogue(&e, top);
+	__builtin___clear_cache((char*) e.start, (char*) e.p);
+#endif
+
+	if(mprotect(page, JIT_CODE_SIZE, PROT_READ | PROT_EXEC)) {
+		log_errno("Error protecting code page");
+		munmap(page, JIT_CODE_SIZE);
+		return -1;
+	}
+
+	if(code) munmap(code, JIT_CODE_SIZE);
+	code = (jit_func_t) page;
+	isDirty = 0;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Power consumer: run the generated loop until told to
+// exit. Counts its instructions and cycles when the
+// kernel lets us, as a power proxy for the search. FP
+// registers start at 1.0 so products never under- or
+// overflow into slow paths.
+int jit_consumer(struct child_t *me) {
+	uint8_t buf[JIT_BUF_LEN] __attribute__((aligned(16)));
+	uint64_t cnt[2];
+	float f = 1.0;
+	double d = 1.0;
+	int i, fds[2];
+
+	if(!code) return EXIT_FAILURE;
+
+	for(i = 0; i < JIT_BUF_INT + 8 * JIT_N_REGS; i++) buf[i] = child_random(me);
+	for(i = 0; i < 4; i++) memcpy(buf + JIT_BUF_FLOAT + i * sizeof(f), &f, sizeof(f));
+	for(i = 0; i < 2; i++) memcpy(buf + JIT_BUF_DOUBLE + i * sizeof(d), &d, sizeof(d));
+
+	fds[0] = perf_open_thread(PERF_COUNT_HW_INSTRUCTIONS);
+	fds[1] = perf_open_thread(PERF_COUNT_HW_CPU_CYCLES);
+
+	code(&me->ctrl->stop, buf);
+
+	if(fds[0] >= 0 && fds[1] >= 0 &&
+			read(fds[0], &cnt[0], sizeof(cnt[0])) == sizeof(cnt[0]) &&
+			read(fds[1], &cnt[1], sizeof(cnt[1])) == sizeof(cnt[1])) {
+		__atomic_add_fetch(&totInstr, cnt[0], __ATOMIC_RELAXED);
+		__atomic_add_fetch(&totCycles, cnt[1], __ATOMIC_RELAXED);
+	}
+	else {
+		hasCounters = 0;
+	}
+	if(fds[0] >= 0) close(fds[0]);
+	if(fds[1] >= 0) close(fds[1]);
+
+	return EXIT_SUCCESS;
+}
+
+
+
+//-------------------------------------------------------------
+// Get and reset the instructions and cycles counted by
+// all childs. Returns -1 if any child had no counters.
+int jit_take_counters(uint64_t *instr, uint64_t *cycles) {
+	int res;
+
+	*instr = __atomic_exchange_n(&totInstr, 0, __ATOMIC_RELAXED);
+	*cycles = __atomic_exchange_n(&totCycles, 0, __ATOMIC_RELAXED);
+	res = hasCounters ? 0 : -1;
+	hasCounters = 1;
+
+	return res;
+}
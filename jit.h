@@ -0,0 +1,52 @@
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+
+#include "high-load.h"
+
+
+//-------------------------------------------------------------
+#define JIT_MAX_OPS				48												// Max instructions in a generated loop body
+
+
+enum jit_class_t {																// Kind of instruction in a loop
+	JIT_INT,																	// Integer add
+	JIT_MUL,																	// Integer multiply
+	JIT_LOAD,																	// Load from scratch buffer
+	JIT_STORE,																	// Store to scratch buffer
+	JIT_SIMD,																	// SIMD integer multiply
+	JIT_FP,																		// Floating point multiply
+	JIT_BRANCH,																	// Always taken branch
+	JIT_N_CLASSES
+};
+
+struct jit_op_t {
+	uint8_t cls;																// enum jit_class_t
+	uint8_t dst;																// Destination register
+	uint8_t src;																// Source register, or buffer slot of load/store
+};
+
+struct jit_loop_t {																// Architecture independent loop description
+	int nOps;
+	struct jit_op_t op[JIT_MAX_OPS];
+};
+
+
+//-------------------------------------------------------------
+const char* jit_isa(void);
+void jit_random(struct jit_loop_t *loop, unsigned int *seed);
+void jit_mutate(struct jit_loop_t *loop, unsigned int *seed);
+void jit_crossover(struct jit_loop_t *child, const struct jit_loop_t *a,
+	const struct jit_loop_t *b, unsigned int *seed);
+double jit_weight(const struct jit_loop_t *loop);
+void jit_set_loop(const struct jit_loop_t *loop);
+void jit_get_loop(struct jit_loop_t *loop);
+int jit_load(const char *fileName);
+int jit_save(const char *fileName, const int64_t score);
+int jit_prepare(void);
+int jit_consumer(struct child_t *me);
+int jit_take_counters(uint64_t *instr, uint64_t *cycles);
+
+#endif
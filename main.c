@@ -28,20 +28,114 @@
 #include <time.h>
 #include <errno.h>
 #include <ctype.h>
+#include <getopt.h>
 
 #include "main.h"
 #include "misc.h"
 #include "high-load.h"
 #include "vchiq.h"
+#include "hwprobe.h"
+#include "search.h"
+#include "powerstate.h"
+#include "rtmon.h"
+#include "margin.h"
+#include "trace.h"
+#include "storage.h"
+#include "replay.h"
+#include "sync.h"
+#include "repeat.h"
+#include "rpiburn.h"
+#include "freqmon.h"
+#include "estimate.h"
+#include "jit.h"
+#include "sensor.h"
+#include "polite.h"
+#include "sweep.h"
+#include "status.h"
+#include "rpiburn-status.h"
+#include "blackbox.h"
 
 
 //-------------------------------------------------------------
 #define MAX_TOT_TIME		999999999											// Max total time in ms we allow the test to run
 #define DFLT_TOT_TIME		10000												// Default total time ms we allow the test to run
+#define DFLT_RECORD_PERIOD	20													// Default sample period in ms of the load recorder
+
+
+//-------------------------------------------------------------
+enum long_opt_t {																// Options without a short name
+	OPT_SYS_ROOT = 256,
+	OPT_RT_MONITOR,
+	OPT_JITTER,
+	OPT_MARGIN,
+	OPT_TRACE,
+	OPT_TRACE_MARKER,
+	OPT_FREQ_RATE,
+	OPT_ESTIMATE,
+	OPT_COEFFS,
+	OPT_CALIBRATE,
+	OPT_COORDINATOR,
+	OPT_BOARDS,
+	OPT_PARTICIPANT,
+	OPT_IO_QD,
+	OPT_IO_VIRTUAL,
+	OPT_FAIL_LIMIT,
+	OPT_RECORD,
+	OPT_RECORD_PERIOD,
+	OPT_REPLAY,
+	OPT_REPLAY_SPEED,
+	OPT_WRITE_FILE,
+	OPT_WRITE_QD,
+	OPT_WRITE_BS,
+	OPT_WRITE_BUDGET,
+	OPT_JIT_LOOP,
+	OPT_JIT_SEARCH,
+	OPT_SENSOR,
+	OPT_BLACKBOX,
+	OPT_POSTMORTEM,
+	OPT_POLITE,
+	OPT_POLITE_CGROUP,
+	OPT_DVFS_SWEEP,
+	OPT_STATUS,
+	OPT_SEED,
+	OPT_ISA_CHECK,
+};
 
 
 //-------------------------------------------------------------
 static int sigFd = -1;															// Signal file descriptor
+static struct rpiburn_t *rb;													// Load engine context
+static int exitRequested;														// True when user asked us to exit
+static int ioSleep;																// Max time in ms until next main loop poll
+static int loadTime;															// Time in ms at full load from user, or 0
+static const char *consumerMap;													// Power consumer map from user
+static int doPerformance;														// True when system is set to max performance during test
+static int doSearch;															// True when searching for best consumer map
+static const char *blackboxFile;												// Record events to this file for postmortem
+static uint64_t seed;															// Seed of worker random numbers from user
+static int hasSeed;																// True when seed is given
+static const char *statusFile;													// Publish live status in this file
+static const char *postmortemFile;												// Decode this black box file and exit
+static int doPolite;															// True when pausing workers while other tasks stall
+static const char *politeCgroup;												// Cgroup of the tasks to be polite to, or NULL for all
+static const char *jitSearchFile;												// Search for best generated loop, save to this file
+static int rtMonitorCpu;														// Core of real-time monitor or -1 when disabled
+static int doJitter;															// True when measuring monitor wakeup jitter
+static int doEstimate;															// True when estimating board current
+static const char *calibrateFile;												// Save fitted current coefficients to this file
+static int nRuns;																// Number of times to repeat the test, or 0
+static int doSweep;																// True when testing every cpufreq operating point
+static int doIsaCheck;															// True when self checking the processor consumer variants
+static int doMargin;															// True when searching for max sustainable load
+static int duty;																// Duty cycle in percent of all childs
+static const char *traceFile;													// Export trace events to this file
+static int doTraceMarker;														// True when writing events to ftrace
+static const char *recordFile;													// Record processor load to this file
+static int recordPeriod;														// Sample period in ms of recorder
+static const char *replayFile;													// Replay processor load from this file
+static double replaySpeed;														// Time scaling of replay
+static int ioVirtual;															// True when loop and ram devices are loaded too
+static int useIdentCache;														// True when a cached hardware identity may be used
 static int tot_time;															// Run for this many millisecons maximum
 static const char progVer[] = "v0.10";											// Program version
 
@@ -49,12 +143,22 @@ static const char progVer[] = "v0.10";											// Program version
 //-------------------------------------------------------------
 // Initialize signals. We use a synchronous filedescriptor
 // for accepting signal as oppose to an asynchronous handler.
+// The duty cycle timers of childs need a real handler.
 static int signal_init(void) {
+	struct sigaction sigAct;
 	sigset_t sigsBlk;
 	int res;
 
+	memset(&sigAct, 0, sizeof(sigAct));
+	sigAct.sa_sigaction = rpiburn_duty_signal;
+	sigAct.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sigAct.sa_mask);
+	if(sigaction(SIGUSR1, &sigAct, NULL) == -1) {
+		perror("Error installing duty cycle handler");
+		return -1;
+	}
+
 	sigemptyset(&sigsBlk);
-	sigaddset(&sigsBlk, SIGCHLD);
 	sigaddset(&sigsBlk, SIGHUP);
 	sigaddset(&sigsBlk, SIGINT);
 	sigaddset(&sigsBlk, SIGQUIT);
@@ -96,19 +200,15 @@ static int signal_manager(void) {
 		//printf("Got signal %d\n", sigBuf.ssi_signo);
 
 		switch(sigBuf.ssi_signo) {
-			case SIGCHLD:
-				//printf("Signal from child %d exit\n", sigBuf.ssi_pid);
-				break;
-
 			case SIGHUP:
 			case SIGQUIT:
 			case SIGTERM:
 				//printf("Time to exit\n");
-				do_exit = 1;
+				exitRequested = 1;
 				break;
 
 			case SIGINT:
-				abort();
+				abort();														// Power state is restored by SIGABRT handler
 				break;
 		}
 	}
@@ -121,23 +221,322 @@ static int signal_manager(void) {
 //-------------------------------------------------------------
 // Parse commandline arguments
 static int parse_args(int argc, char *argv[]) {
+	static const struct option longOpts[] = {
+		{ "blackbox", required_argument, NULL, OPT_BLACKBOX },
+		{ "boards", required_argument, NULL, OPT_BOARDS },
+		{ "calibrate", required_argument, NULL, OPT_CALIBRATE },
+		{ "coeffs", required_argument, NULL, OPT_COEFFS },
+		{ "coordinator", required_argument, NULL, OPT_COORDINATOR },
+		{ "duty", required_argument, NULL, 'd' },
+		{ "dvfs-sweep", no_argument, NULL, OPT_DVFS_SWEEP },
+		{ "estimate", no_argument, NULL, OPT_ESTIMATE },
+		{ "fail-limit", required_argument, NULL, OPT_FAIL_LIMIT },
+		{ "freq-rate", required_argument, NULL, OPT_FREQ_RATE },
+		{ "help", no_argument, NULL, 'h' },
+		{ "io-qd", required_argument, NULL, OPT_IO_QD },
+		{ "io-virtual", no_argument, NULL, OPT_IO_VIRTUAL },
+		{ "isa-check", no_argument, NULL, OPT_ISA_CHECK },
+		{ "jit-loop", required_argument, NULL, OPT_JIT_LOOP },
+		{ "jit-search", required_argument, NULL, OPT_JIT_SEARCH },
+		{ "jitter", no_argument, NULL, OPT_JITTER },
+		{ "map", required_argument, NULL, 'm' },
+		{ "margin", no_argument, NULL, OPT_MARGIN },
+		{ "iterations", required_argument, NULL, 'n' },
+		{ "participant", required_argument, NULL, OPT_PARTICIPANT },
+		{ "performance", no_argument, NULL, 'p' },
+		{ "polite", no_argument, NULL, OPT_POLITE },
+		{ "polite-cgroup", required_argument, NULL, OPT_POLITE_CGROUP },
+		{ "postmortem", required_argument, NULL, OPT_POSTMORTEM },
+		{ "record", required_argument, NULL, OPT_RECORD },
+		{ "record-period", required_argument, NULL, OPT_RECORD_PERIOD },
+		{ "replay", required_argument, NULL, OPT_REPLAY },
+		{ "replay-speed", required_argument, NULL, OPT_REPLAY_SPEED },
+		{ "reprobe", no_argument, NULL, 'r' },
+		{ "rt-monitor", required_argument, NULL, OPT_RT_MONITOR },
+		{ "search", no_argument, NULL, 'S' },
+		{ "seed", required_argument, NULL, OPT_SEED },
+		{ "sensor", required_argument, NULL, OPT_SENSOR },
+		{ "status", required_argument, NULL, OPT_STATUS },
+		{ "sys-root", required_argument, NULL, OPT_SYS_ROOT },
+		{ "time", required_argument, NULL, 't' },
+		{ "trace", required_argument, NULL, OPT_TRACE },
+		{ "trace-marker", no_argument, NULL, OPT_TRACE_MARKER },
+		{ "version", no_argument, NULL, 'v' },
+		{ "write-budget", required_argument, NULL, OPT_WRITE_BUDGET },
+		{ "write-bs", required_argument, NULL, OPT_WRITE_BS },
+		{ "write-file", required_argument, NULL, OPT_WRITE_FILE },
+		{ "write-qd", required_argument, NULL, OPT_WRITE_QD },
+		{ NULL, 0, NULL, 0 }
+	};
 	int arg, res = 0;
+	long long size;
+	char *end;
 
 	opterr=0;																	// Disable lib error msg's
 
-	while((arg=getopt(argc, argv, ":ht:v")) != -1 && !res) {
+	while((arg=getopt_long(argc, argv, ":d:hm:n:prSt:v", longOpts, NULL)) != -1 && !res) {
 		switch(arg) {
+			case 'd':
+				errno = 0;
+				duty = strtol(optarg, NULL, 10);
+				if(errno || duty < 1 || duty > 100) {
+					fprintf(stderr, "Error, invalid duty cycle\n");
+					res = -1;
+				}
+				break;
+
 			case 'h':
 				printf("Usage: rpiburn [options]\n");
 				printf("High power load testing of Raspberry Pi while ");
 				printf("monitoring system for anomalies.\n");
 				printf("\n");
-				printf("    -h          This help\n");
-				printf("    -t <msec>   Run test for <msec> milliseconds.\n");
-				printf("    -v          Display program version and copyrights\n");
+				printf("    --blackbox <file>   Record events to <file> so they survive a power loss\n");
+				printf("    --boards <n>        Number of participants the coordinator waits for\n");
+				printf("    --calibrate <file>  Fit the current estimate to a meter, in steps of\n");
+				printf("                        test time, save coefficients to <file>\n");
+				printf("    --coeffs <file>     Current estimate coefficients from calibration\n");
+				printf("    --coordinator <addr>  Start the test of several boards in lock-step,\n");
+				printf("                        <addr> is host:port (UDP) or unix:<path>\n");
+				printf("    -d, --duty <pct>    Run each consumer <pct> percent of the time\n");
+				printf("    --dvfs-sweep        Run the test at every cpufreq operating point,\n");
+				printf("                        report throttling and throughput of each\n");
+				printf("    --estimate          Estimate board current, without a meter\n");
+				printf("    --fail-limit <pct>  Accepted brownout rate of repeated tests, default 5\n");
+				printf("    --freq-rate <hz>    Sample core frequencies and temperature at <hz>,\n");
+				printf("                        report drops per load phase\n");
+				printf("    -h, --help          This help\n");
+				printf("    --io-qd <n>         Number of reads in flight per block device, default 4\n");
+				printf("    --io-virtual        Load loop, ram and other virtual block devices too\n");
+				printf("    --isa-check         List the processor consumer variants built in and\n");
+				printf("                        run the one picked for each core shortly\n");
+				printf("    --jit-loop <file>   Loop of the jit consumer, from a loop search\n");
+				printf("    --jit-search <file>  Search for the generated jit consumer loop drawing\n");
+				printf("                        most power, save it to <file>\n");
+				printf("    -m, --map <list>    Power consumer per core, comma separated list of\n");
+				printf("                        cpu, crypto, asimd, neon, arm, x86-v1, x86-v3,\n");
+				printf("                        x86-v4, generic, mem, io, write, jit or idle\n");
+				printf("    -n, --iterations <n>  Repeat test up to <n> times with cooldown between,\n");
+				printf("                        stop early when the brownout rate is settled\n");
+				printf("    --margin            Search for the highest sustainable load level,\n");
+				printf("                        each level is held for the test time\n");
+				printf("    --participant <addr>  Join the synchronized test of a coordinator\n");
+				printf("    -p, --performance   Run at max frequency with the performance governor\n");
+				printf("                        and no deep idle, restore settings at exit\n");
+				printf("    --polite            Pause workers while other tasks stall on cpu,\n");
+				printf("                        memory or io, resume them when it's quiet\n");
+				printf("    --polite-cgroup <dir>  Polite to the tasks of cgroup <dir> only\n");
+				printf("    --postmortem <file> Print the timeline of the last run from a black box\n");
+				printf("    --record <file>     Record processor load of this system to <file>,\n");
+				printf("                        for test time or until interrupted\n");
+				printf("    --record-period <ms>  Sample period of recorder, default %d\n", DFLT_RECORD_PERIOD);
+				printf("    --replay <file>     Replay recorded processor load as load profile\n");
+				printf("    --replay-speed <x>  Replay time scaling, 2 is twice as fast\n");
+				printf("    -r, --reprobe       Re-probe hardware, ignore cached identity\n");
+				printf("    --rt-monitor <cpu>  Run monitor SCHED_FIFO with locked memory on a\n");
+				printf("                        core of its own\n");
+				printf("    --jitter            Report monitor wakeup jitter during full load\n");
+				printf("    -S, --search        Search for the consumer map drawing most power\n");
+				printf("    --seed <n>          Seed of worker random numbers, to replay the same\n");
+				printf("                        storage offsets and data of an earlier run\n");
+				printf("    --sensor <spec>     Measure power with rapl, hwmon[:<chip>] or a meter\n");
+				printf("                        at serial:<tty>[:<baud>], may be repeated\n");
+				printf("    --status <file>     Publish live status in <file> for watchers, such\n");
+				printf("                        as %s read by rpiburn-status\n", RPIBURN_STATUS_PATH);
+				printf("    --sys-root <dir>    Root of /sys, /proc and /dev, for testing\n");
+				printf("    -t, --time <msec>   Run test for <msec> milliseconds.\n");
+				printf("    --trace <file>      Save a Chrome/Perfetto trace of test events\n");
+				printf("    --trace-marker      Write test events to the ftrace trace_marker\n");
+				printf("    -v, --version       Display program version and copyrights\n");
+				printf("    --write-file <file> Add a consumer writing O_DIRECT to a scratch file\n");
+				printf("    --write-qd <n>      Number of writes in flight, default 4\n");
+				printf("    --write-bs <list>   Write block size mix, default 4k,64k,1m\n");
+				printf("    --write-budget <sz> Max bytes written per run, default 256m\n");
 				res = -1;
 				break;
 
+			case 'm':
+				consumerMap = optarg;
+				break;
+
+			case 'p':
+				doPerformance = 1;
+				break;
+
+			case 'S':
+				doSearch = 1;
+				break;
+
+			case OPT_SYS_ROOT:
+				sysRoot = optarg;
+				break;
+
+			case OPT_RT_MONITOR:
+				errno = 0;
+				rtMonitorCpu = strtol(optarg, NULL, 10);
+				if(errno || rtMonitorCpu < 0) {
+					fprintf(stderr, "Error, invalid monitor core\n");
+					res = -1;
+				}
+				break;
+
+			case OPT_JITTER:
+				doJitter = 1;
+				break;
+
+			case OPT_JIT_LOOP:
+				res = jit_load(optarg);
+				break;
+
+			case OPT_JIT_SEARCH:
+				jitSearchFile = optarg;
+				break;
+
+			case OPT_SENSOR:
+				res = sensor_add(optarg);
+				break;
+
+			case OPT_BLACKBOX:
+				blackboxFile = optarg;
+				break;
+
+			case OPT_POSTMORTEM:
+				postmortemFile = optarg;
+				break;
+
+			case OPT_STATUS:
+				statusFile = optarg;
+				break;
+
+			case OPT_SEED:
+				errno = 0;
+				seed = strtoull(optarg, &end, 0);
+				if(errno || end == optarg || *end) {
+					fprintf(stderr, "Error, invalid seed\n");
+					res = -1;
+				}
+				hasSeed = 1;
+				break;
+
+			case OPT_POLITE:
+				doPolite = 1;
+				break;
+
+			case OPT_POLITE_CGROUP:
+				doPolite = 1;
+				politeCgroup = optarg;
+				break;
+
+			case OPT_MARGIN:
+				doMargin = 1;
+				break;
+
+			case OPT_DVFS_SWEEP:
+				doSweep = 1;
+				break;
+
+			case OPT_ISA_CHECK:
+				doIsaCheck = 1;
+				break;
+
+			case OPT_TRACE:
+				traceFile = optarg;
+				break;
+
+			case OPT_TRACE_MARKER:
+				doTraceMarker = 1;
+				break;
+
+			case OPT_FREQ_RATE:
+				res = freqmon_set_rate(atoi(optarg));
+				break;
+
+			case OPT_ESTIMATE:
+				doEstimate = 1;
+				break;
+
+			case OPT_COEFFS:
+				res = estimate_load(optarg);
+				break;
+
+			case OPT_CALIBRATE:
+				calibrateFile = optarg;
+				break;
+
+			case OPT_COORDINATOR:
+				res = sync_set_coordinator(optarg);
+				break;
+
+			case OPT_BOARDS:
+				res = sync_set_boards(atoi(optarg));
+				break;
+
+			case OPT_PARTICIPANT:
+				res = sync_set_participant(optarg);
+				break;
+
+			case 'n':
+				errno = 0;
+				nRuns = strtol(optarg, NULL, 10);
+				if(errno || nRuns < 1) {
+					fprintf(stderr, "Error, invalid number of iterations\n");
+					res = -1;
+				}
+				break;
+
+			case OPT_FAIL_LIMIT:
+				res = repeat_set_limit(atoi(optarg));
+				break;
+
+			case OPT_RECORD:
+				recordFile = optarg;
+				break;
+
+			case OPT_RECORD_PERIOD:
+				recordPeriod = atoi(optarg);
+				break;
+
+			case OPT_REPLAY:
+				replayFile = optarg;
+				break;
+
+			case OPT_REPLAY_SPEED:
+				replaySpeed = strtod(optarg, NULL);
+				break;
+
+			case OPT_IO_QD:
+				res = storage_set_read_qd(atoi(optarg));
+				break;
+
+			case OPT_IO_VIRTUAL:
+				ioVirtual = 1;
+				break;
+
+			case OPT_WRITE_FILE:
+				res = storage_set_write(optarg);
+				break;
+
+			case OPT_WRITE_QD:
+				res = storage_set_write_qd(atoi(optarg));
+				break;
+
+			case OPT_WRITE_BS:
+				res = storage_set_write_bs(optarg);
+				break;
+
+			case OPT_WRITE_BUDGET:
+				if(parse_size(optarg, &size)) {
+					fprintf(stderr, "Error, invalid write budget\n");
+					res = -1;
+				}
+				else {
+					storage_set_write_budget(size);
+				}
+				break;
+
+			case 'r':
+				useIdentCache = 0;
+				break;
+
 			case 't':
 				errno = 0;
 				arg = strtol(optarg, NULL, 10);
@@ -146,7 +545,7 @@ static int parse_args(int argc, char *argv[]) {
 					res = -1;
 				}
 				else {
-					load_time = arg;
+					loadTime = arg;
 					tot_time = arg * 2 + 3000;									// Is divided by two later and add extra
 				}																//  marging for hung task timeout.
 				break;
@@ -161,6 +560,7 @@ static int parse_args(int argc, char *argv[]) {
 			case ':':															// Errorhandling
 				fprintf(stderr, "Error, missing option ");						//  missing options.
 				if(isprint(optopt)) fprintf(stderr, "to -%c", optopt);
+				else fprintf(stderr, "to %s", argv[optind - 1]);
 				fprintf(stderr, "\n");
 				res = -1;
 				break;
@@ -168,6 +568,7 @@ static int parse_args(int argc, char *argv[]) {
 			default:															// Errorhandling
 				fprintf(stderr, "Error, unknown option ");						//  unknown options.
 				if(isprint(optopt)) fprintf(stderr, "-%c", optopt);
+				else fprintf(stderr, "%s", argv[optind - 1]);
 				fprintf(stderr, "\n");
 				res = -1;
 				break;
@@ -179,39 +580,77 @@ static int parse_args(int argc, char *argv[]) {
 
 
 
+//-------------------------------------------------------------
+// Register max time in millisecons for program to
+// sleep in main loop.
+void maxSleep(const int ms) {
+	sleep_limit(&ioSleep, ms);
+}
+
+
+
+//-------------------------------------------------------------
+// Print the seed of the worker random numbers. Flushed
+// at once since the board may lose power under load.
+static void print_seed(void) {
+	printf("Random seed %llu, replay with --seed %llu\n",
+		(unsigned long long) high_load_get_seed(),
+		(unsigned long long) high_load_get_seed());
+	fflush(stdout);
+}
+
+
+
 //-------------------------------------------------------------
 // Read and write all our file descriptors
 static int ioExchange(void) {
 	struct timeval timeout;
-	fd_set rfds, wfds;
-	int highFd, res;
+	fd_set rfds, wfds, efds;
+	int highFd, rbFd, res, i, nPsi, psiFds[POLITE_MAX_FDS];
 
 	res = 0;
 	highFd = -1;
 	FD_ZERO(&rfds);
 	FD_ZERO(&wfds);
+	FD_ZERO(&efds);
 	timeout.tv_sec = ioSleep / 1000;
 	timeout.tv_usec = (ioSleep % 1000) * 1000;
 
 	assert(ioSleep >= 0);
-	if(do_exit) ioSleep = 0;
+	if(exitRequested) ioSleep = 0;
 
 	if(sigFd >= 0 && sigFd < FD_SETSIZE) {
 		FD_SET(sigFd, &rfds);
 		if(sigFd > highFd) highFd = sigFd;
 	}
 
+	rbFd = rb ? rpiburn_fd(rb) : -1;											// Wakes us when a child exits
+	if(rbFd >= 0 && rbFd < FD_SETSIZE) {
+		FD_SET(rbFd, &rfds);
+		if(rbFd > highFd) highFd = rbFd;
+	}
+
+	nPsi = polite_fds(psiFds, POLITE_MAX_FDS);									// Stall triggers fire as exceptions
+	for(i = 0; i < nPsi; i++) {
+		if(psiFds[i] >= FD_SETSIZE) continue;
+		FD_SET(psiFds[i], &efds);
+		if(psiFds[i] > highFd) highFd = psiFds[i];
+	}
+
+	status_update();
 	fflush(NULL);
+	if(high_load_is_full()) {
+		jitter_arm(timeout.tv_sec * 1000 + timeout.tv_usec / 1000);
+	}
 
 	if(highFd >= 0) {															// Any reader or write active?
-		res = select(highFd + 1, &rfds, &wfds, NULL, &timeout);
+		res = select(highFd + 1, &rfds, &wfds, &efds, &timeout);
 	}
 	else if(timeout.tv_sec || timeout.tv_usec) {
 		res = select(0, NULL, NULL, NULL, &timeout);							// Just sleep for a while
 	}
 
 	ioSleep = 5000;																// Reset sleep time			
-	if(update_current_time()) return -1;
 
 	if(res == -1) {
 		if(errno == EINTR) return 0;
@@ -219,6 +658,7 @@ static int ioExchange(void) {
 		return -1;
 	}
 	else if(res == 0) {
+		jitter_sample();
 		return 0;
 	}
 
@@ -228,61 +668,200 @@ static int ioExchange(void) {
 	if(sigFd >= 0 && sigFd < FD_SETSIZE && FD_ISSET(sigFd, &rfds)) {
 		res = signal_manager();
 	}
+
+	for(i = 0; i < nPsi; i++) {
+		if(psiFds[i] < FD_SETSIZE && FD_ISSET(psiFds[i], &efds)) polite_pressure(psiFds[i]);
+	}
 	
 	return 0;
 }
 
 
 
+//-------------------------------------------------------------
+// Returns true when the user has asked us to exit, as
+// opposed to the end of a single spawn and load cycle.
+int isExitRequested(void) {
+	return exitRequested;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the time in ms each cycle runs at full load
+int run_load_time(void) {
+	return rpiburn_get_load_time(rb);
+}
+
+
+
+//-------------------------------------------------------------
+// Set the time in ms each following cycle runs at full
+// load. The max time of a cycle is raised to match.
+void run_set_load_time(const int ms) {
+	rpiburn_set_load_time(rb, ms);
+	if(tot_time < ms * 2 + 3000) tot_time = ms * 2 + 3000;						// As for -t
+}
+
+
+
+//-------------------------------------------------------------
+// Run one complete cycle of spawning childs, loading
+// the system and collecting the childs again. Monitoring
+// of the system stays active throughout the cycle.
+int run_cycle(void) {
+	int res, loopRes, sleepMs;
+
+	rpiburn_set_timeout(rb, tot_time);
+	sensor_run_begin();
+	res = rpiburn_start(rb, NULL);
+	if(res) return res;
+	status_new_cycle();
+	polite_run_begin();
+	if(exitRequested) rpiburn_stop(rb);
+
+	// Main loop, until the engine has collected all childs
+	loopRes = 0;
+	while((res = rpiburn_poll(rb, &sleepMs)) > 0) {
+		maxSleep(sleepMs);
+		if(!loopRes) loopRes = replay_manager();
+		if(!loopRes) loopRes = estimate_manager();
+		if(!loopRes) loopRes = sensor_manager();
+		if(!loopRes) loopRes = polite_manager();
+		if(ioExchange()) loopRes = -1;
+		if(loopRes || exitRequested) rpiburn_stop(rb);
+	}
+	sensor_run_end();
+	polite_run_end();
+
+	return (res || loopRes) ? -1 : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Idle for <ms> milliseconds, or less if something
+// happens. Signals are still handled while waiting.
+int run_idle(const int ms) {
+	maxSleep(ms);
+
+	return ioExchange();
+}
+
+
+
+//-------------------------------------------------------------
+// Idle until the SoC temperature has dropped to <baseTemp>
+// milli degrees or until <timeout> ms has passed. Signals
+// are still handled while waiting.
+int run_cooldown(const int baseTemp, const int timeout) {
+	struct timespec coolTimer;
+	int temp;
+
+	timer_set(&coolTimer, timeout);
+
+	while(!exitRequested && !timer_timeout(&coolTimer)) {
+		if(read_soc_temp(&temp) || temp <= baseTemp) break;
+		maxSleep(250);
+		if(ioExchange()) return -1;
+	}
+
+	return 0;
+}
+
+
+
 //-------------------------------------------------------------
 // The main
 int main(int argc, char *argv[]) {
-	struct timespec hungTimer;
+	struct rpiburn_result_t result;
 	int res;
 
  	res = 0;
-	do_exit = 0;
+	memset(&result, 0, sizeof(result));
+	ioSleep = 5000;
 	tot_time = DFLT_TOT_TIME;
-	if(!res) update_current_time();
+	useIdentCache = 1;
+	rtMonitorCpu = -1;
+	recordPeriod = DFLT_RECORD_PERIOD;
+	replaySpeed = 1.0;
+	rpiburn_set_log(rpiburn_log_stdio, NULL);
 	if(!res) res = signal_init();
 	if(!res) res = parse_args(argc, argv);
-	if(!res) res = vchiq_init();
-	if(!res) res = high_load_init();
-
-	// Main loop
-	timer_set(&hungTimer, tot_time / 2);
-	while(!res && !do_exit) {
-		/* Use a timer so we don't hang here
-		 * forever in case of a bug. */
-		if(timer_timeout(&hungTimer)) res = -1;
-		if(!res) maxSleep(timer_remaining(&hungTimer));
-
-		if(!res) res = vchiq_manager();
-		if(hasBrownOut()) do_exit = 1;
-		if(isHeated()) do_exit = 1;
-		if(!res) res = high_load_manager();
-		if(!res) res = ioExchange();
+	if(!res && postmortemFile) {
+		return blackbox_postmortem(postmortemFile) ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
-	
-	/* When time to exit, wait for all childrens to die.
-	 * Ignore errors, but use a timer so we don't
-	 * hang here forever in case of a bug. */
-	do_exit = 1;
-	timer_set(&hungTimer, tot_time / 2);
-	while(isAnyChildAlive() && !timer_timeout(&hungTimer)) {
-		high_load_manager();
-		maxSleep(timer_remaining(&hungTimer));
-		ioExchange();
+	if(!res) res = hw_probe(useIdentCache);
+	if(!res && doIsaCheck) {													// Needs no firmware connection
+		high_load_reserve_cpu(rtMonitorCpu);
+		if(hasSeed) high_load_set_seed(seed);
+		res = high_load_init();
+		if(!res) res = high_load_isa_check();
+		return res ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
-
-	kill_remaining_childs();
-	vchiq_close();
-
-	if(hasBrownOut()) {
+	if(!res && recordFile) {
+		return replay_record(recordFile, recordPeriod, loadTime) ?
+			EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if(!res && replayFile) res = replay_load(replayFile, replaySpeed);
+	if(!res && replayFile) {
+		loadTime = replay_duration();
+		tot_time = loadTime * 2 + 3000;
+	}
+	if(!res) res = storage_discover(ioVirtual);
+	if(!res && doPerformance) res = power_state_init();
+	if(!res && rtMonitorCpu >= 0) res = rtmon_init(rtMonitorCpu);
+	if(!res && doJitter) jitter_init();
+	if(!res && (traceFile || doTraceMarker)) res = trace_init(traceFile, doTraceMarker);
+	if(!res) high_load_reserve_cpu(rtMonitorCpu);
+	if(!res) res = freqmon_start(rtMonitorCpu);
+	if(!res) res = sensor_start(rtMonitorCpu);
+	if(!res && doPolite) res = polite_init(politeCgroup);
+	if(!res && !(rb = rpiburn_init())) res = -1;
+	if(!res) rpiburn_set_load_time(rb, loadTime);
+	if(!res && hasSeed) high_load_set_seed(seed);
+	if(!res) print_seed();
+	if(!res && consumerMap) res = high_load_set_map(consumerMap);
+	if(!res && duty) res = high_load_set_duty(-1, duty);
+	if(!res && blackboxFile) res = blackbox_open(blackboxFile);
+	if(!res && statusFile) res = status_open(statusFile);
+	if(!res && replayFile) res = replay_init();
+	if(!res && (doEstimate || calibrateFile)) res = estimate_init(!calibrateFile);
+
+	if(!res && calibrateFile) res = estimate_calibrate(calibrateFile);
+	else if(!res && doSearch) res = search_consumer_map();
+	else if(!res && jitSearchFile) res = search_jit_loop(jitSearchFile);
+	else if(!res && doMargin) res = margin_search();
+	else if(!res && doSweep) res = sweep_dvfs();
+	else if(!res && sync_is_enabled()) res = sync_run();
+	else if(!res && nRuns) res = repeat_run(nRuns);
+	else if(!res) res = run_cycle();
+
+	sync_close();
+	blackbox_close();
+	status_close();
+	if(rb) print_seed();
+	if(rb) rpiburn_result(rb, &result);
+	rpiburn_free(rb);
+	freqmon_close();
+	sensor_close();
+	polite_close();
+	estimate_close();
+	power_state_restore();
+	trace_close();
+	jitter_report();
+	freqmon_report();
+	estimate_report();
+	sensor_report();
+	polite_report();
+	storage_report();
+	storage_close();
+
+	if(result.anyBrownOut || sync_has_brownout()) {
 		printf("Warning, PSU brownout!\n");
 		return 30;																// Same as SIGPWR
 	}
-	else if(isHeated()) {
+	else if(result.anyHeated) {
 		printf("Warning, overheated!\n");
 		return 70;
 	}
@@ -294,4 +873,3 @@ int main(int argc, char *argv[]) {
 		return EXIT_SUCCESS;
 	}
 }
-
@@ -2,13 +2,15 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-#include <time.h>
-
 
 //-------------------------------------------------------------
-struct timespec now;
-int ioSleep;
-extern volatile unsigned char do_exit;											// True when time to exit app
+void maxSleep(const int ms);
+int isExitRequested(void);
+int run_load_time(void);
+void run_set_load_time(const int ms);
+int run_cycle(void);
+int run_idle(const int ms);
+int run_cooldown(const int baseTemp, const int timeout);
 
 
 #endif
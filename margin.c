@@ -0,0 +1,102 @@
+
+/* Grade a power supply by how much load it sustains,
+ * instead of only pass or fail at full load. Bisect the
+ * duty cycle of all childs for the highest load level
+ * where the firmware under-voltage bit stays clear for
+ * the whole hold time.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "margin.h"
+#include "main.h"
+#include "misc.h"
+#include "high-load.h"
+#include "vchiq.h"
+
+
+//-------------------------------------------------------------
+#define MARGIN_STEP				1												// Resolution of search in percent of full load
+#define MARGIN_COOL_MARGIN		1000											// Accepted temperature rise in mC above start before next probe
+#define MARGIN_COOL_TIMEOUT		60000											// Max time in ms we wait for the board to cool down
+
+
+//-------------------------------------------------------------
+static int baseTemp;															// SoC temperature in mC at start
+
+
+
+//-------------------------------------------------------------
+// Run one probe at load <level> percent. Returns 1 if
+// the supply held, 0 on brownout and -1 on error or
+// if the result is inconclusive.
+static int probe_level(const int level) {
+	int res;
+
+	res = run_cooldown(baseTemp + MARGIN_COOL_MARGIN, MARGIN_COOL_TIMEOUT);
+	if(res) return -1;
+
+	/* A brownout ends the cycle with an error, so
+	 * check the throttled bits before the result. */
+	if(high_load_set_duty(-1, level)) return -1;
+	res = run_cycle();
+	if(isExitRequested()) return -1;
+
+	if(hasCycleBrownOut()) {
+		printf("  %3d%%  brownout\n", level);
+		vchiq_forget_brownout();												// Expected here, the level found is the verdict
+		return 0;
+	}
+	else if(isCycleHeated()) {
+		printf("  %3d%%  overheated, result inconclusive\n", level);
+		return -1;
+	}
+	else if(res) {
+		return -1;
+	}
+
+	printf("  %3d%%  ok\n", level);
+
+	return 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Bisect for the highest load level the supply holds.
+// Full load is tried first since most supplies should
+// pass; then the interval between the highest passed
+// and lowest failed level is halved until the step.
+int margin_search(void) {
+	int lo, hi, mid, res;
+
+	printf("Searching for the maximum sustainable load...\n");
+	if(read_soc_temp(&baseTemp)) baseTemp = 0;									// No sensor; no cooldown
+
+	res = probe_level(100);
+	if(res < 0) return -1;
+	if(res > 0) {
+		printf("PSU sustains 100%% of full load\n");
+		return 0;
+	}
+
+	lo = 0;
+	hi = 100;
+	while(hi - lo > MARGIN_STEP) {
+		mid = (lo + hi) / 2;
+		res = probe_level(mid);
+		if(res < 0) return -1;
+		if(res > 0) lo = mid;
+		else hi = mid;
+	}
+
+	printf("PSU sustains %d%% of full load\n", lo);
+
+	return 0;
+}
@@ -0,0 +1,9 @@
+
+#ifndef MARGIN_H
+#define MARGIN_H
+
+
+//-------------------------------------------------------------
+int margin_search(void);
+
+#endif
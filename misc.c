@@ -12,10 +12,10 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
-#include <regex.h>
+#include <fcntl.h>
+#include <stdarg.h>
 
 #include "misc.h"
-#include "main.h"
 
 
 //-------------------------------------------------------------
@@ -23,11 +23,28 @@
 #error Missing monotonic clock support
 #endif
 
-#define REGEX_ERR_SIZE		1024
+
+//-------------------------------------------------------------
+#define LOG_MAX_LEN				1024											// Max length of one log message
 
 
 //-------------------------------------------------------------
-static char regexErrBuff[REGEX_ERR_SIZE];
+const char *sysRoot = "";														// Prefix of /sys, /proc and /dev paths
+static rpiburn_log_cb_t logCb;													// Where messages go, or NULL when silent
+static void *logUser;															// Argument of log callback
+
+
+
+//=============================================================
+// Fetch the current clock from the kernel
+//-------------------------------------------------------------
+static void get_time(struct timespec *t) {
+	while(clock_gettime(CLOCK_MONOTONIC, t) == -1 && errno == EINTR);
+
+#ifdef NDEBUG
+	assert(0);																	// Test that assert() really has been disabled	
+#endif	
+}
 
 
 
@@ -39,7 +56,6 @@ void timer_set(struct timespec* const t, const int32_t ms_forw) {
 	long ns;
 
 	assert(ms_forw >= 0);
-	assert(now.tv_sec);
 
 	if(ms_forw >= 1000) {		
 		s = ms_forw / 1000;
@@ -50,7 +66,7 @@ void timer_set(struct timespec* const t, const int32_t ms_forw) {
 		ns = ms_forw * 1e6;
 	}
 
-	*t = now;
+	get_time(t);
 	t->tv_sec += s;
 	t->tv_nsec += ns;
 
@@ -63,22 +79,24 @@ void timer_set(struct timespec* const t, const int32_t ms_forw) {
 
 
 //=============================================================
-// Returns the number of millisecons from <now> 
+// Returns the number of millisecons from now 
 // until the timer <t> expires.
 //-------------------------------------------------------------
 int32_t _timer_remaining(const struct timespec* const t) {
+	struct timespec now;
 	int64_t ms;
 
-	assert(now.tv_sec);
 	assert(t->tv_sec);
 
+	get_time(&now);
 	if(t->tv_sec < now.tv_sec) return 0;
 
 	ms = (int64_t) (t->tv_sec - now.tv_sec) * 1000LL;
 	ms += (int64_t) ((t->tv_nsec - now.tv_nsec) / 1e6L);
+	if(ms < 0) return 0;
 	
 	if(ms > (int64_t) INT32_MAX)
-		fprintf(stderr, "Warning, timer_remaining overflow\n");
+		log_error("Warning, timer_remaining overflow\n");
 
 	return (int32_t) ms;
 }
@@ -86,7 +104,7 @@ int32_t _timer_remaining(const struct timespec* const t) {
 
 
 //=============================================================
-// Returns the number of millisecons from <now> 
+// Returns the number of millisecons from now 
 // until the timer <t> expires. Note that 0 is
 // never returned! Use timer_timeout() for catching
 // the timer expire event!
@@ -107,8 +125,10 @@ int32_t timer_remaining(const struct timespec* const t) {
 // Returns true if the timer <t> has expired
 //-------------------------------------------------------------
 short timer_timeout(const struct timespec* const t) {
-	assert(now.tv_sec);
+	struct timespec now;
+
 	if(t->tv_sec == 0) return 1;
+	get_time(&now);
 	if(t->tv_sec > now.tv_sec) return 0;
 	if(t->tv_sec < now.tv_sec) return 1;
 	return t->tv_nsec <= now.tv_nsec;
@@ -142,100 +162,243 @@ int64_t diffntime(struct timespec *t1, struct timespec *t2) {
 
 
 //=============================================================
-// Fetch the current clock from the kernel
+// Returns the monotonic clock in nanoseconds
 //-------------------------------------------------------------
-static int _update_current_time(struct timespec *t) {
-	int res;
+int64_t mono_ns(void) {
+	struct timespec t;
 
-	while((res = clock_gettime(CLOCK_MONOTONIC, t)) == -1 && 
-		errno == EINTR);
+	get_time(&t);
 
-	if(res == -1) {
-		perror("Error, couldn't get monotonic clock");
-		return -1;
-	}
+	return (int64_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
 
-#ifdef NDEBUG
-	assert(0);																	// Test that assert() really has been disabled	
-#endif	
 
-	return 0;
+
+//=============================================================
+// Lower the time in millisecons the caller of a manager
+// may sleep until the next poll, kept in <sleepMs>.
+//-------------------------------------------------------------
+void sleep_limit(int *sleepMs, const int ms) {
+	assert(ms >= 0);
+	if(ms >= 0 && ms < *sleepMs) *sleepMs = ms;
 }
 
 
 
 //=============================================================
-// Fetch the current clock from the kernel
+// Send messages of the engine to <cb>, or drop them
+// when NULL. Process wide, since the engine may
+// report before any context exists.
 //-------------------------------------------------------------
-int update_current_time(void) {
-	return _update_current_time(&now);
+void rpiburn_set_log(rpiburn_log_cb_t cb, void *user) {
+	logCb = cb;
+	logUser = user;
 }
 
 
 
 //=============================================================
-// Register max time in millisecons for
-// program to sleep in main loop.
+// Log callback for applications printing the messages
+// as is; errors to stderr and the rest to stdout.
 //-------------------------------------------------------------
-void maxSleep(const int ms) {
-	assert(ms >= 0);
-	if(ms >=0 && ms < ioSleep) ioSleep = ms;
+void rpiburn_log_stdio(const enum rpiburn_log_t level, const char *text, void *user) {
+	fputs(text, level == RPIBURN_LOG_ERROR ? stderr : stdout);
+}
+
+
+
+//-------------------------------------------------------------
+static void log_text(const enum rpiburn_log_t level, const char *fmt, va_list args) {
+	char buf[LOG_MAX_LEN];
+
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	logCb(level, buf, logUser);
+}
+
+
+
+//=============================================================
+// Log a message, in printf() format. Text may be a
+// part of a line, the next message continues it.
+//-------------------------------------------------------------
+void log_info(const char *fmt, ...) {
+	va_list args;
+
+	if(!logCb) return;
+	va_start(args, fmt);
+	log_text(RPIBURN_LOG_INFO, fmt, args);
+	va_end(args);
 }
 
 
 
 //=============================================================
-// Search for the first text line matching a pattern in a
-// string. Works almost like the grep utility, except for no
-// substrings and only one (the first) match is returned.
-// Args:
-//   haystack      Nullterminated large string which will be searched.
-//   regExpr       Extended regular expression.
-//   matchedBegin  Returned pointer to first char of match.
-//   matchedEnd    Returned pointer to last char of match.
-// Returns 0 on match and -1 on error or no match.
+// Log an error message, in printf() format
 //-------------------------------------------------------------
-int grep(const char *haystack, const char *regExpr, const char **matchedBegin, const char **matchedEnd) {
-	regmatch_t match;
-	regex_t regCmp;
-	int res;
+void log_error(const char *fmt, ...) {
+	va_list args;
+
+	if(!logCb) return;
+	va_start(args, fmt);
+	log_text(RPIBURN_LOG_ERROR, fmt, args);
+	va_end(args);
+}
 
-	if(matchedBegin) *matchedBegin = NULL;
-	if(matchedEnd) *matchedEnd = NULL;
 
-	// "Compile" the regular expression
-	memset(&regCmp, 0, sizeof(regCmp));
-	res = regcomp(&regCmp, regExpr, REG_EXTENDED | REG_ICASE | REG_NEWLINE);
-	if(res) {
-		if(regerror(res, &regCmp, regexErrBuff, REGEX_ERR_SIZE) >= 0) {
-			printf("Error preparing regex %s: %s\n", regExpr, regexErrBuff);
-		}
+
+//=============================================================
+// Log <msg> with the description of errno, as perror()
+//-------------------------------------------------------------
+void log_errno(const char *msg) {
+	int err = errno;
+
+	log_error("%s: %s\n", msg, strerror(err));
+	errno = err;
+}
+
+
+
+//=============================================================
+// Build the path of a system file, such as a sysfs
+// attribute, below the root directory. Makes it possible
+// to run against a fake tree when testing. Returns -1
+// if the buffer is to small.
+//-------------------------------------------------------------
+int sys_path(char *buf, const int bufLen, const char *fmt, ...) {
+	va_list args;
+	int len;
+
+	len = snprintf(buf, bufLen, "%s", sysRoot);
+	if(len >= bufLen) return -1;
+
+	va_start(args, fmt);
+	len += vsnprintf(buf + len, bufLen - len, fmt, args);
+	va_end(args);
+
+	return (len < bufLen ? 0 : -1);
+}
+
+
+
+//=============================================================
+// Read a small file, such as a sysfs or procfs attribute,
+// into a caller supplied buffer. The buffer is always null
+// terminated. Returns number of bytes read or -1 on error.
+//-------------------------------------------------------------
+int read_file_str(const char *path, char *buf, const int bufLen) {
+	int fd, res, hasRdLen;
+
+	assert(bufLen > 0);
+	buf[0] = 0;
+	hasRdLen = 0;
+
+	fd = open(path, O_RDONLY);
+	if(fd == -1) return -1;
+
+	do {
+		res = read(fd, buf + hasRdLen, bufLen - 1 - hasRdLen);
+		if(res == -1 && errno == EINTR) continue;
+		if(res > 0) hasRdLen += res;
+	} while(res > 0 && hasRdLen < bufLen - 1);
+
+	close(fd);
+	buf[hasRdLen] = 0;
+
+	return (res == -1 ? -1 : hasRdLen);
+}
+
+
+
+//=============================================================
+// Read a single integer from a small file, such as
+// a sysfs attribute. Returns 0 on success.
+//-------------------------------------------------------------
+int read_file_long(const char *path, long *val) {
+	char buf[32], *end;
+
+	if(read_file_str(path, buf, sizeof(buf)) <= 0) return -1;
+
+	errno = 0;
+	*val = strtol(buf, &end, 0);
+	if(errno || end == buf) return -1;
+
+	return 0;
+}
+
+
+
+//=============================================================
+// Read the SoC temperature in milli degrees Celsius
+// from the kernel thermal framework.
+//-------------------------------------------------------------
+int read_soc_temp(int *milliC) {
+	char path[256];
+	long val;
+
+	if(sys_path(path, sizeof(path), "/sys/class/thermal/thermal_zone0/temp")) return -1;
+	if(read_file_long(path, &val)) return -1;
+	*milliC = val;
+
+	return 0;
+}
+
+
+
+//=============================================================
+// Read the busy and total jiffies of every core from
+// /proc/stat. Offline cores are missing and left zero.
+//-------------------------------------------------------------
+int read_cpu_stat(struct cpu_stat_t *cnt, const int nCnt) {
+	unsigned long long val[10];
+	char line[256], path[256];
+	int cpu, i, n;
+	FILE *fp;
+
+	sys_path(path, sizeof(path), "/proc/stat");
+	fp = fopen(path, "r");
+	if(!fp) {
+		log_errno("Error opening /proc/stat");
 		return -1;
 	}
 
-	// Do search
-	memset(&match, 0, sizeof(match));
-	res = regexec(&regCmp, haystack, 1, &match, 0);
-	if(res == REG_NOMATCH) {
-		//printf("No grep match\n");
-		res = -1;
-	}
-	else if(res) {
-		if(regerror(res, &regCmp, regexErrBuff, REGEX_ERR_SIZE) >= 0) {
-			printf("Error grepping regex %s: %s\n", regExpr, regexErrBuff);
-		}
-		res = -1;
+	memset(cnt, 0, nCnt * sizeof(*cnt));
+	while(fgets(line, sizeof(line), fp)) {
+		memset(val, 0, sizeof(val));
+		n = sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+			&cpu, &val[0], &val[1], &val[2], &val[3], &val[4], &val[5],
+			&val[6], &val[7], &val[8], &val[9]);
+		if(n < 5 || cpu < 0 || cpu >= nCnt) continue;
+
+		// Guest time is already included in user time
+		for(i = 0; i < 8; i++) cnt[cpu].total += val[i];
+		cnt[cpu].busy = cnt[cpu].total - val[3] - val[4];						// Minus idle and iowait
 	}
-	else {
-		//int i;
-		//printf("Found match at %d: ", match.rm_so);
-		//for(i = match.rm_so; i <= match.rm_eo; i++) putchar(haystack[i]);
-		//if(haystack[i-1] != '\n') putchar('\n');
-		if(matchedBegin) *matchedBegin = haystack + match.rm_so;
-		if(matchedEnd) *matchedEnd = haystack + match.rm_eo;
-		res = 0;
+
+	fclose(fp);
+
+	return 0;
+}
+
+
+
+//=============================================================
+// Parse a size with an optional binary suffix k, m or g,
+// such as "64k". Returns 0 on success.
+//-------------------------------------------------------------
+int parse_size(const char *str, long long *bytes) {
+	char *end;
+
+	errno = 0;
+	*bytes = strtoll(str, &end, 10);
+	if(errno || end == str || *bytes < 0) return -1;
+
+	switch(*end) {
+		case 'g': case 'G': *bytes <<= 10;										// Fall through
+		case 'm': case 'M': *bytes <<= 10;										// Fall through
+		case 'k': case 'K': *bytes <<= 10; end++; break;
+		case 0: break;
+		default: return -1;
 	}
 
-	regfree(&regCmp);
-	return res;
+	return (*end ? -1 : 0);
 }
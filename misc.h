@@ -6,6 +6,8 @@
 #include <time.h>
 #include <sys/time.h>
 
+#include "rpiburn.h"
+
 
 //-------------------------------------------------------------
 #ifndef likely
@@ -14,6 +16,17 @@
 #endif
 
 
+//-------------------------------------------------------------
+struct cpu_stat_t {
+	unsigned long long busy;													// Jiffies not idle or waiting for I/O
+	unsigned long long total;
+};
+
+
+//-------------------------------------------------------------
+extern const char *sysRoot;														// Prefix of /sys, /proc and /dev paths
+
+
 //-------------------------------------------------------------
 void timer_set(struct timespec* const t, const int32_t ms_forw);
 int32_t _timer_remaining(const struct timespec* const t);
@@ -21,9 +34,17 @@ int32_t timer_remaining(const struct timespec* const t);
 short timer_timeout(const struct timespec* const t);
 void timer_cancel(struct timespec* const t);
 int64_t diffntime(struct timespec *t1, struct timespec *t2);
-int update_current_time(void);
-void maxSleep(const int ms);
-int grep(const char *haystack, const char *regExpr, const char **matchedBegin, const char **matchedEnd);
+int64_t mono_ns(void);
+void sleep_limit(int *sleepMs, const int ms);
+void log_info(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_errno(const char *msg);
+int sys_path(char *buf, const int bufLen, const char *fmt, ...);
+int read_file_str(const char *path, char *buf, const int bufLen);
+int read_file_long(const char *path, long *val);
+int read_soc_temp(int *milliC);
+int read_cpu_stat(struct cpu_stat_t *cnt, const int nCnt);
+int parse_size(const char *str, long long *bytes);
 
 #endif // MISC_H
 
@@ -0,0 +1,104 @@
+
+/* Hardware performance counters, of the calling thread
+ * or of every core system wide. The counters need root,
+ * or perf_event_paranoid below 1 for the system wide
+ * ones. Without them callers fall back or skip what they
+ * would have reported.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+#include "hwprobe.h"
+
+
+
+//-------------------------------------------------------------
+// Open a hardware counter of <pid> on <cpu>, as of
+// perf_event_open(2).
+static int open_counter(const uint64_t config, const int pid, const int cpu,
+		const int isUser) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.exclude_kernel = isUser;
+
+	return syscall(SYS_perf_event_open, &attr, pid, cpu, -1, 0);
+}
+
+
+
+//-------------------------------------------------------------
+// Open a counter of user space in the calling thread.
+// Returns the file descriptor or -1.
+int perf_open_thread(const uint64_t config) {
+	return open_counter(config, 0, -1, 1);
+}
+
+
+
+//-------------------------------------------------------------
+// Open the cycle and instruction counters of all online
+// cores. Returns -1, with nothing open, unless every
+// one of them can be counted.
+int perf_open_cores(struct perf_cores_t *pc) {
+	int i, n;
+
+	for(i = 0, n = 0; i < HW_MAX_CPUS; i++) {
+		pc->fds[i][0] = -1;
+		pc->fds[i][1] = -1;
+		if(!hwIdent.cpu[i].online) continue;
+		pc->fds[i][0] = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1, i, 0);
+		pc->fds[i][1] = open_counter(PERF_COUNT_HW_INSTRUCTIONS, -1, i, 0);
+		if(pc->fds[i][0] >= 0 && pc->fds[i][1] >= 0) n++;
+	}
+
+	if(n > 0 && n == hwIdent.nCpus) return 0;
+	perf_close_cores(pc);
+
+	return -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Read the counters of core <cpu>. Values which can't
+// be read are zero. Returns -1 if the core isn't counted.
+int perf_read_core(const struct perf_cores_t *pc, const int cpu, uint64_t *cycles,
+		uint64_t *instr) {
+	*cycles = 0;
+	*instr = 0;
+	if(cpu < 0 || cpu >= HW_MAX_CPUS || pc->fds[cpu][0] < 0) return -1;
+
+	if(read(pc->fds[cpu][0], cycles, sizeof(*cycles)) != sizeof(*cycles)) *cycles = 0;
+	if(read(pc->fds[cpu][1], instr, sizeof(*instr)) != sizeof(*instr)) *instr = 0;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Close the counters of all cores
+void perf_close_cores(struct perf_cores_t *pc) {
+	int i;
+
+	for(i = 0; i < HW_MAX_CPUS; i++) {
+		if(pc->fds[i][0] >= 0) close(pc->fds[i][0]);
+		if(pc->fds[i][1] >= 0) close(pc->fds[i][1]);
+		pc->fds[i][0] = -1;
+		pc->fds[i][1] = -1;
+	}
+}
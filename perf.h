@@ -0,0 +1,22 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+#include "hwprobe.h"
+
+
+//-------------------------------------------------------------
+struct perf_cores_t {															// Counters of every online core
+	int fds[HW_MAX_CPUS][2];													// Cycles and instructions, or -1
+};
+
+
+//-------------------------------------------------------------
+int perf_open_thread(const uint64_t config);
+int perf_open_cores(struct perf_cores_t *pc);
+int perf_read_core(const struct perf_cores_t *pc, const int cpu, uint64_t *cycles,
+	uint64_t *instr);
+void perf_close_cores(struct perf_cores_t *pc);
+
+#endif
@@ -0,0 +1,378 @@
+
+/* Polite mode. Testing in the background shouldn't hurt
+ * the services sharing the board. The kernel pressure
+ * stall information (PSI) of cpu, memory and io tells
+ * when other tasks are kept waiting. Here we register
+ * PSI triggers, or poll the stall totals when the kernel
+ * refuses triggers, and pause one worker per stall
+ * event. The triggers are also in the select() set of
+ * the main loop, so a stall is acted upon at once. A worker loading the stalled resource is
+ * preferred. After a quiet period the workers are
+ * resumed one at a time, and the quiet period needed
+ * grows when stalls come back at once. The fraction
+ * of the load window which really was at full load is
+ * reported per cycle and for the whole test.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+
+#include "polite.h"
+#include "high-load.h"
+#include "misc.h"
+#include "main.h"
+
+
+//-------------------------------------------------------------
+#define POLITE_STALL_US			100000											// Stall time per window which is a stall event
+#define POLITE_WINDOW_US		1000000											// PSI trigger window
+#define POLITE_PERIOD			250												// Max ms between checks of pressure
+#define POLITE_HOLD_MIN			2000											// Quiet ms before resuming a worker
+#define POLITE_HOLD_MAX			32000
+
+
+//-------------------------------------------------------------
+enum psi_res_t {
+	PSI_CPU,
+	PSI_MEM,
+	PSI_IO,
+	N_PSI
+};
+
+struct psi_t {
+	const char *name;															// Resource file name
+	const char *shed[2];														// Consumers preferably paused on stall
+	int fd;
+	char path[256];
+	int hasTrigger;																// True when kernel notifies stalls
+	unsigned long long lastTotal;												// Stall us at last poll, without trigger
+	unsigned int nRunEvents;
+	unsigned int nEvents;
+};
+
+struct polite_stat_t {
+	int64_t loadNs;																// Time of the load window
+	int64_t fullNs;																// Part of it nothing was shed
+	int maxShed;
+};
+
+
+//-------------------------------------------------------------
+static struct psi_t psis[N_PSI] = {
+	[PSI_CPU] = { "cpu", { NULL, NULL }, -1 },
+	[PSI_MEM] = { "memory", { "mem", NULL }, -1 },
+	[PSI_IO] = { "io", { "io", "write" }, -1 },
+};
+
+static int isEnabled;
+static int shed[CPU_SETSIZE];													// Paused childs, the latest last
+static int nShed;
+static int holdMs;																// Quiet time needed before resuming
+static int64_t lastNs;															// Time of last accounting
+static int64_t lastEventNs;
+static int64_t lastResumeNs;
+static int64_t nextPollNs;														// When stall totals are read, without trigger
+static struct polite_stat_t run;
+static struct polite_stat_t tot;
+
+
+
+//-------------------------------------------------------------
+// Read the accumulated stall time in us of some tasks
+// waiting on resource <psi>.
+static int read_stall_total(struct psi_t *psi, unsigned long long *total) {
+	char buf[256];
+
+	if(read_file_str(psi->path, buf, sizeof(buf)) <= 0) return -1;
+	if(sscanf(buf, "some avg10=%*f avg60=%*f avg300=%*f total=%llu", total) != 1) {
+		fprintf(stderr, "Error, unknown format of %s\n", psi->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Enable polite mode. Pressure is of the whole system,
+// or of the tasks in <cgroup> when not NULL, which is
+// the better choice when the services to protect run
+// in a cgroup of their own since our own workers then
+// don't count.
+int polite_init(const char *cgroup) {
+	char trigger[64];
+	int i, len;
+
+	snprintf(trigger, sizeof(trigger), "some %d %d", POLITE_STALL_US, POLITE_WINDOW_US);
+	len = strlen(trigger) + 1;
+
+	for(i = 0; i < N_PSI; i++) {
+		if(!cgroup) {
+			sys_path(psis[i].path, sizeof(psis[i].path), "/proc/pressure/%s", psis[i].name);
+		}
+		else if(cgroup[0] == '/') {
+			snprintf(psis[i].path, sizeof(psis[i].path), "%s/%s.pressure", cgroup, psis[i].name);
+		}
+		else {
+			sys_path(psis[i].path, sizeof(psis[i].path), "/sys/fs/cgroup/%s/%s.pressure",
+				cgroup, psis[i].name);
+		}
+
+		psis[i].fd = open(psis[i].path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if(psis[i].fd >= 0 && write(psis[i].fd, trigger, len) == len) {
+			psis[i].hasTrigger = 1;
+			continue;
+		}
+
+		// Triggers need a recent kernel and privileges, try
+		// polling instead.
+		if(psis[i].fd >= 0) close(psis[i].fd);
+		psis[i].fd = -1;
+		if(read_stall_total(&psis[i], &psis[i].lastTotal)) {
+			fprintf(stderr, "Error, no pressure stall information in %s: %s\n",
+				psis[i].path, strerror(errno));
+			polite_close();
+			return -1;
+		}
+	}
+
+	holdMs = POLITE_HOLD_MIN;
+	isEnabled = 1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Add time since last call to the statistics
+static void account(const int64_t now) {
+	int64_t dt;
+
+	dt = lastNs ? now - lastNs : 0;
+	lastNs = now;
+	if(!high_load_is_full()) return;
+
+	run.loadNs += dt;
+	tot.loadNs += dt;
+	if(nShed) return;
+	run.fullNs += dt;
+	tot.fullNs += dt;
+}
+
+
+
+//-------------------------------------------------------------
+// Pause one more worker because of a stall of <res>
+static void shed_worker(const enum psi_res_t res) {
+	int i, idx;
+
+	for(i = 0, idx = -1; i < 2 && idx < 0 && psis[res].shed[i]; i++) {
+		idx = high_load_find(psis[res].shed[i], 0);
+	}
+	if(idx < 0) idx = high_load_find(NULL, 0);
+	if(idx < 0 || nShed >= CPU_SETSIZE) return;
+
+	high_load_pause(idx, 1);
+	shed[nShed++] = idx;
+	if(nShed > run.maxShed) run.maxShed = nShed;
+	if(nShed > tot.maxShed) tot.maxShed = nShed;
+}
+
+
+
+//-------------------------------------------------------------
+// Count a stall of <res> and shed a worker for it.
+// Stalls right after resuming a worker means it was
+// too early, wait longer the next time.
+static void stall(const enum psi_res_t res, const int64_t now) {
+	psis[res].nRunEvents++;
+	psis[res].nEvents++;
+	if(high_load_is_full()) shed_worker(res);
+
+	if(now != lastEventNs && lastResumeNs && now - lastResumeNs < holdMs * 1000000LL) {
+		holdMs = holdMs * 2 < POLITE_HOLD_MAX ? holdMs * 2 : POLITE_HOLD_MAX;
+	}
+	lastEventNs = now;
+}
+
+
+
+//-------------------------------------------------------------
+// Watch for stalls of other tasks and pause or resume
+// workers accordingly. Called from the main loop.
+int polite_manager(void) {
+	struct pollfd pfds[N_PSI];
+	unsigned long long total;
+	int64_t now;
+	int i, isStalled, hasStall;
+
+	if(!isEnabled) return 0;
+	now = mono_ns();
+	account(now);
+	maxSleep(POLITE_PERIOD);
+
+	for(i = 0; i < N_PSI; i++) {
+		pfds[i].fd = psis[i].fd;
+		pfds[i].events = POLLPRI;
+		pfds[i].revents = 0;
+	}
+	if(poll(pfds, N_PSI, 0) == -1 && errno != EINTR) {
+		perror("Error polling pressure");
+		return -1;
+	}
+
+	for(i = 0, hasStall = 0; i < N_PSI; i++) {
+		if(psis[i].hasTrigger) {
+			if(pfds[i].revents & POLLERR) {
+				fprintf(stderr, "Error, pressure of %s is gone\n", psis[i].path);
+				return -1;
+			}
+			if(!(pfds[i].revents & POLLPRI)) continue;
+		}
+		else {
+			if(now < nextPollNs) continue;
+			if(read_stall_total(&psis[i], &total)) return -1;
+			isStalled = total - psis[i].lastTotal >= POLITE_STALL_US;
+			psis[i].lastTotal = total;
+			if(!isStalled) continue;
+		}
+
+		stall(i, now);
+		hasStall = 1;
+	}
+	if(now >= nextPollNs) nextPollNs = now + POLITE_WINDOW_US * 1000LL;
+	if(hasStall) return 0;
+
+	// Resume one worker after a quiet period
+	if(nShed && now - lastEventNs >= holdMs * 1000000LL &&
+			now - lastResumeNs >= holdMs * 1000000LL) {
+		high_load_pause(shed[--nShed], 0);
+		lastResumeNs = now;
+	}
+	else if(!nShed && now - lastEventNs >= POLITE_HOLD_MAX * 1000000LL) {
+		holdMs = POLITE_HOLD_MIN;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Get the file descriptors of the stall triggers into
+// <fds>, for the select() of the main loop. A trigger
+// fires as an exceptional condition (POLLPRI). Returns
+// the number of them.
+int polite_fds(int *fds, const int maxFds) {
+	int i, n;
+
+	for(i = 0, n = 0; isEnabled && i < N_PSI && n < maxFds; i++) {
+		if(psis[i].hasTrigger) fds[n++] = psis[i].fd;
+	}
+
+	return n;
+}
+
+
+
+//-------------------------------------------------------------
+// Handle a stall trigger <fd> which select() of the main
+// loop found fired. The select consumed the event, so it
+// won't show up in the poll of polite_manager().
+void polite_pressure(const int fd) {
+	int64_t now;
+	int i;
+
+	for(i = 0; i < N_PSI && (!psis[i].hasTrigger || psis[i].fd != fd); i++);
+	if(!isEnabled || i == N_PSI) return;
+
+	now = mono_ns();
+	account(now);
+	stall(i, now);
+}
+
+
+
+//-------------------------------------------------------------
+// Start the statistics of a new load cycle. Workers
+// paused in a previous cycle are paused in this one
+// too, the childs are new but in the same slots.
+void polite_run_begin(void) {
+	int i;
+
+	if(!isEnabled) return;
+	memset(&run, 0, sizeof(run));
+	for(i = 0; i < N_PSI; i++) {
+		psis[i].nRunEvents = 0;
+		if(!psis[i].hasTrigger) read_stall_total(&psis[i], &psis[i].lastTotal);
+	}
+	for(i = 0; i < nShed; i++) high_load_pause(shed[i], 1);
+	run.maxShed = nShed;
+	lastNs = mono_ns();
+	nextPollNs = lastNs + POLITE_WINDOW_US * 1000LL;
+}
+
+
+
+//-------------------------------------------------------------
+// Print the share of full load and stalls in <st>
+static void print_stat(const char *what, const struct polite_stat_t *st, const int isRun) {
+	int i;
+
+	printf("Polite %s: full load %.0f%% of %.1f s load window, up to %d workers shed,"
+		" stalls", what, st->loadNs ? 100.0 * st->fullNs / st->loadNs : 0.0,
+		st->loadNs / 1e9, st->maxShed);
+	for(i = 0; i < N_PSI; i++) {
+		printf("%s %s %u", i ? "," : "", psis[i].name,
+			isRun ? psis[i].nRunEvents : psis[i].nEvents);
+	}
+	printf("\n");
+}
+
+
+
+//-------------------------------------------------------------
+// Print how much of the load cycle was at full load
+void polite_run_end(void) {
+	if(!isEnabled) return;
+	account(mono_ns());
+	print_stat("cycle", &run, 1);
+}
+
+
+
+//-------------------------------------------------------------
+// Close the pressure files
+void polite_close(void) {
+	int i;
+
+	for(i = 0; i < N_PSI; i++) {
+		if(psis[i].fd >= 0) close(psis[i].fd);
+		psis[i].fd = -1;
+		psis[i].hasTrigger = 0;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Print how much of all load cycles was at full load
+void polite_report(void) {
+	if(!isEnabled) return;
+	print_stat("test", &tot, 0);
+	isEnabled = 0;
+}
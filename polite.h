@@ -0,0 +1,20 @@
+
+#ifndef POLITE_H
+#define POLITE_H
+
+
+//-------------------------------------------------------------
+#define POLITE_MAX_FDS			3												// Stall triggers, one per resource
+
+
+//-------------------------------------------------------------
+int polite_init(const char *cgroup);
+int polite_manager(void);
+int polite_fds(int *fds, const int maxFds);
+void polite_pressure(const int fd);
+void polite_run_begin(void);
+void polite_run_end(void);
+void polite_close(void);
+void polite_report(void);
+
+#endif
@@ -0,0 +1,274 @@
+
+/* Put the system in a known power state for the test.
+ * Every core runs the performance governor at maximum
+ * frequency and deep idle states are blocked by holding
+ * the PM QoS cpu_dma_latency at zero. The previous
+ * settings are restored on any exit path we can catch,
+ * that is everything except SIGKILL.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "powerstate.h"
+#include "hwprobe.h"
+#include "misc.h"
+
+
+//-------------------------------------------------------------
+#define PS_PATH_LEN			256
+#define PS_VAL_LEN			32
+
+
+//-------------------------------------------------------------
+enum ps_attr_t {																// Restored in this order
+	PS_MIN_FREQ,
+	PS_MAX_FREQ,
+	PS_GOVERNOR,
+	PS_N_ATTRS
+};
+
+struct ps_saved_t {
+	char path[PS_PATH_LEN];														// Full path of the sysfs attribute
+	char val[PS_VAL_LEN];														// Value before we changed it
+	int len;																	// Length of value
+};
+
+
+//-------------------------------------------------------------
+static const char *attrNames[PS_N_ATTRS] = {
+	[PS_MIN_FREQ] = "scaling_min_freq",
+	[PS_MAX_FREQ] = "scaling_max_freq",
+	[PS_GOVERNOR] = "scaling_governor",
+};
+
+static struct ps_saved_t saved[HW_MAX_CPUS][PS_N_ATTRS];						// Paths are prepared before any signal
+static volatile sig_atomic_t isSaved;											// True when there is something to restore
+static int latencyFd = -1;														// Held open to keep cpu_dma_latency at zero
+
+static const int fatalSigs[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+
+
+//-------------------------------------------------------------
+// Write a value to a sysfs attribute. Only async
+// signal safe calls since we also run from handlers.
+static int write_attr(const char *path, const char *val, const int len) {
+	int fd, res;
+
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if(fd == -1) return -1;
+
+	while((res = write(fd, val, len)) == -1 && errno == EINTR);
+	close(fd);
+
+	return (res == len ? 0 : -1);
+}
+
+
+
+//-------------------------------------------------------------
+// Restore all saved settings and release the latency
+// request. Safe to call several times and from a signal
+// handler.
+void power_state_restore(void) {
+	int i, j;
+
+	if(!isSaved) return;
+	isSaved = 0;
+
+	for(i = 0; i < HW_MAX_CPUS; i++) {
+		for(j = 0; j < PS_N_ATTRS; j++) {
+			if(saved[i][j].len <= 0) continue;
+			write_attr(saved[i][j].path, saved[i][j].val, saved[i][j].len);
+		}
+
+		// A clamped max limit may have been in the way of
+		// the min limit, so the max limit is written again.
+		if(saved[i][PS_MAX_FREQ].len > 0) {
+			write_attr(saved[i][PS_MAX_FREQ].path, saved[i][PS_MAX_FREQ].val,
+				saved[i][PS_MAX_FREQ].len);
+		}
+	}
+
+	if(latencyFd >= 0) close(latencyFd);										// Kernel drops the QoS request on close
+	latencyFd = -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Fatal signal; restore the system and let the signal
+// take its default action.
+static void fatal_handler(int sig) {
+	power_state_restore();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+
+
+//-------------------------------------------------------------
+// Save the settings of one core. Cores may share the
+// same cpufreq policy, so all cores are saved before
+// any of them is changed.
+static int save_core(const int cpu) {
+	int j, len;
+
+	for(j = 0; j < PS_N_ATTRS; j++) {
+		sys_path(saved[cpu][j].path, PS_PATH_LEN,
+			"/sys/devices/system/cpu/cpu%d/cpufreq/%s", cpu, attrNames[j]);
+		len = read_file_str(saved[cpu][j].path, saved[cpu][j].val, PS_VAL_LEN);
+		if(len <= 0) {
+			fprintf(stderr, "Error reading cpufreq %s of core %d\n",
+				attrNames[j], cpu);
+			return -1;
+		}
+		saved[cpu][j].len = len;
+		isSaved = 1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Switch one core to the performance governor at maximum
+// frequency. The max limit is raised before the min
+// limit so the kernel never sees min above max.
+static int set_core(const int cpu) {
+	char path[PS_PATH_LEN], maxFreq[PS_VAL_LEN];
+	int len;
+
+	sys_path(path, sizeof(path),
+		"/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+	len = read_file_str(path, maxFreq, sizeof(maxFreq));
+	if(len <= 0) {
+		fprintf(stderr, "Error reading max frequency of core %d\n", cpu);
+		return -1;
+	}
+
+	if(write_attr(saved[cpu][PS_GOVERNOR].path, "performance", 11) ||
+			write_attr(saved[cpu][PS_MAX_FREQ].path, maxFreq, len) ||
+			write_attr(saved[cpu][PS_MIN_FREQ].path, maxFreq, len)) {
+		fprintf(stderr, "Error setting performance state of core %d: %s\n",
+			cpu, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Install restore hooks and save the cpufreq settings of
+// all cores, unless already saved.
+static int save_state(void) {
+	struct sigaction sigAct;
+	int i, res;
+
+	if(isSaved) return 0;
+
+	// Restore hooks must be in place before we change anything
+	atexit(power_state_restore);
+	memset(&sigAct, 0, sizeof(sigAct));
+	sigAct.sa_handler = fatal_handler;
+	sigemptyset(&sigAct.sa_mask);
+	for(i = 0; i < (int) (sizeof(fatalSigs) / sizeof(fatalSigs[0])); i++) {
+		if(sigaction(fatalSigs[i], &sigAct, NULL) == -1) {
+			perror("Error installing power state restore handler");
+			return -1;
+		}
+	}
+
+	for(i = 0, res = 0; i < HW_MAX_CPUS && !res; i++) {
+		if(hwIdent.cpu[i].online) res = save_core(i);
+	}
+	if(res) power_state_restore();
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Save the current power state, install restore hooks
+// and switch the system to maximum performance.
+int power_state_init(void) {
+	char path[PS_PATH_LEN];
+	int32_t latency;
+	int i, res;
+
+	res = save_state();
+	for(i = 0; i < HW_MAX_CPUS && !res; i++) {
+		if(hwIdent.cpu[i].online) res = set_core(i);
+	}
+	if(res) {
+		power_state_restore();
+		return -1;
+	}
+
+	// Hold the PM QoS latency request for as long as we run
+	sys_path(path, sizeof(path), "/dev/cpu_dma_latency");
+	latencyFd = open(path, O_WRONLY);
+	latency = 0;
+	if(latencyFd == -1 || write(latencyFd, &latency, sizeof(latency)) !=
+			sizeof(latency)) {
+		perror("Error setting cpu_dma_latency");
+		power_state_restore();
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Clamp the max frequency of all cores to <khz>, within
+// the range of each core. The min limit is lowered first
+// when it's above. The settings are saved before the
+// first change and restored at exit.
+int power_state_max_freq(const long khz) {
+	char path[PS_PATH_LEN], val[PS_VAL_LEN];
+	long lim[2], freq, minFreq;
+	int i, len;
+
+	if(save_state()) return -1;
+
+	for(i = 0; i < HW_MAX_CPUS; i++) {
+		if(!hwIdent.cpu[i].online) continue;
+		sys_path(path, sizeof(path),
+			"/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_min_freq", i);
+		if(read_file_long(path, &lim[0])) lim[0] = 0;
+		sys_path(path, sizeof(path),
+			"/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", i);
+		if(read_file_long(path, &lim[1])) lim[1] = LONG_MAX;
+		freq = khz < lim[0] ? lim[0] : (khz > lim[1] ? lim[1] : khz);
+		len = snprintf(val, sizeof(val), "%ld", freq);
+
+		if((!read_file_long(saved[i][PS_MIN_FREQ].path, &minFreq) &&
+				minFreq > freq && write_attr(saved[i][PS_MIN_FREQ].path, val, len)) ||
+				write_attr(saved[i][PS_MAX_FREQ].path, val, len)) {
+			fprintf(stderr, "Error clamping frequency of core %d: %s\n",
+				i, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
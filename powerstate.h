@@ -0,0 +1,11 @@
+
+#ifndef POWERSTATE_H
+#define POWERSTATE_H
+
+
+//-------------------------------------------------------------
+int power_state_init(void);
+int power_state_max_freq(const long khz);
+void power_state_restore(void);
+
+#endif
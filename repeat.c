@@ -0,0 +1,156 @@
+
+/* Repeat the load cycle a number of times in one run
+ * and grade the supply statistically. A single short
+ * cycle is noisy; a supply which browns out one time in
+ * five often passes it. Brownouts are counted with a
+ * Wilson score interval, which behaves well for few
+ * samples and rates near zero, and testing stops early
+ * once the interval is clear of the accepted rate.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "repeat.h"
+#include "main.h"
+#include "misc.h"
+#include "vchiq.h"
+
+
+//-------------------------------------------------------------
+#define REPEAT_MAX_RUNS			10000
+#define REPEAT_COOL_MARGIN		1000											// Accepted temperature rise in mC above start before next run
+#define REPEAT_COOL_TIMEOUT		120000											// Max time in ms we wait for the board to cool down
+#define REPEAT_Z				1.96											// Normal quantile of 95% confidence
+#define REPEAT_DFLT_LIMIT		5												// Accepted brownout rate in percent
+
+
+//-------------------------------------------------------------
+static int failLimit = REPEAT_DFLT_LIMIT;										// Accepted brownout rate in percent
+
+
+
+//-------------------------------------------------------------
+// Set the accepted brownout rate in percent
+int repeat_set_limit(const int pct) {
+	if(pct < 0 || pct >= 100) {
+		fprintf(stderr, "Error, invalid accepted brownout rate\n");
+		return -1;
+	}
+	failLimit = pct;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Wilson score interval at 95% confidence of a rate
+// from <k> events in <n> trials.
+static void wilson(const int k, const int n, double *lo, double *hi) {
+	double p, z2, center, half;
+
+	p = (double) k / n;
+	z2 = REPEAT_Z * REPEAT_Z;
+	center = (p + z2 / (2 * n)) / (1 + z2 / n);
+	half = REPEAT_Z * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n)) / (1 + z2 / n);
+	*lo = center - half < 0 ? 0 : center - half;
+	*hi = center + half > 1 ? 1 : center + half;
+}
+
+
+
+//-------------------------------------------------------------
+// Sort order of qsort() for ints
+static int cmp_int(const void *a, const void *b) {
+	return *(const int*) a - *(const int*) b;
+}
+
+
+
+//-------------------------------------------------------------
+// Run the load cycle up to <nRuns> times, idling until
+// the SoC is back at its start temperature in between
+// so every run starts alike. Prints pass and fail
+// counts, the time to first throttle distribution and
+// the confidence interval of the brownout rate.
+int repeat_run(const int nRuns) {
+	int n, nFail, nHeat, nThrott, res, baseTemp;
+	int *firstThrott;
+	double lo, hi;
+
+	if(nRuns < 1 || nRuns > REPEAT_MAX_RUNS) {
+		fprintf(stderr, "Error, number of runs must be 1 to %d\n",
+			REPEAT_MAX_RUNS);
+		return -1;
+	}
+
+	firstThrott = malloc(nRuns * sizeof(int));
+	if(!firstThrott) {
+		perror("Error allocating run results");
+		return -1;
+	}
+
+	printf("Repeating test up to %d times...\n", nRuns);
+	if(read_soc_temp(&baseTemp)) baseTemp = 0;									// No sensor; no cooldown
+
+	res = 0;
+	nFail = 0;
+	nHeat = 0;
+	nThrott = 0;
+	lo = 0;
+	hi = 1;
+	for(n = 0; n < nRuns && !res; ) {
+		if(n) res = run_cooldown(baseTemp + REPEAT_COOL_MARGIN, REPEAT_COOL_TIMEOUT);
+		if(res || isExitRequested()) break;
+
+		/* A brownout ends the cycle with an error, so
+		 * check the throttled bits before the result. */
+		res = run_cycle();
+		if(isExitRequested()) break;
+		if(hasCycleBrownOut() || isCycleHeated()) res = 0;
+		if(res) break;
+		n++;
+
+		if(hasCycleBrownOut()) nFail++;
+		else if(isCycleHeated()) nHeat++;
+		if(vchiq_first_throttle() >= 0) firstThrott[nThrott++] = vchiq_first_throttle();
+
+		wilson(nFail, n, &lo, &hi);
+		printf("  run %-4d %-10s brownout rate %3.0f%% .. %3.0f%%\n", n,
+			hasCycleBrownOut() ? "brownout" : (isCycleHeated() ? "overheated" : "ok"),
+			lo * 100, hi * 100);
+
+		// Settled when the interval is clear of the limit
+		if(lo * 100 > failLimit || hi * 100 < failLimit) break;
+	}
+
+	if(n) {
+		printf("%d runs: %d ok, %d brownout, %d overheated\n", n,
+			n - nFail - nHeat, nFail, nHeat);
+		printf("Brownout rate %.0f%%, 95%% confidence %.1f%% .. %.1f%% (limit %d%%)%s\n",
+			100.0 * nFail / n, lo * 100, hi * 100, failLimit,
+			(lo * 100 > failLimit || hi * 100 < failLimit) ? "" : ", not settled");
+	}
+
+	/* The rate is the verdict, so single brownouts within
+	 * the accepted rate don't fail the run. */
+	if(n && nFail * 100 <= failLimit * n) vchiq_forget_brownout();
+
+	if(nThrott) {
+		qsort(firstThrott, nThrott, sizeof(int), cmp_int);
+		printf("First throttle after min %d, median %d, max %d ms (%d runs)\n",
+			firstThrott[0], firstThrott[nThrott / 2], firstThrott[nThrott - 1],
+			nThrott);
+	}
+
+	free(firstThrott);
+
+	return res;
+}
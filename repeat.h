@@ -0,0 +1,10 @@
+
+#ifndef REPEAT_H
+#define REPEAT_H
+
+
+//-------------------------------------------------------------
+int repeat_set_limit(const int pct);
+int repeat_run(const int nRuns);
+
+#endif
@@ -0,0 +1,270 @@
+
+/* Record and replay processor utilisation. The recorder
+ * samples the busy fraction of every core in /proc/stat
+ * into a compact trace file, on a production board. The
+ * replay reproduces it as load profile by changing the
+ * duty cycle of one processor consumer per core, while
+ * the brownout and heat monitoring stays active.
+ *
+ * The trace file is a small header followed by one byte
+ * per core and sample, holding busy percent:
+ *   "RPBR", version, cores, period ms (le16), samples (le32)
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include "replay.h"
+#include "main.h"
+#include "misc.h"
+#include "high-load.h"
+#include "hwprobe.h"
+
+
+//-------------------------------------------------------------
+#define REPLAY_MAGIC			"RPBR"
+#define REPLAY_VERSION			1												// Bump when the file format change
+#define REPLAY_MIN_PERIOD		10												// Shortest sample period in ms, one jiffy at HZ 100
+#define REPLAY_MAX_SAMPLES		(16 * 1024 * 1024)								// Max bytes of samples we load
+
+
+//-------------------------------------------------------------
+struct replay_hdr_t {
+	char magic[4];
+	uint8_t version;
+	uint8_t nCpus;																// Number of cores per sample
+	uint16_t period;															// Sample period in ms
+	uint32_t nSamples;
+} __attribute__((packed));
+
+
+//-------------------------------------------------------------
+static uint8_t *samples;														// Busy percent per sample and core
+static int nSamples;
+static int nRecCpus;															// Number of cores in trace
+static int period;																// Sample period in ms of trace
+static double speed = 1.0;														// Replay time scaling
+static int isReplaying;															// True when replay is active
+static int64_t startTime;														// When full load began, in ns
+static int hasStarted;
+
+
+
+//-------------------------------------------------------------
+// Sample the busy fraction of every core each <ms>
+// milliseconds into <fileName>. Runs for <duration> ms,
+// or until the user asks us to exit when zero.
+int replay_record(const char *fileName, const int ms, const int duration) {
+	struct cpu_stat_t cnt[2][HW_MAX_CPUS];
+	struct timespec sampleTimer, endTimer;
+	uint8_t pct[HW_MAX_CPUS];
+	struct replay_hdr_t hdr;
+	unsigned long long dBusy, dTotal;
+	int i, n, cur, res;
+	FILE *fp;
+
+	if(ms < REPLAY_MIN_PERIOD || ms > UINT16_MAX) {
+		fprintf(stderr, "Error, record period must be %d to %d ms\n",
+			REPLAY_MIN_PERIOD, UINT16_MAX);
+		return -1;
+	}
+
+	fp = fopen(fileName, "w");
+	if(!fp) {
+		perror("Error creating record file");
+		return -1;
+	}
+
+	n = sysconf(_SC_NPROCESSORS_CONF);
+	if(n > HW_MAX_CPUS) n = HW_MAX_CPUS;
+	memcpy(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic));
+	hdr.version = REPLAY_VERSION;
+	hdr.nCpus = n;
+	hdr.period = htole16(ms);
+	hdr.nSamples = 0;
+	res = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1) ? 0 : -1;
+
+	printf("Recording processor load every %d ms...\n", ms);
+
+	cur = 0;
+	if(!res) res = read_cpu_stat(cnt[cur], n);
+	timer_set(&sampleTimer, ms);
+	timer_set(&endTimer, duration);
+
+	while(!res && !isExitRequested() && (!duration || !timer_timeout(&endTimer))) {
+		res = run_idle(timer_remaining(&sampleTimer));
+		if(res || !timer_timeout(&sampleTimer)) continue;
+
+		/* Reschedule from the previous deadline, not from
+		 * now, so the sample rate doesn't drift. */
+		sampleTimer.tv_nsec += ms * 1000000L;
+		sampleTimer.tv_sec += sampleTimer.tv_nsec / 1000000000L;
+		sampleTimer.tv_nsec %= 1000000000L;
+		if(timer_timeout(&sampleTimer)) timer_set(&sampleTimer, ms);			// Fell behind, skip ahead
+
+		cur ^= 1;
+		res = read_cpu_stat(cnt[cur], n);
+		for(i = 0; !res && i < n; i++) {
+			dBusy = cnt[cur][i].busy - cnt[cur ^ 1][i].busy;
+			dTotal = cnt[cur][i].total - cnt[cur ^ 1][i].total;
+			pct[i] = dTotal ? (dBusy * 100 + dTotal / 2) / dTotal : 0;
+			if(pct[i] > 100) pct[i] = 100;
+		}
+		if(!res && fwrite(pct, n, 1, fp) != 1) res = -1;
+		if(!res) hdr.nSamples++;
+	}
+
+	// Complete the header with the number of samples
+	n = hdr.nSamples;
+	hdr.nSamples = htole32(n);
+	if(fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, fp) != 1) res = -1;
+	if(fclose(fp)) res = -1;
+	if(res) perror("Error writing record file");
+
+	printf("Recorded %d samples\n", n);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Load a recorded trace for replay. Time is scaled by
+// <scale>; 2 replays twice as fast. The duration of the
+// replay becomes the load time of the test.
+int replay_load(const char *fileName, const double scale) {
+	struct replay_hdr_t hdr;
+	size_t len;
+	FILE *fp;
+
+	if(scale <= 0) {
+		fprintf(stderr, "Error, invalid replay speed\n");
+		return -1;
+	}
+
+	fp = fopen(fileName, "r");
+	if(!fp) {
+		perror("Error opening replay file");
+		return -1;
+	}
+
+	if(fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+			memcmp(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic)) ||
+			hdr.version != REPLAY_VERSION || hdr.nCpus == 0 ||
+			le16toh(hdr.period) < REPLAY_MIN_PERIOD) {
+		fprintf(stderr, "Error, %s is not a replay file\n", fileName);
+		fclose(fp);
+		return -1;
+	}
+
+	nRecCpus = hdr.nCpus;
+	period = le16toh(hdr.period);
+	nSamples = le32toh(hdr.nSamples);
+	len = (size_t) nSamples * nRecCpus;
+	if(nSamples < 1 || len > REPLAY_MAX_SAMPLES) {
+		fprintf(stderr, "Error, replay file has no or to many samples\n");
+		fclose(fp);
+		return -1;
+	}
+
+	samples = malloc(len);
+	if(!samples || fread(samples, len, 1, fp) != 1) {
+		fprintf(stderr, "Error reading replay file\n");
+		free(samples);
+		samples = NULL;
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+	speed = scale;
+	isReplaying = 1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the replay time in ms, including time scaling
+int replay_duration(void) {
+	return (double) nSamples * period / speed;
+}
+
+
+
+//-------------------------------------------------------------
+// Set the duty cycle of every child to the utilisation
+// of the recorded core it replays. A trace from a board
+// with fewer cores wraps around.
+static void set_sample(const int idx) {
+	int i;
+
+	for(i = 0; i < high_load_cores(); i++) {
+		high_load_set_duty(i, samples[idx * nRecCpus + i % nRecCpus]);
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Prepare the consumer map for replay; one processor
+// consumer per core, starting at the first sample.
+int replay_init(void) {
+	char map[HW_MAX_CPUS * 4];
+	int i, len;
+
+	if(!isReplaying) return 0;
+
+	for(i = 0, len = 0; i < high_load_cores(); i++) {
+		len += snprintf(map + len, sizeof(map) - len, "%scpu", i ? "," : "");
+	}
+	if(high_load_set_map(map)) return -1;
+	set_sample(0);
+
+	printf("Replaying %d samples of %d cores, %.1f s\n", nSamples, nRecCpus,
+		replay_duration() / 1000.0);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Follow the trace while the test runs at full load.
+// Called from the main loop.
+int replay_manager(void) {
+	int64_t elapsed;
+	int idx, next;
+
+	if(!isReplaying) return 0;
+	if(!high_load_is_full()) {
+		hasStarted = 0;
+		return 0;
+	}
+
+	if(!hasStarted) {
+		startTime = mono_ns();
+		hasStarted = 1;
+	}
+
+	elapsed = (mono_ns() - startTime) / 1000000LL;
+	idx = elapsed * speed / period;
+	if(idx >= nSamples) idx = nSamples - 1;
+	set_sample(idx);
+
+	// Wake up again for the next sample
+	next = (double) (idx + 1) * period / speed - elapsed;
+	maxSleep(next > 0 ? next : 0);
+
+	return 0;
+}
@@ -0,0 +1,13 @@
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+
+//-------------------------------------------------------------
+int replay_record(const char *fileName, const int ms, const int duration);
+int replay_load(const char *fileName, const double scale);
+int replay_duration(void);
+int replay_init(void);
+int replay_manager(void);
+
+#endif
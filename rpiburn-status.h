@@ -0,0 +1,80 @@
+
+/* Live status page of a running rpiburn, started with
+ * --status <file>. The file is normally in /dev/shm and
+ * holds one fixed layout struct which the test updates
+ * under a sequence lock. Watchers map it read only and
+ * may poll at any rate; a read is plain memory loads,
+ * without syscalls or any effect on the test. Build the
+ * reader with "make lib" and link librpiburn-status.a.
+ * Typical use:
+ *
+ *   const struct rpiburn_status_t *page;
+ *   struct rpiburn_status_t st;
+ *   page = rpiburn_status_open(RPIBURN_STATUS_PATH);
+ *   if(page && !rpiburn_status_read(page, &st)) ...
+ *   rpiburn_status_close(page);
+ *
+ * Fields are only ever added at the end, with <size>
+ * telling how many are there. The version is bumped
+ * when the meaning of a field changes.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+#ifndef RPIBURN_STATUS_H
+#define RPIBURN_STATUS_H
+
+#include <stdint.h>
+
+
+//-------------------------------------------------------------
+#define RPIBURN_STATUS_PATH		"/dev/shm/rpiburn-status"						// Suggested file of the page
+#define RPIBURN_STATUS_MAGIC	0x54534252u										// "RBST" little endian
+#define RPIBURN_STATUS_VERSION	1
+
+
+//-------------------------------------------------------------
+enum rpiburn_phase_t {
+	RPIBURN_PH_IDLE,															// Between load cycles
+	RPIBURN_PH_SPAWN,															// Starting workers
+	RPIBURN_PH_LOAD,															// All workers running, full load
+	RPIBURN_PH_ENDING,															// Waiting for workers to exit
+	RPIBURN_PH_DONE,															// Test has ended, the page is final
+};
+
+enum rpiburn_status_flag_t {
+	RPIBURN_ST_BROWNOUT = 1u << 0,												// PSU under-voltage seen during the test
+	RPIBURN_ST_HEATED = 1u << 1,												// Frequency capped or throttled during the test
+	RPIBURN_ST_HAS_TEMP = 1u << 2,												// <milliC> is valid
+};
+
+struct rpiburn_status_t {
+	uint32_t magic;																// RPIBURN_STATUS_MAGIC
+	uint16_t version;															// RPIBURN_STATUS_VERSION
+	uint16_t size;																// Bytes of struct the writer knows of
+	uint32_t seq;																// Odd while an update is in progress
+	uint32_t pid;																// Process of the test
+	uint32_t phase;																// enum rpiburn_phase_t
+	uint32_t flags;																// enum rpiburn_status_flag_t
+	uint32_t cycle;																// Load cycles started
+	uint32_t workers;															// Workers of the current cycle
+	uint32_t activeWorkers;														// Of them running their consumer
+	uint32_t activeKinds;														// Bit per consumer kind running
+	uint32_t throttled;															// Latest firmware throttled value
+	int32_t milliC;																// SoC temperature
+	uint64_t elapsedMs;															// Since the test started
+	uint64_t cycleMs;															// Since the current load cycle started
+	uint64_t updateNs;															// CLOCK_MONOTONIC of last update
+};
+
+
+//-------------------------------------------------------------
+const struct rpiburn_status_t* rpiburn_status_open(const char *path);
+int rpiburn_status_read(const struct rpiburn_status_t *page,
+	struct rpiburn_status_t *status);
+const char* rpiburn_status_phase_name(const uint32_t phase);
+void rpiburn_status_close(const struct rpiburn_status_t *page);
+
+#endif
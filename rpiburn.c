@@ -0,0 +1,361 @@
+
+/* Library front end of the power load engine. Wraps the
+ * spawn, load and collect cycle in a context with a
+ * start, poll and stop interface, so an application can
+ * run tests in-process and drive its own main loop. The
+ * rpiburn program is built on top of it.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "rpiburn.h"
+#include "misc.h"
+#include "high-load.h"
+#include "hwprobe.h"
+#include "vchiq.h"
+#include "storage.h"
+#include "trace.h"
+#include "freqmon.h"
+
+
+//-------------------------------------------------------------
+#define RB_DFLT_TIMEOUT			10000											// Default max time in ms of a test
+#define RB_DFLT_LOAD_TIME		750												// Default time in ms at full load
+#define RB_MAX_SLEEP			5000											// Max time in ms between polls
+
+
+//-------------------------------------------------------------
+enum rb_state_t {
+	RB_IDLE,
+	RB_RUNNING,																	// Spawning childs or at full load
+	RB_ENDING,																	// Waiting for childs to exit
+	RB_DONE,
+};
+
+struct rpiburn_t {
+	enum rb_state_t state;
+	int timeout;																// Max time in ms of a test
+	int loadTime;																// Time in ms at full load
+	struct timespec hungTimer;													// Guard against hung childs
+	int wasFull;																// True when full load event is sent
+	int wasThrottled;															// True when throttled event is sent
+	struct rpiburn_result_t result;
+	rpiburn_cb_t cb;															// Telemetry callback, or NULL
+	void *user;																	// Argument of callback
+};
+
+
+//-------------------------------------------------------------
+static int nContexts;															// Number of contexts sharing the engine
+static struct rpiburn_t *running;												// Context running a test, or NULL
+
+
+
+//-------------------------------------------------------------
+// Create a context. The engine is initialized with the
+// first one and shared by the rest. Probes the hardware
+// unless the application already has done it.
+struct rpiburn_t* rpiburn_init(void) {
+	struct rpiburn_t *rb;
+	int res;
+
+	rb = calloc(1, sizeof(struct rpiburn_t));
+	if(!rb) return NULL;
+	rb->timeout = RB_DFLT_TIMEOUT;
+	rb->loadTime = RB_DFLT_LOAD_TIME;
+	rb->result.firstThrottle = -1;
+
+	res = 0;
+	if(!nContexts && !hwIdent.nCpus) {											// Standalone use?
+		res = hw_probe(1);
+		if(!res) res = storage_discover(0);
+	}
+	if(!res && !nContexts) res = vchiq_init();
+	if(!res && !nContexts) res = high_load_init();
+	if(res) {
+		if(!nContexts) vchiq_close();
+		free(rb);
+		return NULL;
+	}
+
+	nContexts++;
+
+	return rb;
+}
+
+
+
+//-------------------------------------------------------------
+// Register a function called on telemetry events. It
+// runs in the thread calling rpiburn_poll().
+void rpiburn_set_callback(struct rpiburn_t *rb, rpiburn_cb_t cb, void *user) {
+	rb->cb = cb;
+	rb->user = user;
+}
+
+
+
+//-------------------------------------------------------------
+// Set max time in ms a test may run before it's
+// considered hung. Half of it is allowed for the load
+// phase and half for childs to exit.
+void rpiburn_set_timeout(struct rpiburn_t *rb, const int ms) {
+	rb->timeout = ms;
+}
+
+
+
+//-------------------------------------------------------------
+// Set the time in ms a test runs at full load, when
+// the profile doesn't tell.
+void rpiburn_set_load_time(struct rpiburn_t *rb, const int ms) {
+	if(ms > 0) rb->loadTime = ms;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the time in ms a test runs at full load
+int rpiburn_get_load_time(struct rpiburn_t *rb) {
+	return rb->loadTime;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns a file descriptor which turns readable when
+// the running test needs a poll before <sleepMs> of
+// rpiburn_poll() has passed, for the select() or poll()
+// loop of the application. Never read it, the poll
+// does.
+int rpiburn_fd(struct rpiburn_t *rb) {
+	return high_load_event_fd();
+}
+
+
+
+//-------------------------------------------------------------
+// Send an event to the application, if it wants them
+static void send_event(struct rpiburn_t *rb, const enum rpiburn_event_t event) {
+	if(rb->cb) rb->cb(rb, event, rb->user);
+}
+
+
+
+//-------------------------------------------------------------
+// Start a test with <profile>, or with the current
+// settings when NULL. Returns immediately; the test
+// advances by calls to rpiburn_poll(). Returns -1 with
+// errno EBUSY while any context runs a test.
+int rpiburn_start(struct rpiburn_t *rb, const struct rpiburn_profile_t *profile) {
+	int res;
+
+	if(running) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	res = 0;
+	if(profile && profile->map) res = high_load_set_map(profile->map);
+	if(!res && profile && profile->loadTime > 0) rb->loadTime = profile->loadTime;
+	if(!res && profile && profile->duty > 0) res = high_load_set_duty(-1, profile->duty);
+	if(res) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	vchiq_new_cycle();
+	trace_event(TR_CYCLE_BEGIN, 0);
+	freqmon_set_phase(FREQ_PH_SPAWN);
+	high_load_clear_events();
+	res = high_load_start(rb->loadTime);
+
+	memset(&rb->result, 0, sizeof(rb->result));
+	rb->result.firstThrottle = -1;
+	rb->result.isRunning = !res;
+	rb->result.status = res;
+	rb->wasFull = 0;
+	rb->wasThrottled = 0;
+	rb->state = res ? RB_DONE : RB_RUNNING;
+	if(!res) running = rb;
+	timer_set(&rb->hungTimer, rb->timeout / 2);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Advance the test. Call again within <sleepMs>, if not
+// NULL, or sooner when rpiburn_fd() turns readable.
+// Returns 1 while the test is running, 0 when done and
+// -1 on error.
+int rpiburn_poll(struct rpiburn_t *rb, int *sleepMs) {
+	int res, ms;
+
+	if(rb->state == RB_IDLE || rb->state == RB_DONE) {
+		return (rb->result.status ? -1 : 0);
+	}
+
+	high_load_clear_events();
+	ms = RB_MAX_SLEEP;
+	res = 0;
+
+	if(rb->state == RB_RUNNING) {
+		/* Use a timer so we don't hang here
+		 * forever in case of a bug. */
+		if(!res && timer_timeout(&rb->hungTimer)) res = -1;
+		if(!res) sleep_limit(&ms, timer_remaining(&rb->hungTimer));
+
+		if(!res) res = vchiq_manager(&ms);
+		if(hasCycleBrownOut()) high_load_stop();
+		if(isCycleHeated()) high_load_stop();
+		if(!res) res = high_load_manager(&ms);
+
+		if(high_load_is_full() && !rb->wasFull) {
+			rb->wasFull = 1;
+			send_event(rb, RPIBURN_EV_FULL_LOAD);
+		}
+
+		rb->result.brownOut = hasCycleBrownOut();
+		rb->result.heated = isCycleHeated();
+		rb->result.firstThrottle = vchiq_first_throttle();
+		if((rb->result.brownOut || rb->result.heated) && !rb->wasThrottled) {
+			rb->wasThrottled = 1;
+			send_event(rb, RPIBURN_EV_THROTTLED);
+		}
+
+		/* When time to exit, wait for all childrens to die.
+		 * Ignore errors, but use a timer so we don't
+		 * hang here forever in case of a bug. */
+		if(res || high_load_is_stopping()) {
+			rb->result.status = res;
+			rb->state = RB_ENDING;
+			freqmon_set_phase(FREQ_PH_ENDING);
+			high_load_stop();
+			timer_set(&rb->hungTimer, rb->timeout / 2);
+			sleep_limit(&ms, 0);
+		}
+	}
+	else if(isAnyChildAlive() && !timer_timeout(&rb->hungTimer)) {
+		high_load_manager(&ms);
+		sleep_limit(&ms, timer_remaining(&rb->hungTimer));
+	}
+	else {
+		kill_remaining_childs();
+		trace_event(TR_CYCLE_END, rb->result.status);
+		freqmon_set_phase(FREQ_PH_IDLE);
+		rb->result.isRunning = 0;
+		rb->state = RB_DONE;
+		running = NULL;
+		send_event(rb, RPIBURN_EV_DONE);
+	}
+
+	if(sleepMs) *sleepMs = ms;
+
+	if(rb->state == RB_DONE) return (rb->result.status ? -1 : 0);
+	return 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Ask the test to stop. Childs are collected by the
+// following polls.
+void rpiburn_stop(struct rpiburn_t *rb) {
+	if(rb->state == RB_RUNNING) high_load_stop();
+}
+
+
+
+//-------------------------------------------------------------
+// Set the duty cycle in percent of one worker, or of
+// all when <worker> is negative. Takes effect at once
+// in a running test, if any duty cycle was set before
+// the test started. The application must install
+// rpiburn_duty_signal() as SA_SIGINFO handler of
+// SIGUSR1 first, else -1 is returned.
+int rpiburn_set_duty(struct rpiburn_t *rb, const int worker, const int duty) {
+	return high_load_set_duty(worker, duty);
+}
+
+
+
+//-------------------------------------------------------------
+// Pause or resume one worker of the running test, or
+// all when <worker> is negative. Paused workers idle
+// but still count as started.
+void rpiburn_pause(struct rpiburn_t *rb, const int worker, const int isPaused) {
+	high_load_pause(worker, isPaused);
+}
+
+
+
+//-------------------------------------------------------------
+// Get the result so far, or the final one when the test
+// is done. The brownout and throttle record of the whole
+// process comes along.
+void rpiburn_result(struct rpiburn_t *rb, struct rpiburn_result_t *result) {
+	*result = rb->result;
+	result->anyBrownOut = hasBrownOut();
+	result->anyHeated = isHeated();
+}
+
+
+
+//-------------------------------------------------------------
+// Poll the test until it's done, sleeping in between
+static int wait_done(struct rpiburn_t *rb) {
+	struct pollfd fds;
+	int res, sleepMs;
+
+	fds.fd = rpiburn_fd(rb);
+	fds.events = POLLIN;
+	while((res = rpiburn_poll(rb, &sleepMs)) > 0) poll(&fds, 1, sleepMs);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Run a complete test, blocking until done
+int rpiburn_run(struct rpiburn_t *rb, const struct rpiburn_profile_t *profile,
+		struct rpiburn_result_t *result) {
+	int res;
+
+	res = rpiburn_start(rb, profile);
+	if(!res) res = wait_done(rb);
+	if(result) rpiburn_result(rb, result);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Stop any test of the context and release it. The
+// last one also releases the workers of the engine and
+// the firmware connection.
+void rpiburn_free(struct rpiburn_t *rb) {
+	if(!rb) return;
+
+	rpiburn_stop(rb);
+	wait_done(rb);
+	if(--nContexts == 0) {
+		high_load_close();
+		vchiq_close();
+	}
+
+	free(rb);
+}
@@ -0,0 +1,92 @@
+
+/* Embeddable API of the rpiburn power load engine.
+ * Build with "make lib" and link with librpiburn.a or
+ * librpiburn.so plus -lpthread -lrt.
+ *
+ * The engine owns the worker threads of the process, so
+ * several contexts may exist but only one of them can
+ * run a test at a time. The engine prints nothing by
+ * itself, see rpiburn_set_log().
+ *
+ * The engine state is global to the process and shared
+ * by all contexts: the consumer map, duty cycles and
+ * random seed, the log callback and the brownout and
+ * throttle record of the firmware. The workers and the
+ * firmware connection are released with the last
+ * context, the rest lives as long as the process.
+ * Typical use:
+ *
+ *   struct rpiburn_t *rb = rpiburn_init();
+ *   struct rpiburn_result_t res;
+ *   rpiburn_run(rb, NULL, &res);
+ *   rpiburn_free(rb);
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+#ifndef RPIBURN_H
+#define RPIBURN_H
+
+#include <signal.h>
+
+
+//-------------------------------------------------------------
+struct rpiburn_t;																// Opaque context
+
+struct rpiburn_profile_t {														// What load to apply
+	const char *map;															// Power consumer map, or NULL for current
+	int loadTime;																// Time in ms at full load, or 0 for current
+	int duty;																	// Percent of time consumers run, or 0 for current
+};
+
+struct rpiburn_result_t {
+	int isRunning;																// True until the test has completed
+	int brownOut;																// True on PSU under-voltage
+	int heated;																	// True when frequency capped or throttled
+	int firstThrottle;															// Time in ms from start to first throttle event, or -1
+	int anyBrownOut;															// True on PSU under-voltage in any test of the process
+	int anyHeated;																// True when throttled in any test of the process
+	int status;																	// Zero, or -1 on error
+};
+
+enum rpiburn_event_t {															// Telemetry events of callback
+	RPIBURN_EV_FULL_LOAD,														// All consumers are running
+	RPIBURN_EV_THROTTLED,														// Brownout or throttling detected
+	RPIBURN_EV_DONE,															// Test completed, result is final
+};
+
+typedef void (*rpiburn_cb_t)(struct rpiburn_t *rb, const enum rpiburn_event_t event,
+	void *user);
+
+enum rpiburn_log_t {															// Level of log messages
+	RPIBURN_LOG_INFO,
+	RPIBURN_LOG_ERROR,
+};
+
+typedef void (*rpiburn_log_cb_t)(const enum rpiburn_log_t level, const char *text,
+	void *user);
+
+
+//-------------------------------------------------------------
+void rpiburn_set_log(rpiburn_log_cb_t cb, void *user);
+void rpiburn_log_stdio(const enum rpiburn_log_t level, const char *text, void *user);
+struct rpiburn_t* rpiburn_init(void);
+void rpiburn_set_callback(struct rpiburn_t *rb, rpiburn_cb_t cb, void *user);
+void rpiburn_set_timeout(struct rpiburn_t *rb, const int ms);
+void rpiburn_set_load_time(struct rpiburn_t *rb, const int ms);
+int rpiburn_get_load_time(struct rpiburn_t *rb);
+int rpiburn_fd(struct rpiburn_t *rb);
+int rpiburn_start(struct rpiburn_t *rb, const struct rpiburn_profile_t *profile);
+int rpiburn_poll(struct rpiburn_t *rb, int *sleepMs);
+void rpiburn_stop(struct rpiburn_t *rb);
+int rpiburn_set_duty(struct rpiburn_t *rb, const int worker, const int duty);
+void rpiburn_duty_signal(int sig, siginfo_t *info, void *ctx);
+void rpiburn_pause(struct rpiburn_t *rb, const int worker, const int isPaused);
+void rpiburn_result(struct rpiburn_t *rb, struct rpiburn_result_t *result);
+int rpiburn_run(struct rpiburn_t *rb, const struct rpiburn_profile_t *profile,
+	struct rpiburn_result_t *result);
+void rpiburn_free(struct rpiburn_t *rb);
+
+#endif
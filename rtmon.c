@@ -0,0 +1,170 @@
+
+/* Real-time monitor. The parent thread polls the firmware
+ * for brownouts and must not be starved by the load it
+ * creates. Optionally run it SCHED_FIFO with locked
+ * memory on a core reserved for it, and measure how
+ * late it wakes up during full load, in the same way as
+ * cyclictest does.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "rtmon.h"
+#include "hwprobe.h"
+#include "misc.h"
+
+
+//-------------------------------------------------------------
+#define RT_MONITOR_PRIO		80													// SCHED_FIFO priority of monitor, as cyclictest default
+#define JITTER_BIN_US		10													// Width of a histogram bin in us
+#define JITTER_BINS			100													// Number of bins, later samples go in overflow
+
+
+//-------------------------------------------------------------
+static int isEnabled;															// True when jitter is measured
+static int isArmed;																// True when a wakeup is scheduled
+static struct timespec wakeAt;													// When the monitor was scheduled to wake up
+static uint32_t hist[JITTER_BINS + 1];											// Last bin is overflow
+static uint32_t nSamples;
+static int64_t minLat, maxLat, sumLat;											// Latencies in ns
+
+
+
+//-------------------------------------------------------------
+// Make the calling thread a real-time monitor running
+// SCHED_FIFO on the core <cpu>, with all current and
+// future memory locked to avoid page faults.
+int rtmon_init(const int cpu) {
+	struct sched_param schedParam;
+	cpu_set_t cpuMask;
+	int res;
+
+	if(cpu < 0 || cpu >= HW_MAX_CPUS || !hwIdent.cpu[cpu].online) {
+		fprintf(stderr, "Error, monitor core %d is not online\n", cpu);
+		return -1;
+	}
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		perror("Error locking monitor memory");
+		return -1;
+	}
+
+	CPU_ZERO(&cpuMask);
+	CPU_SET(cpu, &cpuMask);
+	res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuMask);
+	if(res) {
+		fprintf(stderr, "Error setting monitor affinity: %s\n", strerror(res));
+		return -1;
+	}
+
+	schedParam.sched_priority = RT_MONITOR_PRIO;
+	res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &schedParam);
+	if(res) {
+		fprintf(stderr, "Error setting monitor real-time class: %s\n",
+			strerror(res));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Start measuring monitor wakeup latencies
+void jitter_init(void) {
+	memset(hist, 0, sizeof(hist));
+	nSamples = 0;
+	minLat = INT64_MAX;
+	maxLat = 0;
+	sumLat = 0;
+	isEnabled = 1;
+}
+
+
+
+//-------------------------------------------------------------
+// The monitor is about to sleep for <timeout> ms. Save
+// when it is supposed to wake up.
+void jitter_arm(const int timeout) {
+	if(!isEnabled) return;
+
+	clock_gettime(CLOCK_MONOTONIC, &wakeAt);
+	wakeAt.tv_sec += timeout / 1000;
+	wakeAt.tv_nsec += (timeout % 1000) * 1000000L;
+	if(wakeAt.tv_nsec >= 1000000000L) {
+		wakeAt.tv_sec++;
+		wakeAt.tv_nsec -= 1000000000L;
+	}
+	isArmed = 1;
+}
+
+
+
+//-------------------------------------------------------------
+// The monitor woke up by timeout. Add how late it was
+// compared to when it was scheduled to the histogram.
+void jitter_sample(void) {
+	struct timespec wokeAt;
+	int64_t lat;
+	int bin;
+
+	if(!isEnabled || !isArmed) return;
+	isArmed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &wokeAt);
+	lat = diffntime(&wakeAt, &wokeAt);
+	if(lat < 0) lat = 0;
+
+	bin = lat / (JITTER_BIN_US * 1000LL);
+	if(bin > JITTER_BINS) bin = JITTER_BINS;
+	hist[bin]++;
+
+	nSamples++;
+	sumLat += lat;
+	if(lat < minLat) minLat = lat;
+	if(lat > maxLat) maxLat = lat;
+}
+
+
+
+//-------------------------------------------------------------
+// Print statistics and histogram of wakeup latencies
+void jitter_report(void) {
+	int i;
+
+	if(!isEnabled) return;
+
+	if(nSamples == 0) {
+		printf("Monitor jitter: no samples during full load\n");
+		return;
+	}
+
+	printf("Monitor jitter during full load: %u samples, "
+		"min %lld us, avg %lld us, max %lld us\n", nSamples,
+		(long long) minLat / 1000, (long long) sumLat / nSamples / 1000,
+		(long long) maxLat / 1000);
+
+	for(i = 0; i <= JITTER_BINS; i++) {
+		if(!hist[i]) continue;
+		if(i < JITTER_BINS) {
+			printf("  %5d-%-5d us %8u\n", i * JITTER_BIN_US,
+				(i + 1) * JITTER_BIN_US - 1, hist[i]);
+		}
+		else {
+			printf("  %5d+      us %8u\n", i * JITTER_BIN_US, hist[i]);
+		}
+	}
+}
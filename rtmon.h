@@ -0,0 +1,13 @@
+
+#ifndef RTMON_H
+#define RTMON_H
+
+
+//-------------------------------------------------------------
+int rtmon_init(const int cpu);
+void jitter_init(void);
+void jitter_arm(const int timeout);
+void jitter_sample(void);
+void jitter_report(void);
+
+#endif
@@ -0,0 +1,272 @@
+
+/* Search for the power consumer map which makes the
+ * board draw the most current. Mixing processor, memory
+ * and I/O consumers across cores can stress other rails
+ * and power domains than a uniform load does. Also
+ * search for the generated processor consumer loop
+ * with the highest power, by evolving its instructions.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "search.h"
+#include "main.h"
+#include "misc.h"
+#include "high-load.h"
+#include "hwprobe.h"
+#include "vchiq.h"
+#include "storage.h"
+#include "jit.h"
+#include "sensor.h"
+
+
+//-------------------------------------------------------------
+#define SEARCH_COOL_MARGIN		1000											// Accepted temperature rise in mC above start before next candidate
+#define SEARCH_COOL_TIMEOUT		30000											// Max time in ms we wait for the board to cool down
+#define SEARCH_MAP_LEN			(HW_MAX_CPUS * 8 + 64)
+#define SEARCH_POPULATION		8												// Generated loops in each generation
+#define SEARCH_GENERATIONS		12												// Max number of generations
+#define SEARCH_MIN_TEMP_LOAD	5000											// Min load time in ms when scored by temperature
+
+
+
+//-------------------------------------------------------------
+// Build a map with <nCpu> processor consumers, <nMem>
+// memory consumers and I/O consumers on remaining cores.
+// The extra I/O childs of the default map are kept.
+static void build_map(char *map, const int nCpu, const int nMem) {
+	int i, len;
+
+	map[0] = 0;
+	for(i = 0, len = 0; i < high_load_cores() + storage_n_devs(); i++) {
+		len += snprintf(map + len, SEARCH_MAP_LEN - len, "%s%s", i ? "," : "",
+			i < nCpu ? "cpu" : (i < nCpu + nMem ? "mem" : "io"));
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Run one load window per candidate map and score it by
+// the measured power when there is a power sensor, else
+// by how fast the SoC heats up. The temperature proxy
+// needs a few seconds of load to rise above the sensor
+// noise, so the windows are stretched while searching.
+// A brownout beats any score. Cores are assumed to be
+// equal so only the mix is searched, not the order.
+// Prints the winning map for later reuse.
+int search_consumer_map(void) {
+	char map[SEARCH_MAP_LEN], best[SEARCH_MAP_LEN];
+	int nCpu, nMem, res, stop, hasPower, hasTemp, baseTemp, temp[2];
+	int loadTime, milliW;
+	int64_t start, score, bestScore, ms;
+	const char *unit;
+
+	res = 0;
+	stop = 0;
+	best[0] = 0;
+	bestScore = INT64_MIN;
+	hasPower = sensor_is_enabled();
+	hasTemp = !read_soc_temp(&baseTemp);
+	if(!hasTemp) baseTemp = 0;
+
+	if(!hasPower && !hasTemp) {
+		fprintf(stderr, "Error, search needs a power sensor or a SoC "
+			"temperature sensor\n");
+		return -1;
+	}
+
+	loadTime = run_load_time();
+	if(!hasPower && loadTime < SEARCH_MIN_TEMP_LOAD) {
+		run_set_load_time(SEARCH_MIN_TEMP_LOAD);
+	}
+
+	printf("Searching for the power consumer map with highest load, "
+		"%d ms each...\n", run_load_time());
+
+	for(nCpu = high_load_cores(); nCpu >= 0 && !res && !stop; nCpu--) {
+		for(nMem = high_load_cores() - nCpu; nMem >= (storage_n_devs() ? 0 :
+				high_load_cores() - nCpu) && !res && !stop; nMem--) {
+			build_map(map, nCpu, nMem);
+			res = high_load_set_map(map);
+			if(!res && hasTemp) res = run_cooldown(baseTemp +
+				SEARCH_COOL_MARGIN, SEARCH_COOL_TIMEOUT);
+			stop = isExitRequested();
+			if(res || stop) break;
+
+			if(!hasTemp || read_soc_temp(&temp[0])) temp[0] = baseTemp;
+			start = mono_ns();
+			res = run_cycle();
+			if(!hasTemp || read_soc_temp(&temp[1])) temp[1] = temp[0];
+
+			ms = (mono_ns() - start) / 1000000LL;
+			if(hasPower && !sensor_run_power(&milliW)) {
+				score = milliW;
+				unit = "mW";
+			}
+			else {
+				score = (temp[1] - temp[0]) * 1000LL / (ms > 0 ? ms : 1);		// Milli degrees per second
+				unit = "mC/s";
+			}
+			if(hasBrownOut()) score = INT64_MAX;
+
+			printf("  %-40s %8lld %s%s\n", map, (long long) score, unit,
+				hasBrownOut() ? " brownout" : "");
+			if(score > bestScore) {
+				bestScore = score;
+				strcpy(best, map);
+			}
+
+			stop = isExitRequested() || hasBrownOut() || isHeated();
+		}
+	}
+
+	run_set_load_time(loadTime);
+	if(best[0]) {
+		printf("Winning map: -m %s\n", best);
+		high_load_set_map(best);
+	}
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Run one short load window with generated loop <loop>
+// on all cores and score it. The score is the measured
+// power when there is a power sensor, else the SoC
+// temperature slope when there is a temperature sensor,
+// else the instruction rate weighted by the energy of
+// the mix. A brownout beats any score.
+static int score_loop(const struct jit_loop_t *loop, const int hasTemp,
+		const int baseTemp, int64_t *score) {
+	uint64_t instr, cycles;
+	int res, temp[2], milliW;
+	int64_t start, ms;
+	const char *unit;
+
+	jit_set_loop(loop);
+	res = run_cooldown(baseTemp + SEARCH_COOL_MARGIN, SEARCH_COOL_TIMEOUT);
+	if(res || isExitRequested()) return res;
+
+	jit_take_counters(&instr, &cycles);
+	if(!hasTemp || read_soc_temp(&temp[0])) temp[0] = baseTemp;
+	start = mono_ns();
+	res = run_cycle();
+	if(!hasTemp || read_soc_temp(&temp[1])) temp[1] = temp[0];
+	if(res) return res;
+
+	ms = (mono_ns() - start) / 1000000LL;
+	if(ms < 1) ms = 1;
+	if(!sensor_run_power(&milliW)) {
+		*score = milliW;
+		unit = "mW";
+	}
+	else if(hasTemp) {
+		*score = (temp[1] - temp[0]) * 1000LL / ms;								// Milli degrees per second
+		unit = "mC/s";
+	}
+	else if(!jit_take_counters(&instr, &cycles) && instr) {
+		*score = instr * jit_weight(loop) / ms;									// Weighted instructions per ms
+		unit = "";
+	}
+	else {
+		fprintf(stderr, "Error, loop search needs a SoC temperature sensor "
+			"or performance counters\n");
+		return -1;
+	}
+	if(hasBrownOut()) *score = INT64_MAX;
+
+	printf("  %2d instructions, weight %4.2f %12lld %s%s\n", loop->nOps,
+		jit_weight(loop), (long long) *score, unit,
+		hasBrownOut() ? " brownout" : "");
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Evolve the generated consumer loop with a genetic
+// search. Each generation keeps the best half and
+// replaces the rest with mutated crossovers of it. The
+// current loop seeds the first generation. The winner
+// is saved to <fileName> for later runs.
+int search_jit_loop(const char *fileName) {
+	struct jit_loop_t pop[SEARCH_POPULATION], best, tmp;
+	int64_t score[SEARCH_POPULATION], bestScore, t;
+	char map[SEARCH_MAP_LEN];
+	int i, j, gen, len, res, stop, hasTemp, baseTemp;
+	unsigned int seed;
+
+	res = 0;
+	stop = 0;
+	bestScore = INT64_MIN;
+	seed = high_load_get_seed();
+	hasTemp = !read_soc_temp(&baseTemp);
+	if(!hasTemp) baseTemp = 0;
+
+	for(i = 0, len = 0; i < high_load_cores(); i++) {
+		len += snprintf(map + len, sizeof(map) - len, "%sjit", i ? "," : "");
+	}
+	res = high_load_set_map(map);
+	if(res) return res;
+
+	jit_get_loop(&pop[0]);
+	for(i = 1; i < SEARCH_POPULATION; i++) jit_random(&pop[i], &seed);
+	for(i = 0; i < SEARCH_POPULATION; i++) score[i] = INT64_MIN;				// Not scored yet
+
+	printf("Searching for the %s consumer loop with highest load...\n", jit_isa());
+
+	for(gen = 0; gen < SEARCH_GENERATIONS && !res && !stop; gen++) {
+		printf("Generation %d\n", gen + 1);
+		for(i = 0; i < SEARCH_POPULATION && !res && !stop; i++) {
+			if(score[i] != INT64_MIN) continue;
+			res = score_loop(&pop[i], hasTemp, baseTemp, &score[i]);
+			if(!res && score[i] > bestScore) {
+				bestScore = score[i];
+				best = pop[i];
+			}
+			stop = isExitRequested() || hasBrownOut() || isHeated();
+		}
+		if(res || stop) break;
+
+		// Best first
+		for(i = 1; i < SEARCH_POPULATION; i++) {
+			for(j = i; j > 0 && score[j] > score[j - 1]; j--) {
+				tmp = pop[j];
+				pop[j] = pop[j - 1];
+				pop[j - 1] = tmp;
+				t = score[j];
+				score[j] = score[j - 1];
+				score[j - 1] = t;
+			}
+		}
+
+		for(i = SEARCH_POPULATION / 2; i < SEARCH_POPULATION; i++) {
+			jit_crossover(&pop[i], &pop[rand_r(&seed) % (SEARCH_POPULATION / 2)],
+				&pop[rand_r(&seed) % (SEARCH_POPULATION / 2)], &seed);
+			jit_mutate(&pop[i], &seed);
+			score[i] = INT64_MIN;
+		}
+	}
+
+	if(bestScore != INT64_MIN) {
+		jit_set_loop(&best);
+		if(!jit_save(fileName, bestScore)) {
+			printf("Winning loop saved, use: -m jit --jit-loop %s\n", fileName);
+		}
+	}
+
+	return res;
+}
@@ -0,0 +1,10 @@
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+
+//-------------------------------------------------------------
+int search_consumer_map(void);
+int search_jit_loop(const char *fileName);
+
+#endif
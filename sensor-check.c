@@ -0,0 +1,99 @@
+/* Check of the serial power meter backend without a
+ * meter. A pty stands in for the USB serial port; we
+ * write meter lines to the master side, in pieces and
+ * with some garbage in between, and compare what the
+ * sensor made of them. Run by "make sensor-check".
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pty.h>
+
+#include "sensor.h"
+#include "misc.h"
+
+
+//-------------------------------------------------------------
+#define CHECK_SETTLE			300												// Time in ms for the sampler to read all lines
+#define CHECK_EXPECT_MW			3000											// Average of the valid lines below
+
+
+//-------------------------------------------------------------
+static const char *lines[] = {													// Written in this order
+	"5.00V 0.800A\r\n",															// 4000 mW from voltage times current
+	"garbage without any reading\n",
+	"P=2000mW\n",
+	"3.0",																		// 3000 mW, split over two writes
+	"00W\n",
+	"4.1V\n",																	// No power nor current, ignored
+};
+
+
+
+//-------------------------------------------------------------
+// Write all of <str> to <fd>
+static int write_str(const int fd, const char *str) {
+	int len, res;
+
+	for(len = strlen(str); len > 0; len -= res, str += res) {
+		res = write(fd, str, len);
+		if(res <= 0) {
+			perror("Error writing to pty");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+int main(int argc, char *argv[]) {
+	char name[64], spec[80];
+	int master, slave, res, milliW, i;
+
+	rpiburn_set_log(rpiburn_log_stdio, NULL);
+	if(openpty(&master, &slave, name, NULL, NULL) == -1) {
+		perror("Error opening pty");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(spec, sizeof(spec), "serial:%s", name);
+	res = sensor_add(spec);
+	if(!res) res = sensor_start(-1);
+	if(!res) sensor_run_begin();
+
+	for(i = 0; !res && i < (int) (sizeof(lines) / sizeof(lines[0])); i++) {
+		res = write_str(master, lines[i]);
+		usleep(20000);															// Let the sampler see the pieces apart
+	}
+	usleep(CHECK_SETTLE * 1000);
+
+	if(!res) sensor_run_end();
+	if(!res && sensor_run_power(&milliW)) {
+		fprintf(stderr, "Error, no power measured from %s\n", name);
+		res = -1;
+	}
+	else if(!res && milliW != CHECK_EXPECT_MW) {
+		fprintf(stderr, "Error, measured %d mW from %s, expected %d mW\n",
+			milliW, name, CHECK_EXPECT_MW);
+		res = -1;
+	}
+
+	sensor_close();
+	sensor_report();
+	close(master);
+	close(slave);
+
+	printf("Serial meter check %s\n", res ? "FAILED" : "passed");
+
+	return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
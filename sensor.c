@@ -0,0 +1,665 @@
+
+/* Power sensors. The firmware only tells that the supply
+ * voltage has been low, not how much the board draws.
+ * Here power is measured by one or more backends; RAPL
+ * energy counters of Intel and AMD processors, hwmon
+ * power or current monitors such as the INA2xx chips,
+ * and USB power meters printing readings as text on a
+ * serial port. Each sensor samples in a thread of its
+ * own into a lock-free ring, which the monitor drains
+ * without ever blocking the sampler. Average and peak
+ * power is reported for every load cycle.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "sensor.h"
+#include "misc.h"
+
+
+//-------------------------------------------------------------
+#define SENSOR_MAX				4												// Max number of sensors
+#define SENSOR_MAX_FILES		8												// Max sysfs files per sensor, such as RAPL packages
+#define SENSOR_RING_LEN			4096											// Samples in each ring, power of two
+#define SENSOR_RATE				100												// Sample rate in Hz of polled sensors
+#define SENSOR_NICE				10												// Priority of sampler threads
+#define SENSOR_LINE_LEN			128												// Max length of a meter text line
+#define SENSOR_DFLT_BAUD		B115200
+
+
+//-------------------------------------------------------------
+enum sensor_kind_t {
+	SENSOR_RAPL,
+	SENSOR_HWMON,
+	SENSOR_SERIAL,
+};
+
+struct sensor_sample_t {
+	int64_t ns;																	// Monotonic time of sample
+	int32_t milliW;																// Power, or -1 when unknown
+	int32_t milliA;																// Current, or -1 when unknown
+};
+
+struct sensor_stat_t {
+	uint32_t n;																	// Samples with power
+	uint32_t nCurr;																// Samples with current
+	double sumMilliW;
+	double sumMilliA;
+	int32_t peakMilliW;
+	int32_t peakMilliA;
+};
+
+struct sensor_t {
+	enum sensor_kind_t kind;
+	char spec[128];																// As given by user
+	char label[64];																// Name of what we measure
+	int fds[SENSOR_MAX_FILES];													// Energy, power, current or voltage files
+	int nFds;
+	uint64_t maxEnergy[SENSOR_MAX_FILES];										// RAPL counter wrap, in uJ
+	uint64_t lastEnergy[SENSOR_MAX_FILES];
+	int hasEnergy;																// True when lastEnergy is read
+	int isCurrent;																// True when hwmon measures current, not power
+	int ttyFd;																	// Serial meter, or -1
+	speed_t baud;
+	pthread_t thread;
+	int isRunning;																// True when sampler thread exists
+
+	struct sensor_sample_t ring[SENSOR_RING_LEN];
+	uint32_t head;																// Written by the sampler only
+	uint32_t tail;																// Written by the monitor only
+	uint32_t nLost;																// Samples dropped on full ring
+
+	struct sensor_stat_t run;													// Current load cycle
+	struct sensor_stat_t tot;													// All load cycles
+};
+
+
+//-------------------------------------------------------------
+static struct sensor_t *sensors[SENSOR_MAX];
+static int nSensors;
+static volatile int isStopping;
+static int lastRunMilliW = -1;													// Average of the first sensor in last cycle
+
+
+
+//-------------------------------------------------------------
+// Add a sensor from a user specification; "rapl",
+// "hwmon", "hwmon:<chip name>" or "serial:<tty>[:<baud>]".
+// The sensor is opened by sensor_start().
+int sensor_add(const char *spec) {
+	static const struct {
+		long baud;
+		speed_t speed;
+	} bauds[] = {
+		{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+		{ 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+	};
+	struct sensor_t *s;
+	char *p;
+	long baud;
+	int i;
+
+	if(nSensors == SENSOR_MAX) {
+		fprintf(stderr, "Error, max %d sensors\n", SENSOR_MAX);
+		return -1;
+	}
+
+	s = calloc(1, sizeof(struct sensor_t));
+	if(!s) {
+		perror("Error allocating sensor");
+		return -1;
+	}
+	snprintf(s->spec, sizeof(s->spec), "%s", spec);
+	s->ttyFd = -1;
+	s->baud = SENSOR_DFLT_BAUD;
+
+	if(!strcmp(spec, "rapl")) {
+		s->kind = SENSOR_RAPL;
+	}
+	else if(!strcmp(spec, "hwmon") || !strncmp(spec, "hwmon:", 6)) {
+		s->kind = SENSOR_HWMON;
+	}
+	else if(!strncmp(spec, "serial:", 7) && spec[7]) {
+		s->kind = SENSOR_SERIAL;
+		p = strchr(s->spec + 7, ':');											// Optional baud rate
+		if(p) {
+			*p++ = 0;
+			baud = strtol(p, NULL, 10);
+			for(i = 0; i < (int) (sizeof(bauds) / sizeof(bauds[0])) &&
+				bauds[i].baud != baud; i++);
+			if(i == (int) (sizeof(bauds) / sizeof(bauds[0]))) {
+				fprintf(stderr, "Error, unsupported baud rate %s\n", p);
+				free(s);
+				return -1;
+			}
+			s->baud = bauds[i].speed;
+		}
+	}
+	else {
+		fprintf(stderr, "Error, unknown sensor %s\n", spec);
+		free(s);
+		return -1;
+	}
+
+	sensors[nSensors++] = s;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Read an unsigned decimal value from an open sysfs file.
+// Returns -1 on failure.
+static int read_fd_u64(const int fd, uint64_t *val) {
+	char buf[32], *end;
+	int len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0) return -1;
+	buf[len] = 0;
+	*val = strtoull(buf, &end, 10);
+
+	return end == buf ? -1 : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Open the package energy counters of the RAPL power
+// capping framework. Sub-zones (core, uncore, dram) are
+// part of their package and not added.
+static int open_rapl(struct sensor_t *s) {
+	char path[256];
+	int i, fd, maxFd;
+
+	for(i = 0; s->nFds < SENSOR_MAX_FILES; i++) {
+		sys_path(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/energy_uj", i);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd == -1) break;
+
+		sys_path(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/max_energy_range_uj", i);
+		maxFd = open(path, O_RDONLY | O_CLOEXEC);
+		if(maxFd == -1 || read_fd_u64(maxFd, &s->maxEnergy[s->nFds])) {
+			s->maxEnergy[s->nFds] = UINT32_MAX;									// Older kernels wrap at 32 bits
+		}
+		if(maxFd >= 0) close(maxFd);
+		s->fds[s->nFds++] = fd;
+	}
+
+	if(!s->nFds) {
+		fprintf(stderr, "Error, no RAPL energy counters\n");
+		return -1;
+	}
+	snprintf(s->label, sizeof(s->label), "RAPL, %d package%s", s->nFds,
+		s->nFds > 1 ? "s" : "");
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Find a hwmon chip, by name if given, with a power or
+// current input. Power in uW is used when present, else
+// current in mA and bus voltage in mV.
+static int open_hwmon(struct sensor_t *s) {
+	char path[256], name[32];
+	const char *want;
+	int i, fd;
+
+	want = s->spec[5] == ':' ? s->spec + 6 : NULL;
+
+	for(i = 0; i < 64 && !s->nFds; i++) {
+		sys_path(path, sizeof(path), "/sys/class/hwmon/hwmon%d/name", i);
+		if(read_file_str(path, name, sizeof(name)) <= 0) continue;
+		name[strcspn(name, "\n")] = 0;
+		if(want && strcmp(name, want)) continue;
+
+		sys_path(path, sizeof(path), "/sys/class/hwmon/hwmon%d/power1_input", i);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd >= 0) {
+			s->fds[s->nFds++] = fd;
+			snprintf(s->label, sizeof(s->label), "hwmon %s power", name);
+			break;
+		}
+
+		sys_path(path, sizeof(path), "/sys/class/hwmon/hwmon%d/curr1_input", i);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd == -1) continue;
+		s->fds[s->nFds++] = fd;
+		sys_path(path, sizeof(path), "/sys/class/hwmon/hwmon%d/in1_input", i);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd >= 0) s->fds[s->nFds++] = fd;
+		s->isCurrent = 1;
+		snprintf(s->label, sizeof(s->label), "hwmon %s current", name);
+	}
+
+	if(!s->nFds) {
+		fprintf(stderr, "Error, no hwmon power or current sensor%s%s\n",
+			want ? " named " : "", want ? want : "");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Open the serial port of a USB power meter, raw 8N1.
+// Any tty works, also a pty as in sensor-check.c.
+static int open_serial(struct sensor_t *s) {
+	struct termios tio;
+
+	s->ttyFd = open(s->spec + 7, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if(s->ttyFd == -1) {
+		perror("Error opening power meter tty");
+		return -1;
+	}
+
+	if(!tcgetattr(s->ttyFd, &tio)) {
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, s->baud);
+		cfsetospeed(&tio, s->baud);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tcsetattr(s->ttyFd, TCSANOW, &tio);
+	}
+	snprintf(s->label, sizeof(s->label), "meter %s", s->spec + 7);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Store a sample in the ring, or drop it when full.
+// Runs in the sampler thread only.
+static void ring_push(struct sensor_t *s, const struct sensor_sample_t *smp) {
+	uint32_t tail;
+
+	tail = __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+	if(s->head - tail >= SENSOR_RING_LEN) {
+		s->nLost++;
+		return;
+	}
+
+	s->ring[s->head & (SENSOR_RING_LEN - 1)] = *smp;
+	__atomic_store_n(&s->head, s->head + 1, __ATOMIC_RELEASE);
+}
+
+
+
+//-------------------------------------------------------------
+// Sample a polled sensor. RAPL power is the energy
+// difference since the previous sample. Returns -1 when
+// there is no power reading (yet).
+static int sample_polled(struct sensor_t *s, const int64_t dt, struct sensor_sample_t *smp) {
+	uint64_t val, sum, mv;
+	int i, hasLast;
+
+	smp->milliW = -1;
+	smp->milliA = -1;
+
+	if(s->kind == SENSOR_RAPL) {
+		hasLast = s->hasEnergy;
+		for(i = 0, sum = 0; i < s->nFds; i++) {
+			if(read_fd_u64(s->fds[i], &val)) return -1;
+			if(val < s->lastEnergy[i]) sum += val + s->maxEnergy[i] - s->lastEnergy[i];	// Wrapped
+			else sum += val - s->lastEnergy[i];
+			s->lastEnergy[i] = val;
+		}
+		s->hasEnergy = 1;
+		if(!hasLast || dt <= 0) return -1;
+		smp->milliW = sum * 1000000LL / dt;										// uJ per ns to mW
+	}
+	else if(!s->isCurrent) {
+		if(read_fd_u64(s->fds[0], &val)) return -1;
+		smp->milliW = val / 1000;
+	}
+	else {
+		if(read_fd_u64(s->fds[0], &val)) return -1;
+		smp->milliA = val;
+		if(s->nFds > 1 && !read_fd_u64(s->fds[1], &mv)) smp->milliW = val * mv / 1000;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Parse a text line of a power meter. Readings are a
+// number followed by a unit; W, A or V, optionally with
+// an m prefix, such as "5.12V 0.812A" or "P=4100mW".
+// Power is voltage times current when not given.
+static int parse_meter_line(const char *line, struct sensor_sample_t *smp) {
+	double val, scale, w, a, v;
+	const char *p;
+	char *end;
+
+	w = a = v = -1;
+	for(p = line; *p; ) {
+		if(!isdigit((unsigned char) *p) && !(*p == '.' && isdigit((unsigned char) p[1]))) {
+			p++;
+			continue;
+		}
+
+		val = strtod(p, &end);
+		while(*end == ' ') end++;
+		scale = 1;
+		if(*end == 'm' && end[1] && strchr("WwAaVv", end[1])) {
+			scale = 1e-3;
+			end++;
+		}
+		switch(toupper((unsigned char) *end)) {
+			case 'W': w = val * scale; break;
+			case 'A': a = val * scale; break;
+			case 'V': v = val * scale; break;
+			default: break;
+		}
+		p = end;
+	}
+
+	if(w < 0 && v >= 0 && a >= 0) w = v * a;
+	if(w < 0 && a < 0) return -1;
+	smp->milliW = w < 0 ? -1 : w * 1000;
+	smp->milliA = a < 0 ? -1 : a * 1000;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Sampler thread of a serial meter. The meter decides
+// the rate; every complete line is a sample.
+static void serial_sampler(struct sensor_t *s) {
+	struct sensor_sample_t smp;
+	char line[SENSOR_LINE_LEN];
+	struct pollfd pfd;
+	int len, n, i;
+
+	pfd.fd = s->ttyFd;
+	pfd.events = POLLIN;
+	len = 0;
+
+	while(!isStopping) {
+		if(poll(&pfd, 1, 100) <= 0) continue;
+		n = read(s->ttyFd, line + len, sizeof(line) - 1 - len);
+		if(n <= 0) {
+			usleep(100000);														// Hangup of a pty, wait for stop
+			continue;
+		}
+		len += n;
+
+		for(i = 0; i < len; i++) {
+			if(line[i] != '\n' && line[i] != '\r') continue;
+			line[i] = 0;
+			smp.ns = mono_ns();
+			if(i && !parse_meter_line(line, &smp)) ring_push(s, &smp);
+			memmove(line, line + i + 1, len - i - 1);
+			len -= i + 1;
+			i = -1;
+		}
+		if(len == sizeof(line) - 1) len = 0;									// Garbage without newlines
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Sampler thread. Polled sensors wake up on absolute
+// deadlines so the rate doesn't drift.
+static void* sampler(void *arg) {
+	struct sensor_t *s = arg;
+	struct sensor_sample_t smp;
+	struct timespec next;
+	int64_t period, lastT;
+
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), SENSOR_NICE);
+
+	if(s->kind == SENSOR_SERIAL) {
+		serial_sampler(s);
+		return NULL;
+	}
+
+	period = 1000000000LL / SENSOR_RATE;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	lastT = mono_ns();
+
+	while(!isStopping) {
+		smp.ns = mono_ns();
+		if(!sample_polled(s, smp.ns - lastT, &smp)) ring_push(s, &smp);
+		lastT = smp.ns;
+
+		next.tv_nsec += period;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Open all added sensors and start their samplers. The
+// samplers are pinned to <cpu> when not negative.
+int sensor_start(const int cpu) {
+	struct sensor_t *s;
+	struct sched_param schedParam;
+	pthread_attr_t attr;
+	cpu_set_t cpuMask;
+	int i, res;
+
+	isStopping = 0;
+	for(i = 0; i < nSensors; i++) {
+		s = sensors[i];
+		switch(s->kind) {
+			case SENSOR_RAPL: res = open_rapl(s); break;
+			case SENSOR_HWMON: res = open_hwmon(s); break;
+			default: res = open_serial(s); break;
+		}
+		if(res) return -1;
+
+		// Normal class, not inherited from the real-time monitor
+		pthread_attr_init(&attr);
+		schedParam.sched_priority = 0;
+		res = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		if(!res) res = pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		if(!res) res = pthread_attr_setschedparam(&attr, &schedParam);
+		if(!res && cpu >= 0) {
+			CPU_ZERO(&cpuMask);
+			CPU_SET(cpu, &cpuMask);
+			res = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuMask);
+		}
+		if(!res) res = pthread_create(&s->thread, &attr, sampler, s);
+		pthread_attr_destroy(&attr);
+		if(res) {
+			fprintf(stderr, "Error creating sensor thread: %s\n", strerror(res));
+			return -1;
+		}
+		s->isRunning = 1;
+		printf("Measuring power with %s\n", s->label);
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+static void stat_add(struct sensor_stat_t *st, const struct sensor_sample_t *smp) {
+	if(smp->milliW >= 0) {
+		st->n++;
+		st->sumMilliW += smp->milliW;
+		if(smp->milliW > st->peakMilliW) st->peakMilliW = smp->milliW;
+	}
+	if(smp->milliA >= 0) {
+		st->nCurr++;
+		st->sumMilliA += smp->milliA;
+		if(smp->milliA > st->peakMilliA) st->peakMilliA = smp->milliA;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Drain the rings of all sensors into the statistics.
+// Called from the main loop.
+int sensor_manager(void) {
+	struct sensor_sample_t *smp;
+	struct sensor_t *s;
+	uint32_t head, tail;
+	int i;
+
+	for(i = 0; i < nSensors; i++) {
+		s = sensors[i];
+		head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+		for(tail = s->tail; tail != head; tail++) {								// Only we write tail
+			smp = &s->ring[tail & (SENSOR_RING_LEN - 1)];
+			stat_add(&s->run, smp);
+			stat_add(&s->tot, smp);
+		}
+		__atomic_store_n(&s->tail, tail, __ATOMIC_RELEASE);						// Slots are free for the sampler
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Start the statistics of a new load cycle. Samples
+// taken before are counted to the totals only.
+void sensor_run_begin(void) {
+	int i;
+
+	sensor_manager();
+	for(i = 0; i < nSensors; i++) memset(&sensors[i]->run, 0, sizeof(sensors[i]->run));
+}
+
+
+
+//-------------------------------------------------------------
+// Print average and peak power of the load cycle
+void sensor_run_end(void) {
+	struct sensor_stat_t *st;
+	int i;
+
+	sensor_manager();
+	lastRunMilliW = -1;
+
+	for(i = 0; i < nSensors; i++) {
+		st = &sensors[i]->run;
+		if(!st->n && !st->nCurr) {
+			printf("Measured nothing by %s\n", sensors[i]->label);
+			continue;
+		}
+
+		printf("Measured by %s:", sensors[i]->label);
+		if(st->n) {
+			printf(" avg %.2f W, peak %.2f W", st->sumMilliW / st->n / 1000.0,
+				st->peakMilliW / 1000.0);
+			if(i == 0) lastRunMilliW = st->sumMilliW / st->n;
+		}
+		if(st->nCurr) {
+			printf("%s avg %.3f A, peak %.3f A", st->n ? "," : "",
+				st->sumMilliA / st->nCurr / 1000.0, st->peakMilliA / 1000.0);
+		}
+		printf("\n");
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when at least one power sensor is added
+int sensor_is_enabled(void) {
+	return nSensors > 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Get the average power of the first sensor during the
+// last load cycle. Returns -1 when not measured.
+int sensor_run_power(int *milliW) {
+	*milliW = lastRunMilliW;
+
+	return lastRunMilliW < 0 ? -1 : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Stop all samplers and close the sensors
+void sensor_close(void) {
+	struct sensor_t *s;
+	int i, j;
+
+	isStopping = 1;
+	for(i = 0; i < nSensors; i++) {
+		s = sensors[i];
+		if(s->isRunning) pthread_join(s->thread, NULL);
+		s->isRunning = 0;
+		for(j = 0; j < s->nFds; j++) close(s->fds[j]);
+		s->nFds = 0;
+		if(s->ttyFd >= 0) close(s->ttyFd);
+		s->ttyFd = -1;
+	}
+	sensor_manager();
+}
+
+
+
+//-------------------------------------------------------------
+// Print average and peak power of all load cycles. Must
+// be called after sensor_close().
+void sensor_report(void) {
+	struct sensor_stat_t *st;
+	int i;
+
+	for(i = 0; i < nSensors; i++) {
+		st = &sensors[i]->tot;
+		if(!st->n && !st->nCurr) {
+			free(sensors[i]);
+			continue;
+		}
+
+		printf("Power by %s, whole test:", sensors[i]->label);
+		if(st->n) {
+			printf(" avg %.2f W, peak %.2f W", st->sumMilliW / st->n / 1000.0,
+				st->peakMilliW / 1000.0);
+		}
+		if(st->nCurr) {
+			printf("%s avg %.3f A, peak %.3f A", st->n ? "," : "",
+				st->sumMilliA / st->nCurr / 1000.0, st->peakMilliA / 1000.0);
+		}
+		printf(", %u samples", st->n > st->nCurr ? st->n : st->nCurr);
+		if(sensors[i]->nLost) printf(" (%u lost)", sensors[i]->nLost);
+		printf("\n");
+		free(sensors[i]);
+	}
+	nSensors = 0;
+}
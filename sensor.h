@@ -0,0 +1,17 @@
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+
+//-------------------------------------------------------------
+int sensor_add(const char *spec);
+int sensor_is_enabled(void);
+int sensor_start(const int cpu);
+int sensor_manager(void);
+void sensor_run_begin(void);
+void sensor_run_end(void);
+int sensor_run_power(int *milliW);
+void sensor_close(void);
+void sensor_report(void);
+
+#endif
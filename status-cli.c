@@ -0,0 +1,106 @@
+
+/* Command line watcher of the live status page of a
+ * running rpiburn. Prints the status once, or every
+ * update with -f until the test has ended.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "rpiburn-status.h"
+
+
+//-------------------------------------------------------------
+#define DFLT_INTERVAL			100												// Poll period in ms when following
+
+
+
+//-------------------------------------------------------------
+// Print one status line
+static void print_status(const struct rpiburn_status_t *st) {
+	printf("cycle %u %-6s workers %u/%u  throttled 0x%05x", st->cycle,
+		rpiburn_status_phase_name(st->phase), st->activeWorkers, st->workers,
+		st->throttled);
+	if(st->flags & RPIBURN_ST_HAS_TEMP) printf("  %.1f C", st->milliC / 1000.0);
+	printf("  elapsed %.1f s, cycle %.1f s", st->elapsedMs / 1000.0,
+		st->cycleMs / 1000.0);
+	if(st->flags & RPIBURN_ST_BROWNOUT) printf("  brownout");
+	if(st->flags & RPIBURN_ST_HEATED) printf("  heated");
+	if(st->phase != RPIBURN_PH_DONE && kill(st->pid, 0) == -1 && errno == ESRCH) {
+		printf("  (not running)");
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+
+
+//-------------------------------------------------------------
+// The main
+int main(int argc, char *argv[]) {
+	const struct rpiburn_status_t *page;
+	struct rpiburn_status_t st;
+	struct timespec period;
+	const char *path;
+	uint64_t lastUpdate;
+	int opt, doFollow, interval;
+
+	doFollow = 0;
+	interval = DFLT_INTERVAL;
+	while((opt = getopt(argc, argv, "fi:h")) != -1) {
+		switch(opt) {
+			case 'f':
+				doFollow = 1;
+				break;
+
+			case 'i':
+				interval = atoi(optarg);
+				if(interval < 1) interval = 1;
+				break;
+
+			default:
+				printf("Usage: %s [-f] [-i <ms>] [<file>]\n", argv[0]);
+				printf("    -f                  Follow, print every update until the test ends\n");
+				printf("    -i <ms>             Poll period when following, default %d\n", DFLT_INTERVAL);
+				printf("    <file>              Status page, default %s\n", RPIBURN_STATUS_PATH);
+				return EXIT_FAILURE;
+		}
+	}
+	path = optind < argc ? argv[optind] : RPIBURN_STATUS_PATH;
+
+	page = rpiburn_status_open(path);
+	if(!page) {
+		fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	period.tv_sec = interval / 1000;
+	period.tv_nsec = (interval % 1000) * 1000000L;
+	lastUpdate = 0;
+	do {
+		if(rpiburn_status_read(page, &st)) {
+			fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+			rpiburn_status_close(page);
+			return EXIT_FAILURE;
+		}
+		if(st.updateNs != lastUpdate || st.phase == RPIBURN_PH_DONE) print_status(&st);
+		lastUpdate = st.updateNs;
+		if(doFollow && st.phase != RPIBURN_PH_DONE) nanosleep(&period, NULL);
+	} while(doFollow && st.phase != RPIBURN_PH_DONE);
+
+	rpiburn_status_close(page);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+
+/* Reader of the live status page. Kept apart from the
+ * rest so watchers only link this, see rpiburn-status.h.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rpiburn-status.h"
+
+
+//-------------------------------------------------------------
+#define STATUS_READ_RETRIES		100000											// Attempts before an update is considered stuck
+
+
+//-------------------------------------------------------------
+static const char *phaseNames[] = {
+	[RPIBURN_PH_IDLE] = "idle",
+	[RPIBURN_PH_SPAWN] = "spawn",
+	[RPIBURN_PH_LOAD] = "load",
+	[RPIBURN_PH_ENDING] = "ending",
+	[RPIBURN_PH_DONE] = "done",
+};
+
+
+
+//-------------------------------------------------------------
+// Map the status page in file <path>. Returns NULL with
+// errno set on error.
+const struct rpiburn_status_t* rpiburn_status_open(const char *path) {
+	struct stat st;
+	void *page;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1) return NULL;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+	if(st.st_size < (off_t) offsetof(struct rpiburn_status_t, pid)) {
+		close(fd);
+		errno = ENODATA;
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(struct rpiburn_status_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);																	// The mapping stays
+
+	return page == MAP_FAILED ? NULL : page;
+}
+
+
+
+//-------------------------------------------------------------
+// Take a consistent copy of the status page into
+// <status>. Fields the writer doesn't know of are zero.
+// Returns -1 with errno set when the page is of another
+// layout or is being written for too long.
+int rpiburn_status_read(const struct rpiburn_status_t *page,
+		struct rpiburn_status_t *status) {
+	uint32_t seq;
+	int i;
+
+	for(i = 0; i < STATUS_READ_RETRIES; i++) {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1u) continue;
+		memcpy(status, page, sizeof(*status));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq) continue;
+
+		if(status->magic != RPIBURN_STATUS_MAGIC ||
+				status->version != RPIBURN_STATUS_VERSION) {
+			errno = EPROTO;
+			return -1;
+		}
+		if(status->size < sizeof(*status)) {
+			memset((char*) status + status->size, 0, sizeof(*status) - status->size);
+		}
+
+		return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Name of load phase <phase>
+const char* rpiburn_status_phase_name(const uint32_t phase) {
+	if(phase >= sizeof(phaseNames) / sizeof(phaseNames[0])) return "unknown";
+	return phaseNames[phase];
+}
+
+
+
+//-------------------------------------------------------------
+// Unmap a status page
+void rpiburn_status_close(const struct rpiburn_status_t *page) {
+	if(page) munmap((void*) page, sizeof(*page));
+}
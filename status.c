@@ -0,0 +1,168 @@
+
+/* Publish the live status of the test in a shared memory
+ * page for external watchers, such as a node agent. The
+ * page is updated from the main loop under a sequence
+ * lock; the counter is odd while fields are written,
+ * so readers retry instead of seeing a torn update. The
+ * layout and a reader are in rpiburn-status.h.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "status.h"
+#include "rpiburn-status.h"
+#include "misc.h"
+#include "high-load.h"
+#include "freqmon.h"
+#include "vchiq.h"
+
+
+//-------------------------------------------------------------
+#define STATUS_FILE_SIZE		4096											// Room for fields added later
+#define STATUS_TEMP_PERIOD		250												// Min ms between temperature reads
+
+
+//-------------------------------------------------------------
+static const enum rpiburn_phase_t phaseMap[FREQ_N_PHASES] = {
+	[FREQ_PH_IDLE] = RPIBURN_PH_IDLE,
+	[FREQ_PH_SPAWN] = RPIBURN_PH_SPAWN,
+	[FREQ_PH_LOAD] = RPIBURN_PH_LOAD,
+	[FREQ_PH_ENDING] = RPIBURN_PH_ENDING,
+};
+
+static struct rpiburn_status_t *page;											// Mapped status file, or NULL
+static int64_t startNs;															// When the test started
+static int64_t cycleNs;															// When the current cycle started
+static int64_t tempNs;															// Last temperature read
+
+
+
+//-------------------------------------------------------------
+// Begin and end an update of the page
+static void write_begin(void) {
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(void) {
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+
+//-------------------------------------------------------------
+// Create the status page in file <fileName>
+int status_open(const char *fileName) {
+	void *mem;
+	int fd;
+
+	fd = open(fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd == -1 || ftruncate(fd, STATUS_FILE_SIZE) == -1) {
+		perror("Error creating status page");
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+	mem = mmap(NULL, STATUS_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED) {
+		perror("Error mapping status page");
+		return -1;
+	}
+
+	page = mem;
+	startNs = mono_ns();
+	page->seq &= ~1u;															// Left odd by a crashed run?
+	write_begin();
+	memset((char*) page + offsetof(struct rpiburn_status_t, pid), 0,
+		sizeof(*page) - offsetof(struct rpiburn_status_t, pid));				// All after seq
+	page->magic = RPIBURN_STATUS_MAGIC;
+	page->version = RPIBURN_STATUS_VERSION;
+	page->size = sizeof(*page);
+	page->pid = getpid();
+	page->phase = RPIBURN_PH_IDLE;
+	write_end();
+	status_update();
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Publish the current status. Called from the main loop.
+void status_update(void) {
+	enum rpiburn_phase_t phase;
+	uint16_t kinds;
+	int64_t t;
+	int n, temp;
+
+	if(!page) return;
+	t = mono_ns();
+
+	phase = phaseMap[freqmon_get_phase()];
+	n = high_load_active(&kinds);
+
+	write_begin();
+	page->phase = phase;
+	page->flags = (page->flags & RPIBURN_ST_HAS_TEMP) |
+		(hasBrownOut() ? RPIBURN_ST_BROWNOUT : 0) |
+		(isHeated() ? RPIBURN_ST_HEATED : 0);
+	page->workers = high_load_workers();
+	page->activeWorkers = n;
+	page->activeKinds = kinds;
+	page->throttled = vchiq_throttled();
+	if(t - tempNs >= STATUS_TEMP_PERIOD * 1000000LL) {
+		tempNs = t;
+		if(!read_soc_temp(&temp)) {
+			page->milliC = temp;
+			page->flags |= RPIBURN_ST_HAS_TEMP;
+		}
+		else {
+			page->flags &= ~RPIBURN_ST_HAS_TEMP;
+		}
+	}
+	page->elapsedMs = (t - startNs) / 1000000LL;
+	page->cycleMs = cycleNs ? (t - cycleNs) / 1000000LL : 0;
+	page->updateNs = t;
+	write_end();
+}
+
+
+
+//-------------------------------------------------------------
+// A new load cycle has started
+void status_new_cycle(void) {
+	if(!page) return;
+	cycleNs = mono_ns();
+	write_begin();
+	page->cycle++;
+	write_end();
+	status_update();
+}
+
+
+
+//-------------------------------------------------------------
+// Mark the status as final and unmap the page. The file
+// stays so watchers see how the test ended.
+void status_close(void) {
+	if(!page) return;
+	status_update();
+	write_begin();
+	page->phase = RPIBURN_PH_DONE;
+	write_end();
+	munmap(page, STATUS_FILE_SIZE);
+	page = NULL;
+}
@@ -0,0 +1,12 @@
+
+#ifndef STATUS_H
+#define STATUS_H
+
+
+//-------------------------------------------------------------
+int status_open(const char *fileName);
+void status_update(void);
+void status_new_cycle(void);
+void status_close(void);
+
+#endif
@@ -0,0 +1,712 @@
+
+/* Storage power consumers. The read consumer loads every
+ * block device found in sysfs at the same time, so all
+ * storage buses the PSU feeds are busy; SD card, USB and
+ * NVMe alike. Flash controllers draw noticeably more
+ * current when they program than when they read. The
+ * write consumer keeps a queue of O_DIRECT writes in
+ * flight to a preallocated scratch file, limited by a
+ * wear budget per run.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#include "storage.h"
+#include "misc.h"
+#include "high-load.h"
+#include "hwprobe.h"
+
+
+//-------------------------------------------------------------
+#define WRITE_ALIGN			4096												// O_DIRECT alignment of offsets, sizes and buffers
+#define WRITE_SCRATCH_SIZE	(64LL * 1024 * 1024)								// Size of the preallocated scratch file
+#define WRITE_MAX_QD		64													// Max number of writes in flight
+#define WRITE_MAX_BS		8													// Max number of block sizes in mix
+#define WRITE_DFLT_QD		4
+#define WRITE_DFLT_BUDGET	(256LL * 1024 * 1024)								// Default wear budget per run
+#define WRITE_POLL_TIME		50													// Max time in ms between polls of stop flag
+#define HUGE_PAGE_SIZE		(2 * 1024 * 1024)
+#define READ_LEN			4096												// Size of each random read
+#define READ_MAX_QD			64													// Max number of reads in flight per device
+#define READ_DFLT_QD		4
+#define STORAGE_MAX_DEVS	16
+
+
+//-------------------------------------------------------------
+struct storage_dev_t {
+	char name[32];																// Kernel name, as in /sys/block
+	long long size;																// Size in bytes
+	int cpu;																	// Core handling the device interrupt, or -1
+	volatile long long bytesRead;
+	volatile long long nReads;
+	volatile long long readTime;												// Sum of time in ns the device has been loaded
+};
+
+
+//-------------------------------------------------------------
+static const char *scratchFile;													// Scratch file of write consumer, or NULL
+static int hasCreatedScratch;													// True when this run created the scratch file
+static pthread_mutex_t scratchLock = PTHREAD_MUTEX_INITIALIZER;					// Guards creation and the active time
+static int writeQd = WRITE_DFLT_QD;												// Queue depth of write consumer
+static long long writeBs[WRITE_MAX_BS] = { 4096, 65536, 1048576 };				// Block size mix
+static int nWriteBs = 3;
+static long long writeBudget = WRITE_DFLT_BUDGET;								// Max bytes written per run
+static volatile long long bytesWritten;											// Sum of all write childs
+static volatile long long nWrites;
+static volatile long long nShortWrites;											// Writes completed with fewer bytes than asked
+static volatile long long nWriteErrors;											// Failed submits and completions
+static long long writeTime;														// Wall time in ns any write child had writes in flight
+static int nActiveWriters;														// Write childs with writes in flight
+static int64_t activeSince;														// When the first of them started
+static struct storage_dev_t devs[STORAGE_MAX_DEVS];								// Block devices of the read consumer
+static int nDevs;
+static int readQd = READ_DFLT_QD;												// Queue depth per device of read consumer
+
+
+
+//-------------------------------------------------------------
+// Thin wrappers of the kernel native AIO system calls.
+// The C library has no interface for them.
+static int io_setup(unsigned nr, aio_context_t *ctx) {
+	return syscall(SYS_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx) {
+	return syscall(SYS_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long n, struct iocb **iocbs) {
+	return syscall(SYS_io_submit, ctx, n, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long minNr, long maxNr,
+		struct io_event *events, struct timespec *timeout) {
+	return syscall(SYS_io_getevents, ctx, minNr, maxNr, events, timeout);
+}
+
+
+
+//-------------------------------------------------------------
+// Look up the interrupt of a device in /proc/interrupts,
+// by the name the driver registered it with. Returns
+// the IRQ number or -1 when not found.
+static int find_irq_by_name(const char *name) {
+	char line[512], path[256], *p, *tok, *save;
+	int irq, found;
+	FILE *fp;
+
+	sys_path(path, sizeof(path), "/proc/interrupts");
+	fp = fopen(path, "r");
+	if(!fp) return -1;
+
+	found = -1;
+	while(found < 0 && fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, " %d:", &irq) != 1) continue;
+
+		// Device names are last on the line, comma separated
+		p = strrchr(line, ' ');
+		while(p && p > line && p[-1] == ',') {
+			for(p--; p > line && p[-1] != ' '; p--);
+		}
+		for(tok = strtok_r(p, ", \n", &save); tok && found < 0;
+				tok = strtok_r(NULL, ", \n", &save)) {
+			if(!strcmp(tok, name)) found = irq;
+		}
+	}
+
+	fclose(fp);
+
+	return found;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the first MSI interrupt of a PCI device, or -1
+// when it has none. Used by NVMe and virtio where the
+// legacy irq attribute is zero.
+static int find_msi_irq(const char *devPath) {
+	char path[PATH_MAX + 16];
+	struct dirent *ent;
+	int irq;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "%s/msi_irqs", devPath);
+	dir = opendir(path);
+	if(!dir) return -1;
+
+	irq = -1;
+	while(irq < 0 && (ent = readdir(dir))) {
+		if(ent->d_name[0] != '.') irq = atoi(ent->d_name);
+	}
+
+	closedir(dir);
+
+	return irq;
+}
+
+
+
+//-------------------------------------------------------------
+// Find the core which handles the interrupt of a block
+// device. Walk from the device towards the root of the
+// sysfs device tree; PCI devices have an irq attribute
+// or MSI interrupts, while platform hosts (like mmc0) are
+// matched by name in /proc/interrupts. Returns -1 when
+// not found.
+static int find_dev_cpu(const char *name) {
+	char path[PATH_MAX + 16], devPath[PATH_MAX], buf[64], *p;
+	long irq;
+	int cpu;
+
+	sys_path(path, sizeof(path), "/sys/block/%s/device", name);
+	if(!realpath(path, devPath)) return -1;
+
+	irq = -1;
+	while((p = strrchr(devPath, '/')) && strcmp(p, "/devices") && irq <= 0) {
+		snprintf(path, sizeof(path), "%s/irq", devPath);
+		if(read_file_long(path, &irq) || irq <= 0) irq = find_msi_irq(devPath);
+		if(irq <= 0) irq = find_irq_by_name(p + 1);
+		*p = 0;
+	}
+	if(irq <= 0) return -1;
+
+	sys_path(path, sizeof(path), "/proc/irq/%ld/smp_affinity_list", irq);
+	if(read_file_str(path, buf, sizeof(buf)) <= 0) return -1;
+	if(sscanf(buf, "%d", &cpu) != 1 || cpu < 0 || cpu >= HW_MAX_CPUS) return -1;
+
+	return cpu;
+}
+
+
+
+//-------------------------------------------------------------
+// Discover the block devices of the read consumer. Loop,
+// ram, zram and device mapper devices have no backing
+// device in sysfs and are skipped unless <withVirtual>.
+// Empty devices, such as card readers, are skipped too.
+int storage_discover(const int withVirtual) {
+	char path[256], buf[64];
+	struct dirent *ent;
+	long sectors;
+	DIR *dir;
+	int i;
+
+	sys_path(path, sizeof(path), "/sys/block");
+	dir = opendir(path);
+	if(!dir) {
+		log_errno("Error listing block devices");
+		return -1;
+	}
+
+	nDevs = 0;
+	while((ent = readdir(dir)) && nDevs < STORAGE_MAX_DEVS) {
+		if(ent->d_name[0] == '.' || strlen(ent->d_name) >= sizeof(devs[0].name)) {
+			continue;
+		}
+
+		sys_path(path, sizeof(path), "/sys/block/%s/device", ent->d_name);
+		if(!withVirtual && access(path, F_OK)) continue;
+
+		// Size is always in 512 byte units
+		sys_path(path, sizeof(path), "/sys/block/%s/size", ent->d_name);
+		if(read_file_long(path, &sectors) ||
+				sectors * 512LL <= READ_LEN) {
+			continue;
+		}
+
+		memset(&devs[nDevs], 0, sizeof(devs[0]));
+		strcpy(devs[nDevs].name, ent->d_name);
+		devs[nDevs].size = sectors * 512LL;
+		devs[nDevs].cpu = find_dev_cpu(ent->d_name);
+		nDevs++;
+	}
+
+	closedir(dir);
+
+	if(nDevs) {
+		log_info("Storage devices:");
+		for(i = 0; i < nDevs; i++) {
+			if(devs[i].cpu >= 0) snprintf(buf, sizeof(buf), " (core %d)", devs[i].cpu);
+			else buf[0] = 0;
+			log_info(" %s%s", devs[i].name, buf);
+		}
+		log_info("\n");
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Set number of reads in flight per device
+int storage_set_read_qd(const int qd) {
+	if(qd < 1 || qd > READ_MAX_QD) {
+		log_error("Error, read queue depth must be 1 to %d\n",
+			READ_MAX_QD);
+		return -1;
+	}
+	readQd = qd;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns number of discovered block devices
+int storage_n_devs(void) {
+	return nDevs;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns the core handling the interrupt of I/O child
+// number <idx>, or -1 when unknown.
+int storage_dev_cpu(const int idx) {
+	if(nDevs == 0) return -1;
+	return devs[idx % nDevs].cpu;
+}
+
+
+
+//-------------------------------------------------------------
+// Enable the write consumer with a scratch file at
+// <fileName>, on the filesystem to be loaded.
+int storage_set_write(const char *fileName) {
+	scratchFile = fileName;
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Set number of writes in flight of the write consumer
+int storage_set_write_qd(const int qd) {
+	if(qd < 1 || qd > WRITE_MAX_QD) {
+		log_error("Error, write queue depth must be 1 to %d\n",
+			WRITE_MAX_QD);
+		return -1;
+	}
+	writeQd = qd;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Set the block size mix of the write consumer from a
+// comma separated list of sizes, such as "4k,64k,1m".
+// Each write picks one of them at random.
+int storage_set_write_bs(const char *list) {
+	char *buf, *tok, *save;
+	long long bs;
+	int res;
+
+	res = 0;
+	nWriteBs = 0;
+	buf = strdup(list);
+
+	for(tok = strtok_r(buf, ",", &save); tok && !res;
+			tok = strtok_r(NULL, ",", &save)) {
+		if(parse_size(tok, &bs) || bs < WRITE_ALIGN || bs % WRITE_ALIGN ||
+				bs > HUGE_PAGE_SIZE || nWriteBs == WRITE_MAX_BS) {
+			log_error("Error, invalid write block size %s\n", tok);
+			res = -1;
+		}
+		else {
+			writeBs[nWriteBs++] = bs;
+		}
+	}
+
+	if(!res && nWriteBs == 0) res = -1;
+	free(buf);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Set max number of bytes written per run
+void storage_set_write_budget(const long long bytes) {
+	writeBudget = bytes;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when the write consumer is enabled
+int storage_has_write(void) {
+	return scratchFile != NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Open the scratch file of the write consumer. The first
+// child creates it and fails if it already exists, so we
+// never overwrite or remove a file that isn't ours.
+static int open_scratch(void) {
+	int fd;
+
+	pthread_mutex_lock(&scratchLock);
+	if(hasCreatedScratch) {
+		fd = open(scratchFile, O_RDWR | O_DIRECT | O_NOATIME);
+	}
+	else {
+		fd = open(scratchFile, O_RDWR | O_CREAT | O_EXCL | O_DIRECT | O_NOATIME, 0600);
+		if(fd >= 0) hasCreatedScratch = 1;
+	}
+	pthread_mutex_unlock(&scratchLock);
+
+	if(fd == -1 && errno == EEXIST) {
+		log_error("Error, storage scratch file %s already exists\n",
+			scratchFile);
+	}
+	else if(fd == -1) {
+		log_errno("Error opening storage scratch file");
+	}
+
+	return fd;
+}
+
+
+
+//-------------------------------------------------------------
+// A write child begins or ends having writes in flight.
+// Accounts the wall time any of them is active, which
+// the throughput is based on; not the idle time after
+// the wear budget is spent, nor overlapping childs.
+static void write_active(const int isActive) {
+	pthread_mutex_lock(&scratchLock);
+	if(isActive && nActiveWriters++ == 0) {
+		activeSince = mono_ns();
+	}
+	else if(!isActive && --nActiveWriters == 0) {
+		writeTime += mono_ns() - activeSince;
+	}
+	pthread_mutex_unlock(&scratchLock);
+}
+
+
+
+//-------------------------------------------------------------
+// Allocate the aligned buffers of all writes in flight.
+// Try huge pages first to save TLB misses, then fall
+// back to normal pages which are aligned as well.
+static char* arena_alloc(struct child_t *me, const size_t len) {
+	char *arena;
+	size_t i;
+
+	arena = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(arena == MAP_FAILED) {
+		arena = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if(arena == MAP_FAILED) return NULL;
+
+	// Data that doesn't compress, if the controller tries
+	for(i = 0; i + sizeof(uint32_t) <= len; i += sizeof(uint32_t)) {
+		*(uint32_t*) (arena + i) = child_random(me);
+	}
+
+	return arena;
+}
+
+
+
+//-------------------------------------------------------------
+// Queue one write of random size at a random offset,
+// if the wear budget allows it.
+static int submit_write(struct child_t *me, aio_context_t ctx, struct iocb *cb,
+		const int fd, char *buf) {
+	long long bs, offs;
+	struct iocb *cbs[1];
+
+	bs = writeBs[child_random(me) % nWriteBs];
+	if(__sync_add_and_fetch(&bytesWritten, bs) > writeBudget) {
+		__sync_sub_and_fetch(&bytesWritten, bs);
+		return 0;
+	}
+
+	offs = (child_random(me) % ((WRITE_SCRATCH_SIZE - bs) / WRITE_ALIGN)) * WRITE_ALIGN;
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_fildes = fd;
+	cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+	cb->aio_buf = (uintptr_t) buf;
+	cb->aio_nbytes = bs;
+	cb->aio_offset = offs;
+	cb->aio_data = (uintptr_t) buf;
+
+	cbs[0] = cb;
+	if(io_submit(ctx, 1, cbs) != 1) {
+		__sync_sub_and_fetch(&bytesWritten, bs);
+		__sync_add_and_fetch(&nWriteErrors, 1);
+		log_errno("Error submitting storage write");
+		return -1;
+	}
+
+	return 1;
+}
+
+
+
+//-------------------------------------------------------------
+// Power consumer: keep a queue of O_DIRECT writes to a
+// scratch file in flight until told to exit, or until
+// the wear budget is spent.
+int write_storage(struct child_t *me) {
+	struct io_event events[WRITE_MAX_QD];
+	struct iocb cbs[WRITE_MAX_QD];
+	struct timespec timeout;
+	struct iocb *cb;
+	aio_context_t ctx;
+	int fd, i, n, res, inFlight;
+	char *arena;
+
+	if(!scratchFile) return EXIT_FAILURE;
+
+	fd = open_scratch();
+	if(fd == -1) return EXIT_FAILURE;
+	if(fallocate(fd, 0, 0, WRITE_SCRATCH_SIZE) == -1) {
+		log_errno("Error preallocating storage scratch file");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	arena = arena_alloc(me, (size_t) writeQd * HUGE_PAGE_SIZE);
+	ctx = 0;
+	if(!arena || io_setup(writeQd, &ctx) == -1) {
+		log_errno("Error preparing storage writes");
+		if(arena) munmap(arena, (size_t) writeQd * HUGE_PAGE_SIZE);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	write_active(1);
+	res = 0;
+	inFlight = 0;
+	for(i = 0; i < writeQd && res >= 0; i++) {
+		res = submit_write(me, ctx, &cbs[i], fd, arena + i * HUGE_PAGE_SIZE);
+		if(res > 0) inFlight++;
+	}
+
+	// Resubmit each completed write until time to exit
+	while(res >= 0 && inFlight > 0) {
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = WRITE_POLL_TIME * 1000000L;
+		n = io_getevents(ctx, 1, writeQd, events, &timeout);
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			log_errno("Error waiting for storage writes");
+			res = -1;
+			break;
+		}
+
+		for(i = 0; i < n; i++) {
+			inFlight--;
+			cb = (struct iocb*) (uintptr_t) events[i].obj;
+			if((long long) events[i].res < 0) {
+				__sync_sub_and_fetch(&bytesWritten, cb->aio_nbytes);
+				__sync_add_and_fetch(&nWriteErrors, 1);
+				log_error("Error writing storage: %s\n",
+					strerror(-events[i].res));
+				res = -1;
+				continue;
+			}
+			// Only part of it written, count what was
+			if((unsigned long long) events[i].res < cb->aio_nbytes) {
+				__sync_sub_and_fetch(&bytesWritten, cb->aio_nbytes - events[i].res);
+				__sync_add_and_fetch(&nShortWrites, 1);
+			}
+			__sync_add_and_fetch(&nWrites, 1);
+			if(me->ctrl->stop || res < 0) continue;
+
+			res = submit_write(me, ctx, cb, fd, (char*) (uintptr_t) events[i].data);
+			if(res > 0) inFlight++;
+		}
+	}
+	write_active(0);
+
+	// Wear budget spent; idle until time to exit
+	while(res >= 0 && !me->ctrl->stop) usleep(WRITE_POLL_TIME * 1000);
+
+	io_destroy(ctx);
+	munmap(arena, (size_t) writeQd * HUGE_PAGE_SIZE);
+	close(fd);
+
+	return (res < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+
+//-------------------------------------------------------------
+// Queue one read at a random offset of a block device
+static int submit_read(struct child_t *me, aio_context_t ctx, struct iocb *cb,
+		const int fd, char *buf, const long long devSize) {
+	struct iocb *cbs[1];
+
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_fildes = fd;
+	cb->aio_lio_opcode = IOCB_CMD_PREAD;
+	cb->aio_buf = (uintptr_t) buf;
+	cb->aio_nbytes = READ_LEN;
+	cb->aio_offset = (child_random(me) % (devSize / READ_LEN)) * READ_LEN;
+	cb->aio_data = (uintptr_t) buf;
+
+	cbs[0] = cb;
+	if(io_submit(ctx, 1, cbs) != 1) {
+		log_errno("Error submitting storage read");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Power consumer: keep a queue of O_DIRECT reads from
+// random locations of a block device in flight until
+// told to exit. Each I/O child takes the next device in
+// turn; if there are more childs than devices they
+// share them, and only the first of each records time.
+int read_storage(struct child_t *me) {
+	struct io_event events[READ_MAX_QD];
+	struct iocb cbs[READ_MAX_QD];
+	struct storage_dev_t *dev;
+	struct timespec timeout, t0, t1;
+	aio_context_t ctx;
+	int fd, i, n, res, inFlight;
+	char path[256], *arena;
+
+	if(nDevs == 0) return EXIT_FAILURE;
+	dev = &devs[me->arg % nDevs];
+
+	sys_path(path, sizeof(path), "/dev/%s", dev->name);
+	fd = open(path, O_RDONLY | O_DIRECT | O_NOATIME);
+	if(fd == -1) {
+		log_error("Error opening block device %s: %s\n", path,
+			strerror(errno));
+		if(errno == EACCES && geteuid() != 0) {
+			log_error("You need to become root!\n");
+		}
+		return EXIT_FAILURE;
+	}
+
+	arena = arena_alloc(me, (size_t) readQd * READ_LEN);
+	ctx = 0;
+	if(!arena || io_setup(readQd, &ctx) == -1) {
+		log_errno("Error preparing storage reads");
+		if(arena) munmap(arena, (size_t) readQd * READ_LEN);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	res = 0;
+	inFlight = 0;
+	for(i = 0; i < readQd && !res; i++) {
+		res = submit_read(me, ctx, &cbs[i], fd, arena + i * READ_LEN, dev->size);
+		if(!res) inFlight++;
+	}
+
+	// Resubmit each completed read until time to exit
+	while(inFlight > 0) {
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = WRITE_POLL_TIME * 1000000L;
+		n = io_getevents(ctx, 1, readQd, events, &timeout);
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			log_errno("Error waiting for storage reads");
+			res = -1;
+			break;
+		}
+
+		for(i = 0; i < n; i++) {
+			inFlight--;
+			if((long long) events[i].res < 0) {
+				log_error("Error reading %s: %s\n", path,
+					strerror(-events[i].res));
+				res = -1;
+				continue;
+			}
+			__sync_add_and_fetch(&dev->bytesRead, events[i].res);
+			__sync_add_and_fetch(&dev->nReads, 1);
+			if(me->ctrl->stop || res) continue;
+
+			res = submit_read(me, ctx, (struct iocb*) (uintptr_t) events[i].obj,
+				fd, (char*) (uintptr_t) events[i].data, dev->size);
+			if(!res) inFlight++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if(me->arg < nDevs) __sync_add_and_fetch(&dev->readTime, diffntime(&t0, &t1));
+
+	io_destroy(ctx);
+	munmap(arena, (size_t) readQd * READ_LEN);
+	close(fd);
+
+	return (res ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+
+//-------------------------------------------------------------
+// Print storage throughput per device and of all
+// write childs
+void storage_report(void) {
+	double secs;
+	int i;
+
+	for(i = 0; i < nDevs; i++) {
+		if(devs[i].readTime <= 0) continue;
+		secs = devs[i].readTime / 1e9;
+		log_info("Storage reads %s: %.1f MB, %.1f MB/s, %.0f IOPS\n",
+			devs[i].name, devs[i].bytesRead / 1e6,
+			devs[i].bytesRead / secs / 1e6, devs[i].nReads / secs);
+	}
+
+	if(!scratchFile || writeTime <= 0) return;
+
+	secs = writeTime / 1e9;
+	log_info("Storage writes: %.1f MB, %.1f MB/s, %.0f IOPS\n",
+		bytesWritten / 1e6, bytesWritten / secs / 1e6, nWrites / secs);
+	if(nShortWrites || nWriteErrors) {
+		log_info("Storage writes: %lld short, %lld failed\n", nShortWrites,
+			nWriteErrors);
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Remove the scratch file at exit, if we created it
+void storage_close(void) {
+	if(hasCreatedScratch) unlink(scratchFile);
+	hasCreatedScratch = 0;
+}
@@ -0,0 +1,25 @@
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+
+//-------------------------------------------------------------
+struct child_t;
+
+
+//-------------------------------------------------------------
+int storage_discover(const int withVirtual);
+int storage_set_read_qd(const int qd);
+int storage_n_devs(void);
+int storage_dev_cpu(const int idx);
+int read_storage(struct child_t *me);
+int storage_set_write(const char *fileName);
+int storage_set_write_qd(const int qd);
+int storage_set_write_bs(const char *list);
+void storage_set_write_budget(const long long bytes);
+int storage_has_write(void);
+int write_storage(struct child_t *me);
+void storage_report(void);
+void storage_close(void);
+
+#endif
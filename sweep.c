@@ -0,0 +1,214 @@
+
+/* DVFS sweep. A board may pass at stock clock and fail
+ * overclocked, or the other way around when the lower
+ * operating points run at lower voltage. Here the max
+ * frequency of all cores is clamped to each frequency
+ * the cpufreq driver offers, lowest first, and a normal
+ * load cycle is run at each operating point. The
+ * firmware throttled bits, time to the first throttle
+ * event, SoC temperature slope and the throughput by
+ * the performance counters are reported in a table.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "sweep.h"
+#include "main.h"
+#include "misc.h"
+#include "hwprobe.h"
+#include "perf.h"
+#include "high-load.h"
+#include "powerstate.h"
+#include "sensor.h"
+#include "vchiq.h"
+
+
+//-------------------------------------------------------------
+#define SWEEP_MAX_POINTS		64												// Max operating points we test
+#define SWEEP_COOL_MARGIN		1000											// Accepted temperature rise in mC above start before next point
+#define SWEEP_COOL_TIMEOUT		60000											// Max time in ms we wait for the board to cool down
+
+
+//-------------------------------------------------------------
+struct sweep_point_t {
+	long khz;																	// Max frequency of the point
+	int isDone;																	// True when a cycle has run
+	unsigned int throttled;														// Firmware bits seen during the cycle
+	int firstMs;																// Time to first throttle event, or -1
+	int slope;																	// Temperature in mC/s, or INT_MIN when unknown
+	double instrRate;															// Instructions per second, or 0 when unknown
+	double mhz;																	// Clock of loaded cores by the counters
+	int milliW;																	// Average power, or -1 when unknown
+};
+
+
+//-------------------------------------------------------------
+static struct sweep_point_t points[SWEEP_MAX_POINTS];
+static int nPoints;
+static struct perf_cores_t perf;												// Cycles and instructions per core
+static int hasPerf;																// True when all cores have counters
+
+
+
+//-------------------------------------------------------------
+// Add the frequencies a core offers to the sorted set of
+// operating points.
+static int add_core_points(const int cpu) {
+	char path[256], buf[1024], *p, *end;
+	long khz;
+	int i;
+
+	sys_path(path, sizeof(path),
+		"/sys/devices/system/cpu/cpu%d/cpufreq/scaling_available_frequencies", cpu);
+	if(read_file_str(path, buf, sizeof(buf)) <= 0) {
+		fprintf(stderr, "Error, core %d has no frequency table\n", cpu);
+		return -1;
+	}
+
+	for(p = buf; ; p = end) {
+		khz = strtol(p, &end, 10);
+		if(end == p) break;
+		if(khz <= 0) continue;
+
+		for(i = 0; i < nPoints && points[i].khz < khz; i++);
+		if(i < nPoints && points[i].khz == khz) continue;
+		if(nPoints >= SWEEP_MAX_POINTS) break;
+		memmove(&points[i + 1], &points[i], (nPoints - i) * sizeof(points[0]));
+		memset(&points[i], 0, sizeof(points[i]));
+		points[i].khz = khz;
+		nPoints++;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Sum the cycles and instructions of the cores we load.
+// Idle cores would only dilute the clock per core.
+static void read_counters(uint64_t *cycles, uint64_t *instr) {
+	uint64_t val[2];
+	int i;
+
+	*cycles = 0;
+	*instr = 0;
+	for(i = 0; hasPerf && i < high_load_cores(); i++) {
+		if(perf_read_core(&perf, high_load_cpu(i), &val[0], &val[1])) continue;
+		*cycles += val[0];
+		*instr += val[1];
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Run one load cycle at operating point <pt>. Returns
+// -1 on error and if the result is inconclusive.
+static int run_point(struct sweep_point_t *pt, const int hasTemp, const int baseTemp) {
+	uint64_t cycles[2], instr[2];
+	int res, temp[2];
+	int64_t start, ms;
+
+	res = run_cooldown(baseTemp + SWEEP_COOL_MARGIN, SWEEP_COOL_TIMEOUT);
+	if(res || isExitRequested()) return -1;
+	if(power_state_max_freq(pt->khz)) return -1;
+
+	if(!hasTemp || read_soc_temp(&temp[0])) temp[0] = baseTemp;
+	read_counters(&cycles[0], &instr[0]);
+	start = mono_ns();
+
+	/* A brownout ends the cycle with an error, so
+	 * check the throttled bits before the result. */
+	res = run_cycle();
+	read_counters(&cycles[1], &instr[1]);
+	pt->isDone = 1;
+	pt->throttled = vchiq_cycle_throttled();
+	pt->firstMs = vchiq_first_throttle();
+	if(isExitRequested()) return -1;
+
+	ms = (mono_ns() - start) / 1000000LL;
+	if(ms < 1) ms = 1;
+	pt->slope = INT_MIN;
+	if(hasTemp && !read_soc_temp(&temp[1])) {
+		pt->slope = (temp[1] - temp[0]) * 1000LL / ms;
+	}
+	if(hasPerf) {
+		pt->instrRate = (instr[1] - instr[0]) * 1000.0 / ms;
+		pt->mhz = (cycles[1] - cycles[0]) / 1000.0 / ms / high_load_cores();
+	}
+	if(sensor_run_power(&pt->milliW)) pt->milliW = -1;
+
+	printf("  %5ld MHz  throttled 0x%05x%s\n", pt->khz / 1000, pt->throttled,
+		hasCycleBrownOut() ? "  brownout" : (isCycleHeated() ? "  throttled" : ""));
+
+	return (res && !hasCycleBrownOut() && !isCycleHeated()) ? -1 : 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Print the table of all operating points tested
+static void print_table(void) {
+	struct sweep_point_t *pt;
+	int i;
+
+	printf("\n   MHz  throttled  first ms   mC/s  Minstr/s  core MHz  avg W\n");
+	for(i = 0; i < nPoints; i++) {
+		pt = &points[i];
+		if(!pt->isDone) continue;
+		printf(" %5ld    0x%05x", pt->khz / 1000, pt->throttled);
+		if(pt->firstMs >= 0) printf("  %8d", pt->firstMs);
+		else printf("         -");
+		if(pt->slope != INT_MIN) printf("  %5d", pt->slope);
+		else printf("      -");
+		if(hasPerf) printf("  %8.0f  %8.0f", pt->instrRate / 1e6, pt->mhz);
+		else printf("         -         -");
+		if(pt->milliW >= 0) printf("  %5.2f", pt->milliW / 1000.0);
+		else printf("      -");
+		printf("%s\n", (pt->throttled & 1u) ? "  brownout" : "");
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Run a load cycle at every operating point, lowest
+// frequency first, and print the results. The cpufreq
+// settings are restored at exit.
+int sweep_dvfs(void) {
+	int i, res, hasTemp, baseTemp;
+
+	for(i = 0, res = 0; i < HW_MAX_CPUS && !res; i++) {
+		if(hwIdent.cpu[i].online) res = add_core_points(i);
+	}
+	if(res) return -1;
+	if(!nPoints) {
+		fprintf(stderr, "Error, no operating points\n");
+		return -1;
+	}
+
+	hasTemp = !read_soc_temp(&baseTemp);
+	if(!hasTemp) baseTemp = 0;													// No sensor; no cooldown
+	hasPerf = !perf_open_cores(&perf);											// Without counters the throughput isn't reported
+
+	printf("Sweeping %d operating points...\n", nPoints);
+	for(i = 0; i < nPoints && !res; i++) {
+		res = run_point(&points[i], hasTemp, baseTemp);
+	}
+
+	if(hasPerf) perf_close_cores(&perf);
+	hasPerf = 0;
+	print_table();
+
+	return res;
+}
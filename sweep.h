@@ -0,0 +1,9 @@
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+
+//-------------------------------------------------------------
+int sweep_dvfs(void);
+
+#endif
@@ -0,0 +1,612 @@
+
+/* Synchronized test of several boards sharing one power
+ * supply. One instance is coordinator and the others are
+ * participants. Participants register, estimate the
+ * offset between their monotonic clock and the one of
+ * the coordinator, NTP style, and then all start the
+ * load cycle at a common deadline. Throttle events are
+ * reported back to the coordinator which summarizes the
+ * combined result. Messages are short text datagrams
+ * over UDP or a Unix socket, so several instances can
+ * be tested on one host.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+
+#include "sync.h"
+#include "main.h"
+#include "misc.h"
+#include "vchiq.h"
+
+
+//-------------------------------------------------------------
+#define SYNC_MAX_BOARDS			32												// Max number of boards incl. the coordinator
+#define SYNC_MSG_LEN			128
+#define SYNC_PINGS				8												// Clock offset samples per participant
+#define SYNC_PING_TIMEOUT		200												// Max time in ms we wait for a ping reply
+#define SYNC_RESEND				500												// Time in ms between resends of unanswered messages
+#define SYNC_POLL				100												// Max time in ms between polls of exit request
+#define SYNC_START_DELAY		1000											// Time in ms from all boards ready to common start
+#define SYNC_REG_TIMEOUT		60000											// Max time in ms we wait for boards to register
+#define SYNC_RESULT_TIMEOUT		30000											// Max time in ms we wait for results after our own
+
+
+//-------------------------------------------------------------
+enum sync_role_t {
+	SYNC_NONE,
+	SYNC_COORDINATOR,
+	SYNC_PARTICIPANT,
+};
+
+struct board_t {
+	struct sockaddr_storage addr;												// Where the participant sends from
+	socklen_t addrLen;
+	char name[32];
+	int isReady;																// True when clock is synchronized
+	int hasResult;
+	int brownOut;																// Result of load cycle
+	int heated;
+	int firstThrott;															// Time in ms to first throttle event, or -1
+	int res;
+};
+
+
+//-------------------------------------------------------------
+static enum sync_role_t role;
+static const char *address;														// Socket address of coordinator
+static int nParticipants = 1;													// Number of participants the coordinator waits for
+static int sockFd = -1;
+static struct sockaddr_storage peer;											// Address of coordinator, for participants
+static socklen_t peerLen;
+static struct board_t boards[SYNC_MAX_BOARDS];									// Coordinator is the first
+static int nBoards;
+static int myId;																// Board number given by coordinator
+static int64_t clockOffset;														// Coordinator clock minus ours, in ns
+static int anyBrownOut;															// True when any board had a brownout
+
+
+
+//-------------------------------------------------------------
+// Act as coordinator at <addr>
+int sync_set_coordinator(const char *addr) {
+	role = SYNC_COORDINATOR;
+	address = addr;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Set number of participants the coordinator waits for
+// before the test starts.
+int sync_set_boards(const int n) {
+	if(n < 1 || n >= SYNC_MAX_BOARDS) {
+		fprintf(stderr, "Error, number of boards must be 1 to %d\n",
+			SYNC_MAX_BOARDS - 1);
+		return -1;
+	}
+	nParticipants = n;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Act as participant of the coordinator at <addr>
+int sync_set_participant(const char *addr) {
+	role = SYNC_PARTICIPANT;
+	address = addr;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when synchronized with other boards
+int sync_is_enabled(void) {
+	return role != SYNC_NONE;
+}
+
+
+
+//-------------------------------------------------------------
+// Returns true when any of the synchronized boards had
+// a brownout. Only known by the coordinator.
+int sync_has_brownout(void) {
+	return anyBrownOut;
+}
+
+
+
+//-------------------------------------------------------------
+// Open a datagram socket for <address>, which is either
+// "unix:<path>" or "<host>:<port>" for UDP. The host may
+// be left out by the coordinator to listen on all
+// interfaces. Participants bind to an anonymous address
+// so the coordinator can reply.
+static int open_socket(void) {
+	struct addrinfo hints, *ai;
+	struct sockaddr_un *sun;
+	char host[128], *port;
+	sa_family_t family;
+	int res;
+
+	if(!strncmp(address, "unix:", 5)) {
+		sun = (struct sockaddr_un*) &peer;
+		memset(sun, 0, sizeof(*sun));
+		sun->sun_family = AF_UNIX;
+		if(strlen(address + 5) >= sizeof(sun->sun_path)) {
+			fprintf(stderr, "Error, to long socket path\n");
+			return -1;
+		}
+		strcpy(sun->sun_path, address + 5);
+		peerLen = sizeof(*sun);
+
+		sockFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if(sockFd == -1) {
+			perror("Error creating sync socket");
+			return -1;
+		}
+
+		if(role == SYNC_COORDINATOR) {
+			unlink(sun->sun_path);
+			res = bind(sockFd, (struct sockaddr*) sun, peerLen);
+		}
+		else {
+			family = AF_UNIX;													// Kernel picks an abstract name
+			res = bind(sockFd, (struct sockaddr*) &family, sizeof(family));
+		}
+	}
+	else {
+		snprintf(host, sizeof(host), "%s", address);
+		port = strrchr(host, ':');
+		if(!port) {
+			fprintf(stderr, "Error, sync address must be host:port or unix:path\n");
+			return -1;
+		}
+		*port++ = 0;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = (role == SYNC_COORDINATOR) ? AI_PASSIVE : 0;
+		res = getaddrinfo(host[0] ? host : NULL, port, &hints, &ai);
+		if(res) {
+			fprintf(stderr, "Error resolving %s: %s\n", address, gai_strerror(res));
+			return -1;
+		}
+
+		memcpy(&peer, ai->ai_addr, ai->ai_addrlen);
+		peerLen = ai->ai_addrlen;
+		sockFd = socket(ai->ai_family, SOCK_DGRAM, 0);
+		freeaddrinfo(ai);
+		if(sockFd == -1) {
+			perror("Error creating sync socket");
+			return -1;
+		}
+
+		res = (role == SYNC_COORDINATOR) ?
+			bind(sockFd, (struct sockaddr*) &peer, peerLen) : 0;
+	}
+
+	if(res == -1) {
+		perror("Error binding sync socket");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Send a formatted message to <addr>
+static int send_msg(const struct sockaddr_storage *addr, const socklen_t addrLen,
+		const char *fmt, ...) {
+	char msg[SYNC_MSG_LEN];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+
+	if(sendto(sockFd, msg, len, 0, (const struct sockaddr*) addr, addrLen) == -1) {
+		if(role == SYNC_PARTICIPANT) perror("Error sending sync message");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Wait at most <ms> for a message. Signals are handled
+// meanwhile. Returns the message length, 0 on timeout
+// or -1 on error or when the user asks us to exit.
+static int recv_msg(char *msg, struct sockaddr_storage *from, socklen_t *fromLen,
+		const int ms) {
+	struct timeval timeout;
+	fd_set rfds;
+	int len;
+
+	if(run_idle(0) || isExitRequested()) return -1;
+
+	FD_ZERO(&rfds);
+	FD_SET(sockFd, &rfds);
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+	len = select(sockFd + 1, &rfds, NULL, NULL, &timeout);
+	if(len <= 0) return (len == -1 && errno != EINTR) ? -1 : 0;
+
+	*fromLen = sizeof(*from);
+	len = recvfrom(sockFd, msg, SYNC_MSG_LEN - 1, 0, (struct sockaddr*) from,
+		fromLen);
+	if(len == -1) {
+		perror("Error receiving sync message");
+		return -1;
+	}
+	msg[len] = 0;
+
+	return len;
+}
+
+
+
+//-------------------------------------------------------------
+// Find a registered board by the address it sends from
+static struct board_t* find_board(const struct sockaddr_storage *addr,
+		const socklen_t addrLen) {
+	int i;
+
+	for(i = 1; i < nBoards; i++) {
+		if(boards[i].addrLen == addrLen && !memcmp(&boards[i].addr, addr, addrLen)) {
+			return &boards[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+
+//-------------------------------------------------------------
+// Serve one message from a participant. Registration,
+// clock pings and results may arrive at any time since
+// datagrams are resent until they are answered. Replies
+// are best effort; a participant which got an earlier
+// reply may already be gone.
+static int coord_serve(const int ms, const int64_t deadline) {
+	struct sockaddr_storage from;
+	char msg[SYNC_MSG_LEN], name[32];
+	struct board_t *board;
+	socklen_t fromLen;
+	long long t1;
+	int len, id;
+
+	len = recv_msg(msg, &from, &fromLen, ms);
+	if(len <= 0) return len;
+
+	board = find_board(&from, fromLen);
+	id = board ? board - boards : -1;
+
+	if(sscanf(msg, "PING %lld", &t1) == 1) {
+		send_msg(&from, fromLen, "PONG %lld %lld", t1, (long long) mono_ns());
+	}
+	else if(sscanf(msg, "HELLO %31s", name) == 1) {
+		if(!board && nBoards < SYNC_MAX_BOARDS) {
+			board = &boards[nBoards];
+			id = nBoards++;
+			memset(board, 0, sizeof(*board));
+			memcpy(&board->addr, &from, fromLen);
+			board->addrLen = fromLen;
+			strcpy(board->name, name);
+			printf("Board %d registered: %s\n", id, name);
+		}
+		if(board) send_msg(&from, fromLen, "WELCOME %d", id);
+	}
+	else if(!strncmp(msg, "READY", 5) && board) {
+		board->isReady = 1;
+		if(deadline) send_msg(&from, fromLen, "START %lld", (long long) deadline);
+	}
+	else if(board && sscanf(msg, "RESULT %d %d %d %d", &board->brownOut,
+			&board->heated, &board->firstThrott, &board->res) == 4) {
+		board->hasResult = 1;
+		send_msg(&from, fromLen, "ACK");
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Count boards which are ready or have reported results
+static int count_boards(const int isResult) {
+	int i, n;
+
+	for(i = 1, n = 0; i < nBoards; i++) {
+		if(isResult ? boards[i].hasResult : boards[i].isReady) n++;
+	}
+
+	return n;
+}
+
+
+
+//-------------------------------------------------------------
+// Sleep until the local monotonic clock reaches <deadline>
+// ns. Signals are handled until the last few ms, which
+// are slept without interruption for precision.
+static int wait_deadline(const int64_t deadline) {
+	struct timespec t;
+	int64_t left;
+
+	while((left = (deadline - mono_ns()) / 1000000LL) > 2) {
+		if(run_idle(left - 2) || isExitRequested()) return -1;
+	}
+
+	t.tv_sec = deadline / 1000000000LL;
+	t.tv_nsec = deadline % 1000000000LL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Coordinator: wait for all participants to register and
+// synchronize, pick a common start time and tell them.
+static int coord_start(void) {
+	int64_t deadline, timeout;
+	int res, i;
+
+	printf("Waiting for %d boards at %s...\n", nParticipants, address);
+
+	res = 0;
+	timeout = mono_ns() + SYNC_REG_TIMEOUT * 1000000LL;
+	while(!res && count_boards(0) < nParticipants) {
+		if(mono_ns() > timeout) {
+			fprintf(stderr, "Error, only %d of %d boards ready\n",
+				count_boards(0), nParticipants);
+			return -1;
+		}
+		res = coord_serve(SYNC_POLL, 0);
+	}
+
+	deadline = mono_ns() + SYNC_START_DELAY * 1000000LL;
+	for(i = 1; i < nBoards && !res; i++) {
+		send_msg(&boards[i].addr, boards[i].addrLen, "START %lld",
+			(long long) deadline);
+	}
+
+	// Keep answering late ready messages until start
+	while(!res && (deadline - mono_ns()) / 1000000LL > SYNC_POLL) {
+		res = coord_serve(SYNC_POLL, deadline);
+	}
+
+	if(!res) res = wait_deadline(deadline);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Participant: register with the coordinator and send
+// a message, resent until a reply matching <expect>
+// arrives. Clock pings are answered by the caller.
+static int part_request(const char *msg, const char *expect, char *reply) {
+	struct sockaddr_storage from;
+	socklen_t fromLen;
+	int64_t timeout;
+	int len;
+
+	timeout = mono_ns() + SYNC_REG_TIMEOUT * 1000000LL;
+	while(mono_ns() < timeout) {
+		if(send_msg(&peer, peerLen, "%s", msg)) return -1;
+
+		do {
+			len = recv_msg(reply, &from, &fromLen, SYNC_RESEND);
+			if(len > 0 && !strncmp(reply, expect, strlen(expect))) return 0;
+		} while(len > 0);
+		if(len < 0) return -1;
+	}
+
+	fprintf(stderr, "Error, no reply from coordinator at %s\n", address);
+
+	return -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Participant: estimate the offset of our clock to the
+// one of the coordinator. The ping with the shortest
+// round trip has the least queueing, so assume it was
+// symmetric and use it.
+static int part_sync_clock(void) {
+	struct sockaddr_storage from;
+	char msg[SYNC_MSG_LEN];
+	int64_t t4, rtt, bestRtt;
+	long long t1, t2, echo;
+	socklen_t fromLen;
+	int i, len;
+
+	bestRtt = INT64_MAX;
+	for(i = 0; i < SYNC_PINGS; i++) {
+		t1 = mono_ns();
+		if(send_msg(&peer, peerLen, "PING %lld", t1)) return -1;
+
+		do {
+			len = recv_msg(msg, &from, &fromLen, SYNC_PING_TIMEOUT);
+			if(len < 0) return -1;
+		} while(len > 0 && !(sscanf(msg, "PONG %lld %lld", &echo, &t2) == 2 &&
+			echo == t1));
+		if(len == 0) continue;													// Lost, try again
+
+		t4 = mono_ns();
+		rtt = t4 - t1;
+		if(rtt < bestRtt) {
+			bestRtt = rtt;
+			clockOffset = t2 - (t1 + t4) / 2;
+		}
+	}
+
+	if(bestRtt == INT64_MAX) {
+		fprintf(stderr, "Error, no clock sync with coordinator\n");
+		return -1;
+	}
+
+	printf("Clock offset to coordinator %+.3f ms, round trip %.3f ms\n",
+		clockOffset / 1e6, bestRtt / 1e6);
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Participant: register, synchronize the clock and wait
+// for the common start time.
+static int part_start(void) {
+	char msg[SYNC_MSG_LEN], reply[SYNC_MSG_LEN], host[32];
+	long long deadline;
+	int res;
+
+	if(gethostname(host, sizeof(host))) strcpy(host, "unknown");
+	host[sizeof(host) - 1] = 0;
+	snprintf(msg, sizeof(msg), "HELLO %s.%d", host, getpid());
+
+	printf("Joining coordinator at %s...\n", address);
+	res = part_request(msg, "WELCOME", reply);
+	if(!res && sscanf(reply, "WELCOME %d", &myId) != 1) res = -1;
+	if(!res) printf("Joined as board %d\n", myId);
+	if(!res) res = part_sync_clock();
+	if(!res) res = part_request("READY", "START", reply);
+	if(!res && sscanf(reply, "START %lld", &deadline) != 1) res = -1;
+	if(!res) res = wait_deadline(deadline - clockOffset);
+
+	return res;
+}
+
+
+
+//-------------------------------------------------------------
+// Coordinator: collect the results of all participants
+// and print a summary.
+static int coord_finish(void) {
+	int64_t timeout;
+	struct board_t *b;
+	int i, nThrott, first;
+
+	timeout = mono_ns() + SYNC_RESULT_TIMEOUT * 1000000LL;
+	while(count_boards(1) < nBoards - 1 && mono_ns() < timeout) {
+		if(coord_serve(SYNC_POLL, 0) < 0) break;
+	}
+
+	printf("Synchronized result of %d boards:\n", nBoards);
+	nThrott = 0;
+	first = -1;
+	for(i = 0; i < nBoards; i++) {
+		b = &boards[i];
+		if(!b->hasResult) {
+			printf("  %-32s no result\n", b->name);
+			continue;
+		}
+
+		printf("  %-32s %s", b->name, b->brownOut ? "brownout" :
+			(b->heated ? "overheated" : (b->res ? "failed" : "OK")));
+		if(b->firstThrott >= 0) printf(", first throttle after %d ms", b->firstThrott);
+		printf("\n");
+
+		if(b->brownOut) anyBrownOut = 1;
+		if(b->firstThrott >= 0) {
+			nThrott++;
+			if(first < 0 || b->firstThrott < first) first = b->firstThrott;
+		}
+	}
+
+	if(nThrott) {
+		printf("Throttled on %d of %d boards, first after %d ms\n", nThrott,
+			nBoards, first);
+	}
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Run one load cycle in lock-step with the other boards
+// and report, or collect, the results.
+int sync_run(void) {
+	char msg[SYNC_MSG_LEN], reply[SYNC_MSG_LEN];
+	int res, cycleRes;
+
+	res = open_socket();
+	if(!res && role == SYNC_COORDINATOR) {
+		nBoards = 1;
+		memset(&boards[0], 0, sizeof(boards[0]));
+		if(gethostname(boards[0].name, sizeof(boards[0].name) - 1)) {
+			strcpy(boards[0].name, "coordinator");
+		}
+		res = coord_start();
+	}
+	else if(!res) {
+		res = part_start();
+	}
+	if(res) return res;
+
+	cycleRes = run_cycle();
+
+	if(role == SYNC_COORDINATOR) {
+		boards[0].hasResult = 1;
+		boards[0].brownOut = hasCycleBrownOut();
+		boards[0].heated = isCycleHeated();
+		boards[0].firstThrott = vchiq_first_throttle();
+		boards[0].res = cycleRes;
+		res = coord_finish();
+	}
+	else {
+		snprintf(msg, sizeof(msg), "RESULT %d %d %d %d", hasCycleBrownOut(),
+			isCycleHeated(), vchiq_first_throttle(), cycleRes);
+		res = part_request(msg, "ACK", reply);
+	}
+
+	return cycleRes ? cycleRes : res;
+}
+
+
+
+//-------------------------------------------------------------
+// Close the socket and remove a Unix socket file
+void sync_close(void) {
+	if(sockFd >= 0) close(sockFd);
+	sockFd = -1;
+
+	if(role == SYNC_COORDINATOR && !strncmp(address, "unix:", 5)) {
+		unlink(address + 5);
+	}
+}
@@ -0,0 +1,15 @@
+
+#ifndef SYNC_H
+#define SYNC_H
+
+
+//-------------------------------------------------------------
+int sync_set_coordinator(const char *addr);
+int sync_set_boards(const int n);
+int sync_set_participant(const char *addr);
+int sync_is_enabled(void);
+int sync_has_brownout(void);
+int sync_run(void);
+void sync_close(void);
+
+#endif
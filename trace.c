@@ -0,0 +1,350 @@
+
+/* Low overhead tracing of test phases and events. Every
+ * thread records into a buffer of its own, so no locks
+ * are needed, with raw timestamps from the processor
+ * counter. At exit the events are exported as a Chrome
+ * JSON trace, which Perfetto can open, with timestamps
+ * in CLOCK_MONOTONIC. Events can also be written to the
+ * ftrace trace_marker to line up with kernel events.
+ *
+ * Nard Linux SDK
+ * http://www.arbetsmyra.dyndns.org/nard
+ * Copyright (C) 2014-2017 Ronny Nilsson
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "hwprobe.h"
+#include "misc.h"
+#include "blackbox.h"
+
+
+//-------------------------------------------------------------
+#define TRACE_BUF_LEN		16384												// Max number of events per thread
+#define TRACE_MAX_BUFS		256													// Max number of traced threads, and of worker slots
+#define TRACE_EV_THREAD		0xffff												// Record of a new owner thread, <arg> is its tid
+
+
+//-------------------------------------------------------------
+struct trace_rec_t {
+	uint64_t cnt;																// Raw counter value
+	int32_t arg;
+	uint16_t event;
+};
+
+struct trace_buf_t {
+	int tid;																	// Linux PID of owner thread
+	int slot;																	// Worker slot, or -1 when owned by one thread
+	uint32_t len;																// Number of used records
+	uint32_t nDropped;															// Events lost due to full buffer
+	struct trace_rec_t rec[TRACE_BUF_LEN];
+};
+
+
+//-------------------------------------------------------------
+static const struct {
+	const char *name;
+	char phase;																	// Chrome trace event type
+} events[TR_N_EVENTS] = {
+	[TR_CYCLE_BEGIN] = { "cycle", 'B' },
+	[TR_CYCLE_END] = { "cycle", 'E' },
+	[TR_LOAD_BEGIN] = { "full load", 'B' },
+	[TR_LOAD_END] = { "full load", 'E' },
+	[TR_SPAWN] = { "spawn", 'i' },
+	[TR_CONSUMER_BEGIN] = { "consumer", 'B' },
+	[TR_CONSUMER_END] = { "consumer", 'E' },
+	[TR_CHILD_EXIT] = { "child exit", 'i' },
+	[TR_VCHIQ_POLL] = { "vchiq poll", 'i' },
+	[TR_THROTTLED] = { "throttled", 'C' },										// Counter track
+	[TR_FREQ_DROP] = { "freq drop", 'i' },
+};
+
+static int isEnabled;															// True when tracing is active
+static const char *traceFile;													// Where to export events, or NULL
+static int markerFd = -1;														// ftrace trace_marker
+static int hasArchTimer;														// True when ARM generic timer is readable
+static struct trace_buf_t *bufs[TRACE_MAX_BUFS];
+static struct trace_buf_t *slotBufs[TRACE_MAX_BUFS];							// Buffers of worker slots, reused across cycles
+static volatile int nBufs;														// Number of reserved entries in bufs
+static __thread struct trace_buf_t *myBuf;										// Buffer of calling thread
+static __thread int hasNoBuf;													// True when buffer allocation failed
+static volatile uint32_t nNoBuf;												// Events lost by threads without a buffer
+static uint64_t cnt0;															// Counter and clock at start, for calibration
+static int64_t mono0;
+
+
+
+//-------------------------------------------------------------
+// Read the raw processor counter. The ARMv7 generic
+// timer is missing in the ARM11 of BCM2835, where we
+// use the kernel clock instead.
+static inline uint64_t read_counter(void) {
+#if defined(__aarch64__)
+	uint64_t cnt;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r" (cnt));
+	return cnt;
+#elif defined(__arm__)
+	uint64_t cnt;
+
+	if(!hasArchTimer) return mono_ns();
+	asm volatile("mrrc p15, 1, %Q0, %R0, c14" : "=r" (cnt));
+	return cnt;
+#elif defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return mono_ns();
+#endif
+}
+
+
+
+//-------------------------------------------------------------
+// Allocate and register a buffer for the calling
+// thread. Registration is a single atomic add.
+static int get_buf(void) {
+	struct trace_buf_t *buf;
+	int idx;
+
+	if(hasNoBuf) return -1;
+
+	buf = calloc(1, sizeof(struct trace_buf_t));
+	idx = __sync_fetch_and_add(&nBufs, 1);
+	if(!buf || idx >= TRACE_MAX_BUFS) {
+		free(buf);
+		hasNoBuf = 1;
+		return -1;
+	}
+
+	buf->tid = syscall(SYS_gettid);
+	buf->slot = -1;
+	bufs[idx] = buf;
+	myBuf = buf;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Append a record to the buffer of the calling thread
+static void add_rec(const int event, const int arg) {
+	struct trace_rec_t *rec;
+
+	if(myBuf->len >= TRACE_BUF_LEN) {
+		myBuf->nDropped++;
+		return;
+	}
+
+	rec = &myBuf->rec[myBuf->len];
+	rec->cnt = read_counter();
+	rec->event = event;
+	rec->arg = arg;
+	myBuf->len++;
+}
+
+
+
+//-------------------------------------------------------------
+// Start tracing. Events are exported to <fileName> at
+// exit, if not NULL, and written to the ftrace marker
+// if <useMarker> is true.
+int trace_init(const char *fileName, const int useMarker) {
+	char path[256];
+
+	if(useMarker) {
+		sys_path(path, sizeof(path), "/sys/kernel/tracing/trace_marker");
+		markerFd = open(path, O_WRONLY);
+		if(markerFd == -1) {
+			sys_path(path, sizeof(path), "/sys/kernel/debug/tracing/trace_marker");
+			markerFd = open(path, O_WRONLY);
+		}
+		if(markerFd == -1) {
+			log_errno("Error opening ftrace trace_marker");
+			return -1;
+		}
+	}
+
+	hasArchTimer = hwIdent.cpuId != CPU_UNKNOWN && hwIdent.cpuId != CPU_BCM2835;
+	traceFile = fileName;
+	mono0 = mono_ns();
+	cnt0 = read_counter();
+	isEnabled = 1;
+
+	return 0;
+}
+
+
+
+//-------------------------------------------------------------
+// Record an event in the buffer of the calling thread
+void trace_event(const enum trace_event_t event, const int arg) {
+	char msg[64];
+	int len;
+
+	blackbox_event(event, arg);
+	if(likely(!isEnabled)) return;
+
+	if(markerFd >= 0) {
+		len = snprintf(msg, sizeof(msg), "rpiburn: %s %d\n",
+			events[event].name, arg);
+		write(markerFd, msg, len);
+	}
+
+	if(!traceFile) return;
+	if(!myBuf && get_buf()) {
+		__sync_fetch_and_add(&nNoBuf, 1);
+		return;
+	}
+
+	add_rec(event, arg);
+}
+
+
+
+//-------------------------------------------------------------
+// Let the calling worker thread record into the buffer
+// of worker slot <slot>. Workers are respawned every
+// cycle, and the previous one of the slot has been
+// joined, so the buffer is reused rather than taking
+// one per thread. A record marks the new owner.
+void trace_worker(const int slot) {
+	struct trace_buf_t *buf;
+
+	if(!isEnabled || !traceFile || slot < 0 || slot >= TRACE_MAX_BUFS) return;
+
+	buf = slotBufs[slot];
+	if(!buf) {
+		buf = calloc(1, sizeof(struct trace_buf_t));
+		if(!buf) return;
+		buf->slot = slot;
+		slotBufs[slot] = buf;
+	}
+
+	buf->tid = syscall(SYS_gettid);
+	myBuf = buf;
+	add_rec(TRACE_EV_THREAD, buf->tid);
+}
+
+
+
+//-------------------------------------------------------------
+// Name of an event
+const char* trace_event_name(const enum trace_event_t event) {
+	return event < TR_N_EVENTS ? events[event].name : "?";
+}
+
+
+
+//-------------------------------------------------------------
+// Export the records of one buffer. Records of a worker
+// slot start a new track at each owner thread.
+static void write_buf(FILE *fp, const struct trace_buf_t *buf, const double nsPerCnt,
+		int *isFirst) {
+	const struct trace_rec_t *rec;
+	int j, pid, tid;
+
+	pid = getpid();
+	tid = buf->tid;
+	if(buf->slot < 0) {
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+			"\"tid\":%d,\"args\":{\"name\":\"%s\"}}", *isFirst ? "" : ",\n",
+			pid, tid, tid == pid ? "monitor" : "thread");
+		*isFirst = 0;
+	}
+
+	for(j = 0; j < (int) buf->len; j++) {
+		rec = &buf->rec[j];
+		if(rec->event == TRACE_EV_THREAD) {
+			tid = rec->arg;
+			fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+				"\"tid\":%d,\"args\":{\"name\":\"child %d\"}}", *isFirst ? "" : ",\n",
+				pid, tid, buf->slot);
+			*isFirst = 0;
+			continue;
+		}
+
+		fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%.3f,"
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"%s\":%d}}", *isFirst ? "" : ",\n",
+			events[rec->event].name, events[rec->event].phase,
+			events[rec->event].phase == 'i' ? "\"s\":\"t\"," : "",
+			(mono0 + (int64_t) (rec->cnt - cnt0) * nsPerCnt) / 1000.0,
+			pid, tid, events[rec->event].phase == 'C' ? "value" : "arg", rec->arg);
+		*isFirst = 0;
+	}
+}
+
+
+
+//-------------------------------------------------------------
+// Stop tracing and export all buffers. Must be called
+// when all childs have been collected. The counter is
+// calibrated against the monotonic clock over the run.
+int trace_close(void) {
+	uint32_t nDropped;
+	double nsPerCnt;
+	int i, isFirst;
+	uint64_t cnt1;
+	int64_t mono1;
+	FILE *fp;
+
+	if(!isEnabled) return 0;
+	isEnabled = 0;
+
+	if(markerFd >= 0) close(markerFd);
+	markerFd = -1;
+	if(!traceFile) return 0;
+
+	mono1 = mono_ns();
+	cnt1 = read_counter();
+	nsPerCnt = (cnt1 > cnt0) ? (double) (mono1 - mono0) / (cnt1 - cnt0) : 1.0;
+
+	fp = fopen(traceFile, "w");
+	if(!fp) {
+		log_errno("Error creating trace file");
+		return -1;
+	}
+
+	nDropped = 0;
+	isFirst = 1;
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for(i = 0; i < nBufs && i < TRACE_MAX_BUFS; i++) {
+		if(!bufs[i]) continue;
+		nDropped += bufs[i]->nDropped;
+		write_buf(fp, bufs[i], nsPerCnt, &isFirst);
+		free(bufs[i]);
+		bufs[i] = NULL;
+	}
+	for(i = 0; i < TRACE_MAX_BUFS; i++) {
+		if(!slotBufs[i]) continue;
+		nDropped += slotBufs[i]->nDropped;
+		write_buf(fp, slotBufs[i], nsPerCnt, &isFirst);
+		free(slotBufs[i]);
+		slotBufs[i] = NULL;
+	}
+
+	fprintf(fp, "\n]}\n");
+	if(fclose(fp)) {
+		log_errno("Error writing trace file");
+		return -1;
+	}
+
+	if(nDropped) log_info("Warning, %u trace events dropped\n", nDropped);
+	if(nNoBuf) {
+		log_info("Warning, %u trace events dropped, more than %d "
+			"threads traced\n", nNoBuf, TRACE_MAX_BUFS);
+	}
+	nNoBuf = 0;
+
+	return 0;
+}
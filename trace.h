@@ -0,0 +1,30 @@
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+//-------------------------------------------------------------
+enum trace_event_t {
+	TR_CYCLE_BEGIN,																// Spawn and load cycle begins
+	TR_CYCLE_END,
+	TR_LOAD_BEGIN,																// All childs running, full load begins
+	TR_LOAD_END,
+	TR_SPAWN,																	// Parent spawned child <arg>
+	TR_CONSUMER_BEGIN,															// Child <arg> starts its consumer
+	TR_CONSUMER_END,
+	TR_CHILD_EXIT,																// Parent collected child, <arg> is exit status
+	TR_VCHIQ_POLL,																// Firmware polled, <arg> is throttled value
+	TR_THROTTLED,																// Throttled value changed to <arg>
+	TR_FREQ_DROP,																// Core <arg> frequency dropped
+	TR_N_EVENTS
+};
+
+
+//-------------------------------------------------------------
+int trace_init(const char *fileName, const int useMarker);
+void trace_event(const enum trace_event_t event, const int arg);
+void trace_worker(const int slot);
+const char* trace_event_name(const enum trace_event_t event);
+int trace_close(void);
+
+#endif
@@ -27,6 +27,7 @@
 #include "vchiq_cfg.h"
 #include "vc_gencmd_defs.h"
 #include "misc.h"
+#include "trace.h"
 
 
 //-------------------------------------------------------------
@@ -55,6 +56,9 @@ static int responseLen;															// Length of received data
 static int responseErr;															// Received error from firmware (if any)
 static unsigned int throttVal;													// Lates "throttled" value as recived from firmware
 static unsigned int throttSaved;												// Saved "throttled" value as recived from firmware
+static unsigned int throttCycle;												// Saved "throttled" value of current load cycle
+static int64_t cycleStart;														// When current load cycle began, in ns
+static int firstThrott;															// Time in ms to first throttle event of cycle, or -1
 
 
 
@@ -69,7 +73,7 @@ int vchiq_init(void) {
 
 	vchiqFd = open("/dev/vchiq", O_RDWR);
 	if(vchiqFd == -1) {
-		perror("Error opening vchiq");
+		log_errno("Error opening vchiq");
 		return -1;
 	}
 
@@ -79,12 +83,12 @@ int vchiq_init(void) {
 	cnfArg.pconfig = &config;
 	res = ioctl(vchiqFd, VCHIQ_IOC_GET_CONFIG, &cnfArg);
 	if(res == -1) {
-		perror("Error vchiq config");
+		log_errno("Error vchiq config");
 		return -1;
 	}
 	else if(config.version < VCHIQ_VERSION_MIN ||
 			config.version_min > VCHIQ_VERSION) {
-		printf("Error, incompatible vchiq version %d\n", config.version);
+		log_info("Error, incompatible vchiq version %d\n", config.version);
 		return -1;
 	}
 	else if(res == 0) {
@@ -92,7 +96,7 @@ int vchiq_init(void) {
 		maxMsgSize = config.max_msg_size;
 	}
 	else {
-		printf("Can't get vchiq config\n");
+		log_info("Can't get vchiq config\n");
 		return -1;
 	}
 
@@ -100,7 +104,7 @@ int vchiq_init(void) {
 	// Connect to kernel VCHIQ
 	res = ioctl(vchiqFd, VCHIQ_IOC_CONNECT, 0);
 	if(res == -1) {
-		perror("Error vchiq connect");
+		log_errno("Error vchiq connect");
 		return -1;
 	}
 	else if(res == 0) {
@@ -108,7 +112,7 @@ int vchiq_init(void) {
 		isConnected = 1;
 	}
 	else {
-		printf("Can't connect to vchiq\n");
+		log_info("Can't connect to vchiq\n");
 		return -1;
 	}
 
@@ -123,22 +127,21 @@ int vchiq_init(void) {
 	srvArg.handle = VCHIQ_SERVICE_HANDLE_INVALID;
 	res = ioctl(vchiqFd, VCHIQ_IOC_CREATE_SERVICE, &srvArg);
 	if(res == -1) {
-		perror("Error vchiq create service");
+		log_errno("Error vchiq create service");
 		return -1;
 	}
 	else if(srvArg.handle == VCHIQ_SERVICE_HANDLE_INVALID ||
 			srvArg.handle == VCHIQ_INVALID_HANDLE) {
-		printf("Error, vchiq service invalid handle\n");
+		log_info("Error, vchiq service invalid handle\n");
 		return -1;
 	}
 	else if(res == 0) {
 		handle = srvArg.handle;
 		vchiqState = R_VCHIQ_VERSION;
-		maxSleep(0);
 		//printf("Service GCMD created with handle %u\n", handle);
 	}
 	else {
-		printf("Can't create vchiq service\n");
+		log_info("Can't create vchiq service\n");
 		return -1;
 	}
 
@@ -156,12 +159,12 @@ int vchiq_close(void) {
 
 	if(handle != VCHIQ_INVALID_HANDLE && handle != VCHIQ_SERVICE_HANDLE_INVALID) {
 		res = ioctl(vchiqFd, VCHIQ_IOC_CLOSE_SERVICE, handle);
-		if(res == -1) perror("Error vchiq close service");
+		if(res == -1) log_errno("Error vchiq close service");
 		handle = VCHIQ_INVALID_HANDLE;
 	}
 
 	res = ioctl(vchiqFd, VCHIQ_IOC_SHUTDOWN, 0);
-	if(res == -1) perror("Error vchiq shutdown");
+	if(res == -1) log_errno("Error vchiq shutdown");
 	isConnected = 0;
 
 	close(vchiqFd);
@@ -188,7 +191,7 @@ static int vchiq_send_string(const char *msg) {
 	assert(vchiqFd >= 0);
 	res = ioctl(vchiqFd, VCHIQ_IOC_QUEUE_MESSAGE, &arg);
 	if(res == -1) {
-		perror("Error sending message");
+		log_errno("Error sending message");
 		return -1;
 	}
 
@@ -215,7 +218,7 @@ static int vchiq_receive_string(void) {
 	res = ioctl(vchiqFd, VCHIQ_IOC_DEQUEUE_MESSAGE, &arg);
 
 	if(res == -1) {
-		perror("Error reciving message");
+		log_errno("Error reciving message");
 		free(arg.buf);
 		return -1;
 	}
@@ -255,6 +258,16 @@ int hasBrownOut(void) {
 
 
 
+//-------------------------------------------------------------
+// Forget brownouts saved for the whole run. For modes
+// which provoke them on purpose and grade the supply
+// by other means.
+void vchiq_forget_brownout(void) {
+	throttSaved &= ~0x10001u;
+}
+
+
+
 //-------------------------------------------------------------
 // Return true if processor has become to hot.
 int isHeated(void) {
@@ -263,10 +276,66 @@ int isHeated(void) {
 
 
 
+//-------------------------------------------------------------
+// Forget throttled bits seen in previous load cycles.
+// The bits saved for the whole run are kept.
+void vchiq_new_cycle(void) {
+	throttCycle = 0;
+	cycleStart = mono_ns();
+	firstThrott = -1;
+}
+
+
+
+//-------------------------------------------------------------
+// Return time in ms from start of the current load
+// cycle to the first throttle event, or -1 if none.
+int vchiq_first_throttle(void) {
+	return firstThrott;
+}
+
+
+
+//-------------------------------------------------------------
+// Return the latest throttled value from the firmware
+unsigned int vchiq_throttled(void) {
+	return throttVal;
+}
+
+
+
+//-------------------------------------------------------------
+// Return all throttled bits seen in the current load
+// cycle, as received from the firmware.
+unsigned int vchiq_cycle_throttled(void) {
+	return throttCycle;
+}
+
+
+
+//-------------------------------------------------------------
+// Return true if we have had a voltage brown out in
+// the current load cycle.
+int hasCycleBrownOut(void) {
+	return ((throttCycle & 1u) ? 1 : 0);
+}
+
+
+
+//-------------------------------------------------------------
+// Return true if processor has become to hot in the
+// current load cycle.
+int isCycleHeated(void) {
+	return ((throttCycle & 6u) ? 1 : 0);
+}
+
+
+
 //-------------------------------------------------------------
 // Handle VCHIQ state machine. Regularly query the
 // firmware for if we have a brown out situation.
-int vchiq_manager(void) {
+int vchiq_manager(int *sleepMs) {
+	unsigned int lastVal;
 	int res = 0;
 
 	// Send query
@@ -294,29 +363,36 @@ int vchiq_manager(void) {
 	// Parse ASCII response from firmware
 	if(strstr(responseBuf, "Broadcom")) {
 		vchiqState = R_VCHIQ_COMMANDS;
-		maxSleep(0);
+		sleep_limit(sleepMs, 0);
 		//printf("Got valid firmware version; good.\n");
 	}
 	else if(strstr(responseBuf, "get_throttled")) {
 		vchiqState = R_VCHIQ_BROWNOUT;
-		maxSleep(0);
+		sleep_limit(sleepMs, 0);
 		//printf("Firmware has throttled command; good.\n");
 	}
 	else if(strstr(responseBuf, "throttled=")) {
+		lastVal = throttVal;
 		res = sscanf(responseBuf, "throttled=%x", &throttVal);
 		if(res == 1) {
 			//printf("Trottled value %x\n", throttVal);
+			trace_event(TR_VCHIQ_POLL, throttVal);
+			if(throttVal != lastVal) trace_event(TR_THROTTLED, throttVal);
 			throttSaved |= throttVal;
+			if(!(throttCycle & 7u) && (throttVal & 7u)) {
+				firstThrott = (mono_ns() - cycleStart) / 1000000LL;
+			}
+			throttCycle |= throttVal;
 			res = 0;
 		}
 		else {
-			printf("Error parsing throttled value\n");
+			log_info("Error parsing throttled value\n");
 			res = -1;
 		}
-		maxSleep(BROWNOUT_POLL_DELAY);
+		sleep_limit(sleepMs, BROWNOUT_POLL_DELAY);
 	}
 	else {
-		printf("Warning, invalid response from VCHIQ\n");
+		log_info("Warning, invalid response from VCHIQ\n");
 		res = -1;
 	}
 
@@ -7,7 +7,14 @@ int vchiq_init(void);
 int vchiq_close(void);
 int hasBrownOut(void);
 int isHeated(void);
-int vchiq_manager(void);
+void vchiq_forget_brownout(void);
+void vchiq_new_cycle(void);
+int hasCycleBrownOut(void);
+int isCycleHeated(void);
+int vchiq_first_throttle(void);
+unsigned int vchiq_throttled(void);
+unsigned int vchiq_cycle_throttled(void);
+int vchiq_manager(int *sleepMs);
 
 
 #endif